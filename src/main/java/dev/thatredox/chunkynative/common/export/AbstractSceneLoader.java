@@ -1,15 +1,20 @@
 package dev.thatredox.chunkynative.common.export;
 
 import dev.thatredox.chunkynative.common.export.models.PackedAabbModel;
-import dev.thatredox.chunkynative.common.export.models.PackedBvhNode;
+import dev.thatredox.chunkynative.common.export.models.PackedInstancedBvh;
 import dev.thatredox.chunkynative.common.export.models.PackedQuadModel;
 import dev.thatredox.chunkynative.common.export.models.PackedTriangleModel;
 import dev.thatredox.chunkynative.common.export.models.PackedWaterModel;
+import dev.thatredox.chunkynative.common.export.models.PackedWideBvh;
 import dev.thatredox.chunkynative.common.export.primitives.PackedBlock;
 import dev.thatredox.chunkynative.common.export.primitives.PackedMaterial;
 import dev.thatredox.chunkynative.common.export.primitives.PackedSun;
 import dev.thatredox.chunkynative.common.export.texture.AbstractTextureLoader;
 import dev.thatredox.chunkynative.util.Reflection;
+import it.unimi.dsi.fastutil.ints.Int2IntOpenHashMap;
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+import se.llbit.chunky.block.Block;
+import se.llbit.chunky.entity.Entity;
 import se.llbit.chunky.renderer.ResetReason;
 import se.llbit.chunky.renderer.scene.Scene;
 import se.llbit.chunky.renderer.scene.SceneEntities;
@@ -17,14 +22,22 @@ import se.llbit.chunky.renderer.scene.sky.Sun;
 import se.llbit.log.Log;
 import se.llbit.math.Octree;
 import se.llbit.math.PackedOctree;
+import se.llbit.math.Vector3;
+import se.llbit.math.Vector3i;
 import se.llbit.math.bvh.BVH;
 import se.llbit.math.bvh.BinaryBVH;
+import se.llbit.math.primitive.Primitive;
 import se.llbit.math.primitive.TexturedTriangle;
 
 import java.lang.ref.WeakReference;
+import java.util.ArrayList;
 import java.util.Arrays;
+import java.util.List;
 
 public abstract class AbstractSceneLoader {
+    // Leaf size for BVHs that are not BinaryBVHs and must be rebuilt
+    protected static final int DEFAULT_BVH_LEAF_SIZE = 4;
+
     protected int modCount = 0;
     protected WeakReference<BVH> prevWorldBvh = new WeakReference<>(null, null);
     protected WeakReference<BVH> prevActorBvh = new WeakReference<>(null, null);
@@ -39,8 +52,14 @@ public abstract class AbstractSceneLoader {
     protected ResourcePalette<PackedWaterModel> waterPalette = null;
     protected ResourcePalette<PackedTriangleModel> trigPalette = null;
     protected int[] worldBvh = null;
-    protected int[] actorBvh = null;
+    // Traversal stack entries the world BVH needs, see PackedWideBvh.stackSize
+    protected int worldBvhStackSize = 0;
+    // Actor triangles as one triangle leaves, the actor BVH is built by the implementation
+    protected int[] actorTriangles = null;
     protected int[] blockMapping = null;
+    // Average ARGB color of every packed block, with an alpha of 0 for invisible blocks
+    protected Int2IntOpenHashMap blockColors = null;
+    protected boolean hasWater = true;
     protected PackedSun packedSun = null;
 
     public boolean ensureLoad(Scene scene) {
@@ -92,14 +111,29 @@ public abstract class AbstractSceneLoader {
                 prevWorldBvh.get() != worldBvh ||
                 prevActorBvh.get() != actorBvh;
 
-        if (needTextureLoad) {
-            if (!(worldBvh instanceof BinaryBVH || worldBvh == BVH.EMPTY)) {
-                Log.error("BVH implementation must extend BinaryBVH");
-                return false;
+        // If only the actors changed, keep everything else and just replace the actor triangles
+        boolean actorsOnly = false;
+        if (prevActorBvh.get() != actorBvh && resetReason != ResetReason.MATERIALS_CHANGED &&
+                prevWorldBvh.get() == worldBvh && this.texturePalette != null &&
+                prevWorldOctree.get() == scene.getWorldOctree().getImplementation() &&
+                prevWaterOctree.get() == scene.getWaterOctree().getImplementation() &&
+                primitivesOf(actorBvh) != null) {
+            int[] triangles = packActorTriangles(actorBvh, this.texturePalette, this.materialPalette);
+            if (triangles != null) {
+                prevActorBvh = new WeakReference<>(actorBvh, null);
+                this.actorTriangles = triangles;
+                loadActorTriangles(triangles);
+                actorsOnly = true;
+                needTextureLoad = false;
             }
-            if (!(actorBvh instanceof BinaryBVH || actorBvh == BVH.EMPTY)) {
-                Log.error("BVH implementation must extend BinaryBVH");
-                return false;
+        }
+
+        if (needTextureLoad) {
+            for (BVH bvh : new BVH[] {worldBvh, actorBvh}) {
+                if (primitivesOf(bvh) == null) {
+                    Log.error("Cannot read the primitives of BVH implementation " + bvh.getClass().getName());
+                    return false;
+                }
             }
             prevWorldBvh = new WeakReference<>(worldBvh, null);
             prevActorBvh = new WeakReference<>(actorBvh, null);
@@ -108,31 +142,36 @@ public abstract class AbstractSceneLoader {
         // Preload textures
         if (needTextureLoad) {
             scene.getPalette().getPalette().forEach(b -> PackedBlock.preloadTextures(b, texturePalette));
-            if (worldBvh != BVH.EMPTY) preloadBvh((BinaryBVH) worldBvh, texturePalette);
-            if (actorBvh != BVH.EMPTY) preloadBvh((BinaryBVH) actorBvh, texturePalette);
+            preloadBvh(worldBvh, texturePalette);
+            preloadBvh(actorBvh, texturePalette);
             texturePalette.get(Sun.texture);
             texturePalette.build();
         }
 
         int[] blockMapping = null;
         int[] packedWorldBvh;
-        int[] packedActorBvh;
+        int[] packedActorTriangles;
 
         if (needTextureLoad) {
             blockMapping = scene.getPalette().getPalette().stream()
                     .mapToInt(block ->
                             blockPalette.put(new PackedBlock(block, texturePalette, materialPalette, aabbPalette, quadPalette, waterPalette)))
                     .toArray();
-            if (worldBvh != BVH.EMPTY) {
-                packedWorldBvh = loadBvh((BinaryBVH) worldBvh, texturePalette, materialPalette, trigPalette);
-            } else {
-                packedWorldBvh = PackedBvhNode.EMPTY_NODE.node;
+            Int2IntOpenHashMap blockColors = new Int2IntOpenHashMap();
+            List<Block> blocks = scene.getPalette().getPalette();
+            for (int i = 0; i < blockMapping.length; i++) {
+                Block block = blocks.get(i);
+                blockColors.put(blockMapping[i], block.invisible ? 0 : block.texture.getAvgColor());
             }
-            if (actorBvh != BVH.EMPTY) {
-                packedActorBvh = loadBvh((BinaryBVH) actorBvh, texturePalette, materialPalette, trigPalette);
+            if (worldBvh != BVH.EMPTY) {
+                packedWorldBvh = useInstancing() ? loadInstancedBvh(scene, texturePalette, materialPalette, trigPalette) : null;
+                if (packedWorldBvh == null) {
+                    packedWorldBvh = loadBvh(worldBvh, texturePalette, materialPalette, trigPalette);
+                }
             } else {
-                packedActorBvh = PackedBvhNode.EMPTY_NODE.node;
+                packedWorldBvh = PackedWideBvh.EMPTY;
             }
+            packedActorTriangles = packActorTriangles(actorBvh, texturePalette, materialPalette);
             packedSun = new PackedSun(scene.sun(), texturePalette);
 
             if (this.texturePalette != null) this.texturePalette.release();
@@ -151,20 +190,26 @@ public abstract class AbstractSceneLoader {
             this.waterPalette = waterPalette;
             this.trigPalette = trigPalette;
             this.worldBvh = packedWorldBvh;
-            this.actorBvh = packedActorBvh;
+            this.worldBvhStackSize = PackedWideBvh.stackSize(packedWorldBvh);
+            this.actorTriangles = packedActorTriangles;
             this.blockMapping = blockMapping;
+            this.blockColors = blockColors;
+            loadActorTriangles(packedActorTriangles);
         }
 
         // Need to reload octree
         Octree.OctreeImplementation worldImpl = scene.getWorldOctree().getImplementation();
         Octree.OctreeImplementation waterImpl = scene.getWaterOctree().getImplementation();
-        if (resetReason == ResetReason.SCENE_LOADED ||
+        if ((resetReason == ResetReason.SCENE_LOADED && !actorsOnly) ||
                 prevWorldOctree.get() != worldImpl ||
                 prevWaterOctree.get() != waterImpl) {
             prevWorldOctree = new WeakReference<>(worldImpl, null);
             prevWaterOctree = new WeakReference<>(waterImpl, null);
             if (worldImpl instanceof PackedOctree && waterImpl instanceof PackedOctree) {
                 assert blockMapping != null;
+                // A root leaf of air means there is no water at all. Loaders that merge the water
+                // into the world octree clear this.
+                hasWater = ((PackedOctree) waterImpl).treeData[0] != 0;
                 if (!loadWorldOctree(((PackedOctree) worldImpl).treeData, worldImpl.getDepth(), blockMapping, blockPalette))
                     return false;
                 if (!loadWaterOctree(((PackedOctree) waterImpl).treeData, waterImpl.getDepth(), blockMapping, blockPalette))
@@ -178,26 +223,159 @@ public abstract class AbstractSceneLoader {
         return true;
     }
 
-    protected static void preloadBvh(BinaryBVH bvh, AbstractTextureLoader texturePalette) {
-        Arrays.stream(bvh.packedPrimitives).flatMap(Arrays::stream).forEach(primitive -> {
+    public boolean hasWater() {
+        return hasWater;
+    }
+
+    public boolean hasWorldBvh() {
+        return worldBvh != null && worldBvh != PackedWideBvh.EMPTY;
+    }
+
+    public boolean hasActorBvh() {
+        return actorTriangles != null && actorTriangles.length > 0;
+    }
+
+    /**
+     * Primitives of a BVH. Chunky's BinaryBVH keeps them in its leaves, other implementations are
+     * searched for an array of primitives.
+     *
+     * @return The primitives, or null if they cannot be found.
+     */
+    protected static Primitive[] primitivesOf(BVH bvh) {
+        if (bvh == BVH.EMPTY) {
+            return new Primitive[0];
+        }
+        Primitive[][] leaves = bvh instanceof BinaryBVH
+                ? ((BinaryBVH) bvh).packedPrimitives
+                : Reflection.findFieldOfType(bvh, Primitive[][].class);
+        if (leaves != null) {
+            return Arrays.stream(leaves).flatMap(Arrays::stream).toArray(Primitive[]::new);
+        }
+        return Reflection.findFieldOfType(bvh, Primitive[].class);
+    }
+
+    protected static void preloadBvh(BVH bvh, AbstractTextureLoader texturePalette) {
+        for (Primitive primitive : primitivesOf(bvh)) {
             if (primitive instanceof TexturedTriangle) {
                 texturePalette.get(((TexturedTriangle) primitive).material.texture);
             }
-        });
+        }
     }
 
-    protected static int[] loadBvh(BinaryBVH bvh,
-                                  AbstractTextureLoader texturePalette,
-                                  ResourcePalette<PackedMaterial> materialPalette,
-                                  ResourcePalette<PackedTriangleModel> trigPalette) {
-        int[] out = new int[bvh.packed.length];
-        for (int i = 0; i < out.length; i += 7) {
-            PackedBvhNode node = new PackedBvhNode(bvh.packed, i, bvh.packedPrimitives, texturePalette, materialPalette, trigPalette);
-            System.arraycopy(node.pack().elements(), 0, out, i, 7);
+    protected int[] loadBvh(BVH bvh,
+                            AbstractTextureLoader texturePalette,
+                            ResourcePalette<PackedMaterial> materialPalette,
+                            ResourcePalette<PackedTriangleModel> trigPalette) {
+        int leafSize = getBvhLeafSize();
+        if (leafSize == 0 && bvh instanceof BinaryBVH) {
+            return new PackedWideBvh((BinaryBVH) bvh, getBvhWidth(), texturePalette, materialPalette, trigPalette).pack().toIntArray();
         }
-        return out;
+
+        // Rebuild the tree over the triangles
+        TexturedTriangle[] triangles = Arrays.stream(primitivesOf(bvh))
+                .filter(p -> p instanceof TexturedTriangle)
+                .map(p -> (TexturedTriangle) p)
+                .toArray(TexturedTriangle[]::new);
+        SahBvhBuilder builder = new SahBvhBuilder(triangles, leafSize > 0 ? leafSize : DEFAULT_BVH_LEAF_SIZE);
+        return new PackedWideBvh(builder.packed, builder.leaves(triangles), getBvhWidth(),
+                texturePalette, materialPalette, trigPalette).pack().toIntArray();
     }
 
+    /**
+     * Pack the world entities as instances of shared models, see PackedInstancedBvh. This reads the
+     * entities instead of the world BVH, which has every entity flattened into it.
+     *
+     * @return The packed BVH, or null if no entity model repeats.
+     */
+    protected int[] loadInstancedBvh(Scene scene,
+                                     AbstractTextureLoader texturePalette,
+                                     ResourcePalette<PackedMaterial> materialPalette,
+                                     ResourcePalette<PackedTriangleModel> trigPalette) {
+        List<?> entities;
+        try {
+            SceneEntities sceneEntities = Reflection.getFieldValue(scene, "entities", SceneEntities.class);
+            entities = Reflection.getFieldValue(sceneEntities, "entities", List.class);
+        } catch (RuntimeException e) {
+            Log.warn("Entity instancing is not available", e);
+            return null;
+        }
+
+        // Entity primitives relative to their position, the scene is relative to its origin
+        Vector3i origin = scene.getOrigin();
+        List<PackedInstancedBvh.Instance> instances = new ArrayList<>(entities.size());
+        for (Object o : entities) {
+            Entity entity = (Entity) o;
+            Vector3 offset = new Vector3(-entity.position.x, -entity.position.y, -entity.position.z);
+            instances.add(new PackedInstancedBvh.Instance(entity.primitives(offset).toArray(new Primitive[0]),
+                    entity.position.x - origin.x, entity.position.y - origin.y, entity.position.z - origin.z));
+        }
+
+        int leafSize = getBvhLeafSize();
+        PackedInstancedBvh bvh;
+        try {
+            bvh = PackedInstancedBvh.build(instances, getBvhWidth(), leafSize > 0 ? leafSize : DEFAULT_BVH_LEAF_SIZE,
+                    texturePalette, materialPalette, trigPalette);
+        } catch (IllegalArgumentException | IllegalStateException e) {
+            // A texture that was not preloaded from the world BVH
+            Log.warn("Entity instancing failed", e);
+            return null;
+        }
+        return bvh == null ? null : bvh.pack().toIntArray();
+    }
+
+    /**
+     * @return True to pack repeated entity models once, see PackedInstancedBvh.
+     */
+    protected boolean useInstancing() {
+        return false;
+    }
+
+    /**
+     * @return Number of children per BVH node, 4 or 8.
+     */
+    protected int getBvhWidth() {
+        return 4;
+    }
+
+    /**
+     * @return Largest number of triangles per leaf of the entity BVH built by SahBvhBuilder, or 0 to
+     * keep the tree Chunky built if it is a BinaryBVH.
+     */
+    protected int getBvhLeafSize() {
+        return 0;
+    }
+
+    /**
+     * Pack the triangles of the actor BVH as leaves of one triangle, in the layout of
+     * PackedTriangleModel.
+     *
+     * @return The packed leaves, or null if a triangle needs a texture or material the palettes
+     * do not have and cannot take anymore.
+     */
+    protected static int[] packActorTriangles(BVH bvh, AbstractTextureLoader texturePalette,
+                                              ResourcePalette<PackedMaterial> materialPalette) {
+        IntArrayList out = new IntArrayList();
+        try {
+            for (Primitive primitive : primitivesOf(bvh)) {
+                if (primitive instanceof TexturedTriangle) {
+                    // A leaf of one triangle
+                    out.addAll(new PackedTriangleModel(new Primitive[] {primitive}, texturePalette, materialPalette).pack());
+                }
+            }
+        } catch (IllegalArgumentException | IllegalStateException e) {
+            // Locked texture loader or palette
+            return null;
+        }
+        return out.toIntArray();
+    }
+
+    /**
+     * Upload the actor triangles and build the actor BVH over them.
+     *
+     * @param triangles Leaves packed by {@link #packActorTriangles}.
+     */
+    protected abstract void loadActorTriangles(int[] triangles);
+
     protected abstract boolean loadWorldOctree(int[] octree, int depth, int[] blockMapping, ResourcePalette<PackedBlock> blockPalette);
     protected abstract boolean loadWaterOctree(int[] octree, int depth, int[] blockMapping, ResourcePalette<PackedBlock> blockPalette);
 
@@ -0,0 +1,127 @@
+package dev.thatredox.chunkynative.common.export;
+
+import it.unimi.dsi.fastutil.ints.Int2IntOpenHashMap;
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+
+/**
+ * 64-ary tree of 4x4x4 bricks built from a packed octree. Every node is two ints of occupancy mask
+ * (bits 0-31, then 32-63) followed by one int for each occupied child, in bit order. A positive
+ * child is the index of a child node, anything else is a negated leaf like in the packed octree.
+ * The root is the node at index 0.
+ * <p>
+ * A child at position (x, y, z) in its brick is bit {@code (x << 4) | (y << 2) | z}. Every node
+ * covers two octree levels, so a tree of odd depth gets a root twice the size of the octree.
+ * <p>
+ * Subtrees shared in the octree (see {@link OctreeDag}) are emitted once and stay shared.
+ */
+public class BrickTree {
+    /** Value of the format int in the depth buffer. Must match OCTREE_FORMAT_BRICK in octree.h. */
+    public static final int FORMAT = 1;
+
+    private final int[] octree;
+    private final IntArrayList nodes = new IntArrayList();
+    // Brick tree value of every packed octree node emitted so far
+    private final Int2IntOpenHashMap emitted = new Int2IntOpenHashMap();
+
+    private BrickTree(int[] octree) {
+        this.octree = octree;
+    }
+
+    /**
+     * Build a brick tree. Leaves must already be in their final encoding.
+     *
+     * @param octree    Packed octree data.
+     * @param depth     Octree depth.
+     */
+    public static int[] build(int[] octree, int depth) {
+        BrickTree tree = new BrickTree(octree);
+        int[] children = new int[64];
+        for (int i = 0; i < 64; i++) {
+            int x = i >> 4;
+            int y = (i >> 2) & 3;
+            int z = i & 3;
+            if ((depth & 1) == 0) {
+                children[i] = descend(octree, octree[0], 2, x, y, z);
+            } else if (x < 2 && y < 2 && z < 2) {
+                children[i] = descend(octree, octree[0], 1, x, y, z);
+            }
+        }
+        tree.emit(children);
+        return tree.nodes.toIntArray();
+    }
+
+    /**
+     * Get a descendant of a packed octree node, or the leaf that contains it.
+     *
+     * @param steps Number of levels to go down. The position is in units of the descendant size.
+     */
+    private static int descend(int[] octree, int node, int steps, int x, int y, int z) {
+        for (int level = steps - 1; level >= 0 && node > 0; level--) {
+            node = octree[node + ((((x >> level) & 1) << 2) | (((y >> level) & 1) << 1) | ((z >> level) & 1))];
+        }
+        return node;
+    }
+
+    /**
+     * Append a node and its subtree. Children are packed octree values two levels below the node.
+     *
+     * @return Index of the node.
+     */
+    private int emit(int[] children) {
+        // Resolve the bricks of inner children first, uniform ones become leaves. Children that were
+        // already emitted are final values.
+        int[][] grandchildren = new int[64][];
+        int[] sources = new int[64];
+        for (int i = 0; i < 64; i++) {
+            int child = children[i];
+            if (child <= 0) continue;
+            if (emitted.containsKey(child)) {
+                children[i] = emitted.get(child);
+                continue;
+            }
+            int[] bricks = new int[64];
+            boolean uniform = true;
+            for (int j = 0; j < 64; j++) {
+                bricks[j] = descend(octree, child, 2, j >> 4, (j >> 2) & 3, j & 3);
+                uniform &= bricks[j] == bricks[0];
+            }
+            if (uniform && bricks[0] <= 0) {
+                children[i] = bricks[0];
+                emitted.put(child, bricks[0]);
+            } else {
+                grandchildren[i] = bricks;
+                sources[i] = child;
+            }
+        }
+
+        int maskLo = 0;
+        int maskHi = 0;
+        int count = 0;
+        for (int i = 0; i < 64; i++) {
+            if (children[i] == 0) continue;
+            if (i < 32) {
+                maskLo |= 1 << i;
+            } else {
+                maskHi |= 1 << (i - 32);
+            }
+            count++;
+        }
+
+        int index = nodes.size();
+        nodes.add(maskLo);
+        nodes.add(maskHi);
+        nodes.size(index + 2 + count);
+
+        int slot = index + 2;
+        for (int i = 0; i < 64; i++) {
+            int child = children[i];
+            if (child == 0) continue;
+            if (grandchildren[i] != null) {
+                child = emit(grandchildren[i]);
+                emitted.put(sources[i], child);
+            }
+            nodes.set(slot++, child);
+        }
+        return index;
+    }
+}
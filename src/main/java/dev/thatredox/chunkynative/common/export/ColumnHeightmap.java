@@ -0,0 +1,93 @@
+package dev.thatredox.chunkynative.common.export;
+
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+
+import java.util.Arrays;
+
+/**
+ * Vertical extent of the geometry in every column of an octree. Columns are at least a chunk wide,
+ * and are made wider on huge octrees to keep the map small.
+ * <p>
+ * Packed layout: column size shift, columns per axis, top of all geometry, then the bottom and
+ * (exclusive) top of every column, indexed by {@code (x >> shift) * columns + (z >> shift)}. Empty
+ * columns have a bottom and top of 0.
+ */
+public class ColumnHeightmap implements Packer {
+    private static final int MAX_COLUMN_BITS = 10;
+
+    private final int depth;
+    private final int shift;
+    private final int columns;
+    private final int[] bottom;
+    private final int[] top;
+
+    public ColumnHeightmap(int depth) {
+        this.depth = depth;
+        this.shift = Math.max(4, depth - MAX_COLUMN_BITS);
+        this.columns = 1 << Math.max(0, depth - shift);
+        this.bottom = new int[columns * columns];
+        this.top = new int[columns * columns];
+        Arrays.fill(bottom, Integer.MAX_VALUE);
+    }
+
+    /**
+     * Add the non-air leaves of a packed octree.
+     *
+     * @return False if the octree depth does not match.
+     */
+    public boolean add(int[] octree, int depth) {
+        if (depth != this.depth) {
+            return false;
+        }
+        add(octree, octree[0], depth, 0, 0, 0);
+        return true;
+    }
+
+    /**
+     * Mark every column as filled from the bottom to the top, which disables culling.
+     */
+    public void fill() {
+        Arrays.fill(bottom, 0);
+        Arrays.fill(top, 1 << depth);
+    }
+
+    private void add(int[] octree, int node, int level, int x, int y, int z) {
+        if (node > 0) {
+            int half = level - 1;
+            for (int i = 0; i < 8; i++) {
+                add(octree, octree[node + i], half,
+                        x + (((i >> 2) & 1) << half),
+                        y + (((i >> 1) & 1) << half),
+                        z + ((i & 1) << half));
+            }
+            return;
+        }
+        if (node == 0) {
+            return;
+        }
+
+        int size = 1 << level;
+        for (int cx = x >> shift; cx <= (x + size - 1) >> shift; cx++) {
+            for (int cz = z >> shift; cz <= (z + size - 1) >> shift; cz++) {
+                int index = cx * columns + cz;
+                bottom[index] = Math.min(bottom[index], y);
+                top[index] = Math.max(top[index], y + size);
+            }
+        }
+    }
+
+    @Override
+    public IntArrayList pack() {
+        IntArrayList packed = new IntArrayList(3 + 2 * bottom.length);
+        int globalTop = Arrays.stream(top).max().orElse(0);
+        packed.add(shift);
+        packed.add(columns);
+        packed.add(globalTop);
+        for (int i = 0; i < bottom.length; i++) {
+            boolean empty = top[i] == 0;
+            packed.add(empty ? 0 : bottom[i]);
+            packed.add(top[i]);
+        }
+        return packed;
+    }
+}
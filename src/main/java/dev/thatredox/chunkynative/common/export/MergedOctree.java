@@ -0,0 +1,86 @@
+package dev.thatredox.chunkynative.common.export;
+
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+import it.unimi.dsi.fastutil.longs.Long2IntOpenHashMap;
+
+/**
+ * World octree with the water octree merged into its leaves. Leaves with water are replaced by
+ * {@code -(MERGED_LEAF | pair)}, where {@code pair} indexes a table of (world block, water block)
+ * pairs. The pair table is uploaded after the tree data, see OCTREE_MERGED_LEAF in octree.h.
+ */
+public class MergedOctree {
+    /** Flag of leaves that index the pair table. Must match OCTREE_MERGED_LEAF in octree.h. */
+    public static final int MERGED_LEAF = 0x40000000;
+
+    private final int[] world;
+    private final int[] water;
+    private final IntArrayList nodes = new IntArrayList();
+    private final IntArrayList pairs = new IntArrayList();
+    private final Long2IntOpenHashMap pairIndex = new Long2IntOpenHashMap();
+
+    private MergedOctree(int[] world, int[] water) {
+        this.world = world;
+        this.water = water;
+        pairIndex.defaultReturnValue(-1);
+    }
+
+    /**
+     * Merge two packed octrees of the same depth. Leaves must already be in their final encoding.
+     */
+    public static MergedOctree build(int[] world, int[] water) {
+        MergedOctree tree = new MergedOctree(world, water);
+        tree.nodes.add(0);
+        tree.nodes.set(0, tree.merge(world[0], water[0]));
+        return tree;
+    }
+
+    public int[] getTree() {
+        return nodes.toIntArray();
+    }
+
+    /**
+     * @return Table of (world block, water block) pairs, as packed octree leaves.
+     */
+    public int[] getPairs() {
+        return pairs.toIntArray();
+    }
+
+    private int merge(int worldNode, int waterNode) {
+        if (worldNode <= 0 && waterNode <= 0) {
+            return leaf(worldNode, waterNode);
+        }
+
+        int index = nodes.size();
+        nodes.size(index + 8);
+        boolean uniform = true;
+        for (int i = 0; i < 8; i++) {
+            int child = merge(
+                    worldNode > 0 ? world[worldNode + i] : worldNode,
+                    waterNode > 0 ? water[waterNode + i] : waterNode);
+            nodes.set(index + i, child);
+            uniform &= child == nodes.getInt(index);
+        }
+        if (uniform && nodes.getInt(index) <= 0) {
+            // Every child is the same leaf, the node is only needed if it has children of its own
+            int leaf = nodes.getInt(index);
+            nodes.size(index);
+            return leaf;
+        }
+        return index;
+    }
+
+    private int leaf(int worldLeaf, int waterLeaf) {
+        if (waterLeaf == 0) {
+            return worldLeaf;
+        }
+        long key = ((long) worldLeaf << 32) | (waterLeaf & 0xFFFFFFFFL);
+        int pair = pairIndex.get(key);
+        if (pair < 0) {
+            pair = pairs.size() / 2;
+            pairs.add(worldLeaf);
+            pairs.add(waterLeaf);
+            pairIndex.put(key, pair);
+        }
+        return -(MERGED_LEAF | pair);
+    }
+}
@@ -0,0 +1,135 @@
+package dev.thatredox.chunkynative.common.export;
+
+import java.util.Arrays;
+
+/**
+ * Sparse voxel DAG built from a packed octree by sharing identical subtrees. The result keeps the
+ * node format of {@link se.llbit.math.PackedOctree}: a positive value is the index of 8 consecutive
+ * children, and anything else is a negated leaf. Traversal code reads both the same way.
+ */
+public class OctreeDag {
+    private final int[] source;
+    private int sourceSize = 1;
+
+    private int[] nodes = new int[1024];
+    private int size = 1;
+
+    // Open addressing table of the first child index of every unique node. 0 is an empty slot.
+    private int[] table = new int[1024];
+    private int tableSize = 0;
+
+    private OctreeDag(int[] source) {
+        this.source = source;
+    }
+
+    /**
+     * Deduplicate the subtrees of an octree. Leaves must already be in their final encoding, since
+     * only equal values are merged. Nodes whose children are 8 equal leaves become that leaf.
+     */
+    public static OctreeDag build(int[] octree) {
+        OctreeDag dag = new OctreeDag(octree);
+        dag.nodes[0] = dag.dedup(octree[0]);
+        dag.nodes = Arrays.copyOf(dag.nodes, dag.size);
+        dag.table = null;
+        return dag;
+    }
+
+    /**
+     * @return The deduplicated tree data.
+     */
+    public int[] getTree() {
+        return nodes;
+    }
+
+    /**
+     * @return Size of the reachable part of the source tree.
+     */
+    public int getSourceSize() {
+        return sourceSize;
+    }
+
+    public double getCompressionRatio() {
+        return (double) sourceSize / nodes.length;
+    }
+
+    private int dedup(int node) {
+        if (node <= 0) {
+            return node;
+        }
+        sourceSize += 8;
+
+        int[] children = new int[8];
+        boolean uniform = true;
+        for (int i = 0; i < 8; i++) {
+            children[i] = dedup(source[node + i]);
+            uniform &= children[i] == children[0];
+        }
+        if (uniform && children[0] <= 0) {
+            return children[0];
+        }
+        return intern(children);
+    }
+
+    private int intern(int[] children) {
+        int mask = table.length - 1;
+        for (int slot = hash(children, 0) & mask; ; slot = (slot + 1) & mask) {
+            int index = table[slot];
+            if (index == 0) {
+                index = append(children);
+                table[slot] = index;
+                if (++tableSize * 2 > table.length) {
+                    growTable();
+                }
+                return index;
+            }
+            if (matches(index, children)) {
+                return index;
+            }
+        }
+    }
+
+    private int append(int[] children) {
+        if (size + 8 > nodes.length) {
+            nodes = Arrays.copyOf(nodes, Math.max(nodes.length * 2, size + 8));
+        }
+        int index = size;
+        System.arraycopy(children, 0, nodes, index, 8);
+        size += 8;
+        return index;
+    }
+
+    private boolean matches(int index, int[] children) {
+        for (int i = 0; i < 8; i++) {
+            if (nodes[index + i] != children[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    private void growTable() {
+        int[] newTable = new int[table.length * 2];
+        int mask = newTable.length - 1;
+        for (int index : table) {
+            if (index == 0) continue;
+            int slot = hash(nodes, index) & mask;
+            while (newTable[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            newTable[slot] = index;
+        }
+        table = newTable;
+    }
+
+    private static int hash(int[] data, int offset) {
+        int hash = 0;
+        for (int i = 0; i < 8; i++) {
+            hash = 31 * hash + data[offset + i];
+        }
+        // Spread the bits, the children of neighbouring nodes are often close in value
+        hash ^= hash >>> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >>> 13;
+        return hash;
+    }
+}
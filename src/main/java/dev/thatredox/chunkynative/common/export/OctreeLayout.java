@@ -0,0 +1,89 @@
+package dev.thatredox.chunkynative.common.export;
+
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+
+import java.util.Arrays;
+
+/**
+ * Rewrites a packed octree in traversal order. The top levels are laid out breadth-first so the
+ * nodes every ray visits share a few cache lines, and every subtree below them is laid out
+ * depth-first so a walk through a subtree stays in one contiguous range. Child groups stay 8
+ * consecutive ints, so the result reads like any other packed octree. Shared subtrees of a DAG are
+ * kept shared.
+ */
+public class OctreeLayout {
+    /** Number of levels laid out breadth-first. */
+    private static final int BREADTH_FIRST_LEVELS = 6;
+
+    private final int[] source;
+    private final IntArrayList nodes = new IntArrayList();
+    // New index of every source child group, or -1
+    private final int[] moved;
+
+    private OctreeLayout(int[] source) {
+        this.source = source;
+        this.moved = new int[source.length];
+        Arrays.fill(moved, -1);
+    }
+
+    public static int[] reorder(int[] octree) {
+        OctreeLayout layout = new OctreeLayout(octree);
+        layout.nodes.add(octree[0]);
+
+        // Slots of the output that still point to a source group
+        IntArrayList frontier = new IntArrayList();
+        frontier.add(0);
+        for (int level = 0; level < BREADTH_FIRST_LEVELS && !frontier.isEmpty(); level++) {
+            IntArrayList next = new IntArrayList();
+            for (int i = 0; i < frontier.size(); i++) {
+                int group = layout.place(frontier.getInt(i));
+                if (group < 0) continue;
+                for (int child = 0; child < 8; child++) {
+                    if (layout.nodes.getInt(group + child) > 0) {
+                        next.add(group + child);
+                    }
+                }
+            }
+            frontier = next;
+        }
+
+        for (int i = 0; i < frontier.size(); i++) {
+            layout.placeDepthFirst(frontier.getInt(i));
+        }
+        return layout.nodes.toIntArray();
+    }
+
+    /**
+     * Move the group a slot points to, and update the slot.
+     *
+     * @return The new group index, or -1 if the slot is a leaf or the group was already moved.
+     */
+    private int place(int slot) {
+        int node = nodes.getInt(slot);
+        if (node <= 0) {
+            return -1;
+        }
+        if (moved[node] >= 0) {
+            nodes.set(slot, moved[node]);
+            return -1;
+        }
+
+        int group = nodes.size();
+        for (int i = 0; i < 8; i++) {
+            nodes.add(source[node + i]);
+        }
+        moved[node] = group;
+        nodes.set(slot, group);
+        return group;
+    }
+
+    private void placeDepthFirst(int slot) {
+        int group = place(slot);
+        if (group < 0) {
+            return;
+        }
+        for (int i = 0; i < 8; i++) {
+            placeDepthFirst(group + i);
+        }
+    }
+}
@@ -0,0 +1,106 @@
+package dev.thatredox.chunkynative.common.export;
+
+import java.util.function.IntUnaryOperator;
+
+/**
+ * Coarse levels of a packed octree for far-field rays. Every child group gets a representative
+ * block and an averaged color, so a traversal can stop at an interior node once the node is smaller
+ * than the ray footprint.
+ * <p>
+ * Packed layout: two ints per child group, indexed by {@code node >> 3}: the representative block
+ * (the block covering the most volume) and the volume weighted average color in ARGB, with the
+ * alpha set to the opacity of the node: the fraction of its volume that is covered, weighted by the
+ * alpha of the block colors. See Octree_intersectLod in octree.h.
+ */
+public class OctreeLod {
+    private final int[] tree;
+    private final IntUnaryOperator leafBlock;
+    private final IntUnaryOperator blockColor;
+    private final int[] lod;
+    // Volume of the representative block of every group, as a fraction of the group volume
+    private final float[] representative;
+    private final boolean[] done;
+
+    private OctreeLod(int[] tree, IntUnaryOperator leafBlock, IntUnaryOperator blockColor) {
+        this.tree = tree;
+        this.leafBlock = leafBlock;
+        this.blockColor = blockColor;
+        int groups = (tree.length >> 3) + 1;
+        this.lod = new int[2 * groups];
+        this.representative = new float[groups];
+        this.done = new boolean[groups];
+    }
+
+    /**
+     * Build the levels of a packed octree.
+     *
+     * @param tree       Packed octree with leaves in their final encoding. Child groups must start
+     *                   at indices {@code 1 + 8k}, as every packed layout here does.
+     * @param leafBlock  Block of a leaf value, 0 for empty leaves.
+     * @param blockColor Average ARGB color of a block, with an alpha of 0 for invisible blocks.
+     * @return The packed levels, or null if the child groups are not aligned.
+     */
+    public static int[] build(int[] tree, IntUnaryOperator leafBlock, IntUnaryOperator blockColor) {
+        for (int i = 0; i < tree.length; i++) {
+            if (tree[i] > 0 && (tree[i] & 7) != 1) {
+                return null;
+            }
+        }
+        OctreeLod builder = new OctreeLod(tree, leafBlock, blockColor);
+        if (tree[0] > 0) {
+            builder.group(tree[0]);
+        }
+        return builder.lod;
+    }
+
+    private void group(int node) {
+        int group = node >> 3;
+        if (done[group]) {
+            return;
+        }
+        done[group] = true;
+
+        float coverage = 0;
+        float r = 0, g = 0, b = 0;
+        int block = 0;
+        float blockCoverage = 0;
+        for (int i = 0; i < 8; i++) {
+            int child = tree[node + i];
+            int childBlock;
+            int childColor;
+            float childBlockCoverage;
+            if (child > 0) {
+                group(child);
+                childBlock = lod[2 * (child >> 3)];
+                childColor = lod[2 * (child >> 3) + 1];
+                childBlockCoverage = representative[child >> 3];
+            } else {
+                childBlock = leafBlock.applyAsInt(-child);
+                childColor = childBlock != 0 ? blockColor.applyAsInt(childBlock) : 0;
+                childBlockCoverage = (childColor >>> 24) / 255f;
+            }
+
+            float weight = (childColor >>> 24) / 255f;
+            if (weight == 0) continue;
+            coverage += weight;
+            r += weight * ((childColor >> 16) & 0xFF);
+            g += weight * ((childColor >> 8) & 0xFF);
+            b += weight * (childColor & 0xFF);
+            if (childBlockCoverage > blockCoverage) {
+                block = childBlock;
+                blockCoverage = childBlockCoverage;
+            }
+        }
+
+        int color = 0;
+        if (coverage > 0) {
+            color = (Math.round(coverage / 8 * 255) << 24)
+                    | (Math.round(r / coverage) << 16)
+                    | (Math.round(g / coverage) << 8)
+                    | Math.round(b / coverage);
+        }
+        lod[2 * group] = block;
+        lod[2 * group + 1] = color;
+        representative[group] = blockCoverage / 8;
+    }
+}
@@ -0,0 +1,172 @@
+package dev.thatredox.chunkynative.common.export;
+
+import it.unimi.dsi.fastutil.ints.Int2IntOpenHashMap;
+import it.unimi.dsi.fastutil.ints.Int2LongOpenHashMap;
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * Packed octree split into a resident top tree and pages that are streamed in on demand. Every
+ * subtree that fits in a page becomes one, and the nodes above them form the top tree. The top
+ * tree refers to a page with the leaf {@code -(PAGE_REF | page)}, see OCTREE_PAGE_REF in octree.h.
+ * <p>
+ * A page is a packed octree of its own: the root value at index 0 and child pointers relative to
+ * the page start. Pointers must be relocated when a page is uploaded.
+ * <p>
+ * Subtrees shared in the source (see {@link OctreeDag}) stay shared: a shared node of the top tree
+ * is split once, a shared subtree that fits in a page becomes one page, and shared groups within a
+ * page are copied once.
+ */
+public class PagedOctree {
+    /** Flag of top tree leaves that refer to a page. Must match OCTREE_PAGE_REF in octree.h. */
+    public static final int PAGE_REF = 0x20000000;
+    /** Value of the format int in the depth buffer. Must match OCTREE_FORMAT_PAGED in octree.h. */
+    public static final int FORMAT = 2;
+
+    private final int[] source;
+    private final int pageSize;
+    // Size of the subtree of every child group in the source, 0 if not computed yet
+    private final long[] subtreeSize;
+
+    private final IntArrayList top = new IntArrayList();
+    private final List<int[]> pages = new ArrayList<>();
+    private final IntArrayList fallbacks = new IntArrayList();
+    // Top tree value of every source node split so far
+    private final Int2IntOpenHashMap splitNodes = new Int2IntOpenHashMap();
+
+    private PagedOctree(int[] source, int pageSize) {
+        this.source = source;
+        this.pageSize = pageSize;
+        this.subtreeSize = new long[source.length];
+    }
+
+    /**
+     * Split a packed octree into pages.
+     *
+     * @param octree   Packed octree data. Leaves must already be in their final encoding.
+     * @param depth    Octree depth.
+     * @param pageSize Size of a page in ints.
+     */
+    public static PagedOctree build(int[] octree, int depth, int pageSize) {
+        PagedOctree tree = new PagedOctree(octree, pageSize);
+        tree.top.add(0);
+        tree.split(0, octree[0], depth);
+        return tree;
+    }
+
+    /**
+     * @return Resident top tree.
+     */
+    public int[] getTop() {
+        return top.toIntArray();
+    }
+
+    public int getPageCount() {
+        return pages.size();
+    }
+
+    public int getPageSize() {
+        return pageSize;
+    }
+
+    /**
+     * @return Page data, with pointers relative to the page start.
+     */
+    public int[] getPage(int page) {
+        return pages.get(page);
+    }
+
+    /**
+     * @return Leaf that stands in for a page while it is not resident: the leaf covering the most
+     * volume of the page.
+     */
+    public int getFallback(int page) {
+        return fallbacks.getInt(page);
+    }
+
+    private void split(int slot, int node, int level) {
+        if (node <= 0) {
+            top.set(slot, node);
+        } else if (splitNodes.containsKey(node)) {
+            top.set(slot, splitNodes.get(node));
+        } else if (size(node) + 1 <= pageSize) {
+            top.set(slot, -(PAGE_REF | pages.size()));
+            splitNodes.put(node, top.getInt(slot));
+            addPage(node, level);
+        } else {
+            int group = top.size();
+            top.size(group + 8);
+            top.set(slot, group);
+            splitNodes.put(node, group);
+            for (int i = 0; i < 8; i++) {
+                split(group + i, source[node + i], level - 1);
+            }
+        }
+    }
+
+    // Expanded size, an upper bound of the size of a page with shared groups
+    private long size(int node) {
+        if (node <= 0) {
+            return 0;
+        }
+        if (subtreeSize[node] == 0) {
+            long size = 8;
+            for (int i = 0; i < 8; i++) {
+                size += size(source[node + i]);
+            }
+            subtreeSize[node] = size;
+        }
+        return subtreeSize[node];
+    }
+
+    private void addPage(int node, int level) {
+        IntArrayList page = new IntArrayList((int) size(node) + 1);
+        Int2LongOpenHashMap volume = new Int2LongOpenHashMap();
+        page.add(0);
+        copy(page, volume, new Int2IntOpenHashMap(), 0, node, level);
+        pages.add(page.toIntArray());
+
+        int fallback = 0;
+        long fallbackVolume = -1;
+        for (Int2LongOpenHashMap.Entry entry : volume.int2LongEntrySet()) {
+            if (entry.getLongValue() > fallbackVolume) {
+                fallback = entry.getIntKey();
+                fallbackVolume = entry.getLongValue();
+            }
+        }
+        fallbacks.add(fallback);
+    }
+
+    private void copy(IntArrayList page, Int2LongOpenHashMap volume, Int2IntOpenHashMap copied, int slot, int node, int level) {
+        if (node <= 0) {
+            page.set(slot, node);
+            volume.addTo(node, 1L << (3 * level));
+            return;
+        }
+        if (copied.containsKey(node)) {
+            page.set(slot, copied.get(node));
+            addVolume(volume, node, level);
+            return;
+        }
+        int group = page.size();
+        page.size(group + 8);
+        page.set(slot, group);
+        copied.put(node, group);
+        for (int i = 0; i < 8; i++) {
+            copy(page, volume, copied, group + i, source[node + i], level - 1);
+        }
+    }
+
+    // Count the leaves of a subtree that was already copied, for the fallback leaf
+    private void addVolume(Int2LongOpenHashMap volume, int node, int level) {
+        if (node <= 0) {
+            volume.addTo(node, 1L << (3 * level));
+            return;
+        }
+        for (int i = 0; i < 8; i++) {
+            addVolume(volume, source[node + i], level - 1);
+        }
+    }
+}
@@ -0,0 +1,368 @@
+package dev.thatredox.chunkynative.common.export;
+
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+import se.llbit.math.primitive.Primitive;
+import se.llbit.math.primitive.TexturedTriangle;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+import java.util.concurrent.ForkJoinPool;
+import java.util.concurrent.RecursiveTask;
+import java.util.stream.IntStream;
+
+/**
+ * Binned SAH BVH over boxes, usually entity triangles, as in Wald, "On fast Construction of
+ * SAH-based Bounding Volume Hierarchies" (2007). Subtrees and the binning of large nodes run on
+ * the ForkJoin common pool.
+ * <p>
+ * The result is in the layout of Chunky's BinaryBVH (7 ints per node: the second child or the
+ * negated leaf index, then the bounds as min x, max x, min y, max y, min z, max z) so PackedWideBvh
+ * collapses it like a tree built by Chunky.
+ */
+public class SahBvhBuilder {
+    private static final int BINS = 16;
+    // Nodes with fewer boxes are built and binned on the current thread
+    private static final int PARALLEL_THRESHOLD = 4096;
+    // Cost of a node visit relative to a triangle test
+    private static final float TRAVERSAL_COST = 1.0f;
+
+    /** Packed nodes in the layout of {@code BinaryBVH.packed}. */
+    public final int[] packed;
+    /** Indices of the boxes in every leaf. */
+    public final int[][] leaves;
+
+    private final int leafSize;
+    // Per box: bounds as min xyz, max xyz and the centroid
+    private final float[] bounds;
+    private final float[] centroids;
+    private final int[] order;
+
+    /**
+     * Build a BVH over triangles.
+     *
+     * @param triangles Triangles to build over.
+     * @param leafSize  Largest number of triangles in a leaf. Smaller nodes become leaves when the
+     *                  SAH does not find a cheaper split.
+     */
+    public SahBvhBuilder(TexturedTriangle[] triangles, int leafSize) {
+        this(triangleBounds(triangles), leafSize);
+    }
+
+    /**
+     * Build a BVH over boxes.
+     *
+     * @param bounds   Bounds of every box as min x, y, z, max x, y, z.
+     * @param leafSize Largest number of boxes in a leaf.
+     */
+    public SahBvhBuilder(float[] bounds, int leafSize) {
+        this.leafSize = Math.max(leafSize, 1);
+        int n = bounds.length / 6;
+        this.bounds = bounds;
+        this.centroids = new float[3 * n];
+        this.order = new int[n];
+        IntStream.range(0, n).parallel().forEach(this::prepare);
+
+        Node root;
+        if (n == 0) {
+            root = new Node(new float[6]);
+        } else {
+            float[] box = emptyBox();
+            float[] centroidBox = emptyBox();
+            boxes(0, n, box, centroidBox);
+            root = ForkJoinPool.commonPool().invoke(new BuildTask(0, n, box, centroidBox));
+        }
+
+        IntArrayList out = new IntArrayList();
+        List<int[]> leaves = new ArrayList<>();
+        flatten(root, out, leaves);
+        this.packed = out.toIntArray();
+        this.leaves = leaves.toArray(new int[0][]);
+    }
+
+    /**
+     * @return Bounds of the triangles as min x, y, z, max x, y, z.
+     */
+    public static float[] triangleBounds(TexturedTriangle[] triangles) {
+        float[] bounds = new float[6 * triangles.length];
+        IntStream.range(0, triangles.length).parallel().forEach(i -> {
+            TexturedTriangle t = triangles[i];
+            for (int axis = 0; axis < 3; axis++) {
+                double o = component(t.o.x, t.o.y, t.o.z, axis);
+                double b = o + component(t.e1.x, t.e1.y, t.e1.z, axis);
+                double c = o + component(t.e2.x, t.e2.y, t.e2.z, axis);
+                bounds[6 * i + axis] = (float) Math.min(o, Math.min(b, c));
+                bounds[6 * i + 3 + axis] = (float) Math.max(o, Math.max(b, c));
+            }
+        });
+        return bounds;
+    }
+
+    /**
+     * @return Leaves in the layout of {@code BinaryBVH.packedPrimitives}.
+     */
+    public Primitive[][] leaves(Primitive[] items) {
+        Primitive[][] out = new Primitive[leaves.length][];
+        for (int i = 0; i < leaves.length; i++) {
+            out[i] = new Primitive[leaves[i].length];
+            for (int j = 0; j < leaves[i].length; j++) {
+                out[i][j] = items[leaves[i][j]];
+            }
+        }
+        return out;
+    }
+
+    private void prepare(int i) {
+        for (int axis = 0; axis < 3; axis++) {
+            centroids[3 * i + axis] = (bounds[6 * i + axis] + bounds[6 * i + 3 + axis]) / 2;
+        }
+        order[i] = i;
+    }
+
+    private static double component(double x, double y, double z, int axis) {
+        return axis == 0 ? x : axis == 1 ? y : z;
+    }
+
+    private static final class Node {
+        final float[] box;
+        Node left = null;
+        Node right = null;
+        int start;
+        int count;
+
+        Node(float[] box) {
+            this.box = box;
+        }
+    }
+
+    /**
+     * Triangle counts and bounds of the bins of a node, on all three axes.
+     */
+    private static final class Bins {
+        final int[] counts = new int[3 * BINS];
+        final float[] boxes = new float[6 * 3 * BINS];
+        final float[] centroidBoxes = new float[6 * 3 * BINS];
+
+        Bins() {
+            for (int bin = 0; bin < 3 * BINS; bin++) {
+                setEmpty(boxes, 6 * bin);
+                setEmpty(centroidBoxes, 6 * bin);
+            }
+        }
+
+        Bins merge(Bins other) {
+            for (int bin = 0; bin < 3 * BINS; bin++) {
+                counts[bin] += other.counts[bin];
+                grow(boxes, 6 * bin, other.boxes, 6 * bin);
+                grow(centroidBoxes, 6 * bin, other.centroidBoxes, 6 * bin);
+            }
+            return this;
+        }
+    }
+
+    private final class BuildTask extends RecursiveTask<Node> {
+        private final int start;
+        private final int end;
+        private final float[] box;
+        private final float[] centroidBox;
+
+        BuildTask(int start, int end, float[] box, float[] centroidBox) {
+            this.start = start;
+            this.end = end;
+            this.box = box;
+            this.centroidBox = centroidBox;
+        }
+
+        @Override
+        protected Node compute() {
+            Node node = new Node(box);
+            int count = end - start;
+            if (count == 1) {
+                return leaf(node);
+            }
+
+            Bins bins = bin(start, end, centroidBox);
+            int bestAxis = -1;
+            int bestSplit = -1;
+            float bestCost = Float.POSITIVE_INFINITY;
+            float[] leftArea = new float[BINS];
+            int[] leftCount = new int[BINS];
+            for (int axis = 0; axis < 3; axis++) {
+                if (!(centroidBox[3 + axis] > centroidBox[axis])) continue;
+
+                // Sweep from the left, then find the cheapest split sweeping from the right
+                float[] acc = emptyBox();
+                int n = 0;
+                for (int b = 0; b < BINS - 1; b++) {
+                    grow(acc, 0, bins.boxes, 6 * (axis * BINS + b));
+                    n += bins.counts[axis * BINS + b];
+                    leftArea[b] = area(acc);
+                    leftCount[b] = n;
+                }
+                acc = emptyBox();
+                n = 0;
+                for (int b = BINS - 1; b > 0; b--) {
+                    grow(acc, 0, bins.boxes, 6 * (axis * BINS + b));
+                    n += bins.counts[axis * BINS + b];
+                    if (n == 0 || leftCount[b - 1] == 0) continue;
+                    float cost = leftArea[b - 1] * leftCount[b - 1] + area(acc) * n;
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b - 1;
+                    }
+                }
+            }
+
+            // Leaf if it is small enough and no split is cheaper: TRAVERSAL_COST + cost / area >= count
+            if (count <= leafSize && (bestAxis < 0 || bestCost >= (count - TRAVERSAL_COST) * area(box))) {
+                return leaf(node);
+            }
+
+            int mid;
+            float[] leftBox = emptyBox();
+            float[] leftCentroids = emptyBox();
+            float[] rightBox = emptyBox();
+            float[] rightCentroids = emptyBox();
+            if (bestAxis < 0) {
+                // Every centroid is the same, split in the middle
+                mid = start + count / 2;
+                boxes(start, mid, leftBox, leftCentroids);
+                boxes(mid, end, rightBox, rightCentroids);
+            } else {
+                for (int b = 0; b < BINS; b++) {
+                    int bin = 6 * (bestAxis * BINS + b);
+                    grow(b <= bestSplit ? leftBox : rightBox, 0, bins.boxes, bin);
+                    grow(b <= bestSplit ? leftCentroids : rightCentroids, 0, bins.centroidBoxes, bin);
+                }
+                mid = partition(bestAxis, bestSplit);
+            }
+
+            BuildTask left = new BuildTask(start, mid, leftBox, leftCentroids);
+            BuildTask right = new BuildTask(mid, end, rightBox, rightCentroids);
+            if (count > PARALLEL_THRESHOLD) {
+                left.fork();
+                node.right = right.compute();
+                node.left = left.join();
+            } else {
+                node.left = left.compute();
+                node.right = right.compute();
+            }
+            return node;
+        }
+
+        private Node leaf(Node node) {
+            node.start = start;
+            node.count = end - start;
+            return node;
+        }
+
+        /**
+         * Move the boxes in bins up to {@code split} to the front of the range.
+         *
+         * @return Start of the right side.
+         */
+        private int partition(int axis, int split) {
+            int i = start;
+            int j = end - 1;
+            while (i <= j) {
+                if (binIndex(centroidBox, axis, centroids[3 * order[i] + axis]) <= split) {
+                    i++;
+                } else {
+                    int tmp = order[i];
+                    order[i] = order[j];
+                    order[j--] = tmp;
+                }
+            }
+            return i;
+        }
+    }
+
+    private Bins bin(int start, int end, float[] centroidBox) {
+        if (end - start > PARALLEL_THRESHOLD) {
+            int chunks = (end - start + PARALLEL_THRESHOLD - 1) / PARALLEL_THRESHOLD;
+            return IntStream.range(0, chunks).parallel()
+                    .mapToObj(c -> bin(start + c * PARALLEL_THRESHOLD,
+                            Math.min(end, start + (c + 1) * PARALLEL_THRESHOLD), centroidBox))
+                    .reduce(Bins::merge)
+                    .orElseGet(Bins::new);
+        }
+
+        Bins bins = new Bins();
+        for (int i = start; i < end; i++) {
+            int t = order[i];
+            for (int axis = 0; axis < 3; axis++) {
+                int bin = axis * BINS + binIndex(centroidBox, axis, centroids[3 * t + axis]);
+                bins.counts[bin]++;
+                grow(bins.boxes, 6 * bin, bounds, 6 * t);
+                growPoint(bins.centroidBoxes, 6 * bin, centroids, 3 * t);
+            }
+        }
+        return bins;
+    }
+
+    private static int binIndex(float[] centroidBox, int axis, float centroid) {
+        float lo = centroidBox[axis];
+        float extent = centroidBox[3 + axis] - lo;
+        if (!(extent > 0)) return 0;
+        return Math.max(Math.min((int) ((centroid - lo) / extent * BINS), BINS - 1), 0);
+    }
+
+    private void boxes(int start, int end, float[] box, float[] centroidBox) {
+        for (int i = start; i < end; i++) {
+            grow(box, 0, bounds, 6 * order[i]);
+            growPoint(centroidBox, 0, centroids, 3 * order[i]);
+        }
+    }
+
+    private void flatten(Node node, IntArrayList out, List<int[]> leaves) {
+        int index = out.size();
+        out.size(index + 7);
+        for (int axis = 0; axis < 3; axis++) {
+            out.set(index + 1 + 2 * axis, Float.floatToIntBits(node.box[axis]));
+            out.set(index + 2 + 2 * axis, Float.floatToIntBits(node.box[3 + axis]));
+        }
+        if (node.left == null) {
+            out.set(index, -leaves.size());
+            leaves.add(Arrays.copyOfRange(order, node.start, node.start + node.count));
+        } else {
+            // The first child follows its parent
+            flatten(node.left, out, leaves);
+            out.set(index, out.size());
+            flatten(node.right, out, leaves);
+        }
+    }
+
+    private static float[] emptyBox() {
+        float[] box = new float[6];
+        setEmpty(box, 0);
+        return box;
+    }
+
+    private static void setEmpty(float[] box, int offset) {
+        Arrays.fill(box, offset, offset + 3, Float.POSITIVE_INFINITY);
+        Arrays.fill(box, offset + 3, offset + 6, Float.NEGATIVE_INFINITY);
+    }
+
+    private static void grow(float[] box, int offset, float[] other, int otherOffset) {
+        for (int axis = 0; axis < 3; axis++) {
+            box[offset + axis] = Math.min(box[offset + axis], other[otherOffset + axis]);
+            box[offset + 3 + axis] = Math.max(box[offset + 3 + axis], other[otherOffset + 3 + axis]);
+        }
+    }
+
+    private static void growPoint(float[] box, int offset, float[] points, int pointOffset) {
+        for (int axis = 0; axis < 3; axis++) {
+            box[offset + axis] = Math.min(box[offset + axis], points[pointOffset + axis]);
+            box[offset + 3 + axis] = Math.max(box[offset + 3 + axis], points[pointOffset + axis]);
+        }
+    }
+
+    private static float area(float[] box) {
+        float x = box[3] - box[0];
+        float y = box[4] - box[1];
+        float z = box[5] - box[2];
+        if (!(x >= 0 && y >= 0 && z >= 0)) return 0;
+        return x * y + y * z + z * x;
+    }
+}
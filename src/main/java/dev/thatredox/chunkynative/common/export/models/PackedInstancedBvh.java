@@ -0,0 +1,212 @@
+package dev.thatredox.chunkynative.common.export.models;
+
+import dev.thatredox.chunkynative.common.export.Packer;
+import dev.thatredox.chunkynative.common.export.ResourcePalette;
+import dev.thatredox.chunkynative.common.export.SahBvhBuilder;
+import dev.thatredox.chunkynative.common.export.primitives.PackedMaterial;
+import dev.thatredox.chunkynative.common.export.primitives.PackedTriangle;
+import dev.thatredox.chunkynative.common.export.texture.AbstractTextureLoader;
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+import se.llbit.math.primitive.Primitive;
+import se.llbit.math.primitive.TexturedTriangle;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+
+/**
+ * Two level BVH for entities that share a model. Every distinct model gets one bottom level BVH
+ * whose triangles are packed once, and a top level BVH over the entities places translated copies
+ * of it. See bvh.h for the layout.
+ * <p>
+ * Chunky poses entities before the plugin sees them, so models are found by comparing the triangles
+ * of every entity relative to its position, and an instance is only a translation.
+ * <p>
+ * Packed layout: the width with {@link #INSTANCED} set, the instance count, every instance as the
+ * root node of its model followed by the float translation, the top level nodes, then the bottom
+ * level nodes of every model. Leaves of the top level are negated indices of instances in this
+ * buffer, leaves of the bottom levels index the triangle model palette.
+ */
+public class PackedInstancedBvh implements Packer {
+    /** Set in the first int of an instanced BVH, next to the width. */
+    public static final int INSTANCED = 1 << 8;
+
+    static final int INSTANCE_SIZE = 4;
+    // Vertices are compared at this resolution, the positions of the entities change the last bits
+    private static final double KEY_SCALE = 1 << 12;
+
+    /**
+     * An entity: its primitives relative to its position, and the position in scene coordinates.
+     */
+    public static class Instance {
+        public final Primitive[] primitives;
+        public final double x;
+        public final double y;
+        public final double z;
+
+        public Instance(Primitive[] primitives, double x, double y, double z) {
+            this.primitives = primitives;
+            this.x = x;
+            this.y = y;
+            this.z = z;
+        }
+    }
+
+    private static final class Model {
+        final TexturedTriangle[] triangles;
+        float[] bounds;
+        SahBvhBuilder bvh;
+
+        Model(TexturedTriangle[] triangles) {
+            this.triangles = triangles;
+        }
+    }
+
+    private static final class ModelKey {
+        final int[] data;
+        final int hash;
+
+        ModelKey(PackedTriangle[] triangles) {
+            IntArrayList data = new IntArrayList(triangles.length * 20);
+            for (PackedTriangle t : triangles) {
+                // Edges, origin and normal
+                for (int i = 0; i < 12; i++) data.add((int) Math.round(t.vectors[i] * KEY_SCALE));
+                // Texture coordinates
+                for (int i = 12; i < 18; i++) data.add(Float.floatToIntBits(t.vectors[i]));
+                data.add(t.material);
+                data.add(t.flags);
+            }
+            this.data = data.toIntArray();
+            this.hash = Arrays.hashCode(this.data);
+        }
+
+        @Override
+        public boolean equals(Object o) {
+            return o instanceof ModelKey && Arrays.equals(data, ((ModelKey) o).data);
+        }
+
+        @Override
+        public int hashCode() {
+            return hash;
+        }
+    }
+
+    private final IntArrayList out = new IntArrayList();
+
+    private PackedInstancedBvh(List<Model> models, int[] instanceModels, float[] translations, int width,
+                               AbstractTextureLoader texturePalette,
+                               ResourcePalette<PackedMaterial> materialPalette,
+                               ResourcePalette<PackedTriangleModel> modelPalette) {
+        int count = instanceModels.length;
+        out.add(width | INSTANCED);
+        out.add(count);
+        out.size(2 + INSTANCE_SIZE * count);
+
+        // Top level, one instance per leaf
+        float[] bounds = new float[6 * count];
+        for (int i = 0; i < count; i++) {
+            float[] model = models.get(instanceModels[i]).bounds;
+            for (int j = 0; j < 6; j++) {
+                bounds[6 * i + j] = model[j] + translations[3 * i + j % 3];
+            }
+        }
+        SahBvhBuilder top = new SahBvhBuilder(bounds, 1);
+        int[] leaves = new int[top.leaves.length];
+        for (int i = 0; i < leaves.length; i++) {
+            leaves[i] = 2 + INSTANCE_SIZE * top.leaves[i][0];
+        }
+        append(new PackedWideBvh(top.packed, leaves, width, out.size() - 1));
+
+        // Bottom levels
+        int[] roots = new int[models.size()];
+        for (int i = 0; i < roots.length; i++) {
+            Model model = models.get(i);
+            roots[i] = out.size();
+            int[] modelLeaves = PackedWideBvh.putLeaves(model.bvh.leaves(model.triangles),
+                    texturePalette, materialPalette, modelPalette);
+            append(new PackedWideBvh(model.bvh.packed, modelLeaves, width, out.size() - 1));
+        }
+
+        for (int i = 0; i < count; i++) {
+            int instance = 2 + INSTANCE_SIZE * i;
+            out.set(instance, roots[instanceModels[i]]);
+            for (int axis = 0; axis < 3; axis++) {
+                out.set(instance + 1 + axis, Float.floatToIntBits(translations[3 * i + axis]));
+            }
+        }
+    }
+
+    /**
+     * Append the nodes of a BVH, without its width.
+     */
+    private void append(PackedWideBvh bvh) {
+        IntArrayList nodes = bvh.pack();
+        out.addAll(nodes.subList(1, nodes.size()));
+    }
+
+    /**
+     * Find the shared models of the entities and pack them.
+     *
+     * @param leafSize Largest number of triangles per leaf of the models.
+     * @return The packed BVH, or null if no model is used by more than one entity.
+     */
+    public static PackedInstancedBvh build(List<Instance> instances, int width, int leafSize,
+                                           AbstractTextureLoader texturePalette,
+                                           ResourcePalette<PackedMaterial> materialPalette,
+                                           ResourcePalette<PackedTriangleModel> modelPalette) {
+        Map<ModelKey, Integer> keys = new LinkedHashMap<>();
+        List<Model> models = new ArrayList<>();
+        IntArrayList instanceModels = new IntArrayList();
+        List<Instance> used = new ArrayList<>();
+        for (Instance instance : instances) {
+            TexturedTriangle[] triangles = Arrays.stream(instance.primitives)
+                    .filter(p -> p instanceof TexturedTriangle)
+                    .map(p -> (TexturedTriangle) p)
+                    .toArray(TexturedTriangle[]::new);
+            if (triangles.length == 0) continue;
+
+            PackedTriangle[] packed = Arrays.stream(triangles)
+                    .map(t -> new PackedTriangle(t, texturePalette, materialPalette))
+                    .toArray(PackedTriangle[]::new);
+            int model = keys.computeIfAbsent(new ModelKey(packed), k -> {
+                models.add(new Model(triangles));
+                return models.size() - 1;
+            });
+            instanceModels.add(model);
+            used.add(instance);
+        }
+        if (models.size() == used.size()) {
+            return null;
+        }
+
+        models.parallelStream().forEach(model -> {
+            model.bounds = new float[] {
+                    Float.POSITIVE_INFINITY, Float.POSITIVE_INFINITY, Float.POSITIVE_INFINITY,
+                    Float.NEGATIVE_INFINITY, Float.NEGATIVE_INFINITY, Float.NEGATIVE_INFINITY};
+            float[] bounds = SahBvhBuilder.triangleBounds(model.triangles);
+            for (int i = 0; i < bounds.length; i += 6) {
+                for (int axis = 0; axis < 3; axis++) {
+                    model.bounds[axis] = Math.min(model.bounds[axis], bounds[i + axis]);
+                    model.bounds[3 + axis] = Math.max(model.bounds[3 + axis], bounds[i + 3 + axis]);
+                }
+            }
+            model.bvh = new SahBvhBuilder(bounds, leafSize);
+        });
+
+        float[] translations = new float[3 * used.size()];
+        for (int i = 0; i < used.size(); i++) {
+            translations[3 * i] = (float) used.get(i).x;
+            translations[3 * i + 1] = (float) used.get(i).y;
+            translations[3 * i + 2] = (float) used.get(i).z;
+        }
+        return new PackedInstancedBvh(models, instanceModels.toIntArray(), translations, width,
+                texturePalette, materialPalette, modelPalette);
+    }
+
+    @Override
+    public IntArrayList pack() {
+        return out;
+    }
+}
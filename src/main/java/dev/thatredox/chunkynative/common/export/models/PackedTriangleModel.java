@@ -10,8 +10,18 @@ import se.llbit.math.primitive.Primitive;
 import se.llbit.math.primitive.TexturedTriangle;
 
 import java.util.Arrays;
+import java.util.Comparator;
 
+/**
+ * A BVH leaf of triangles, split into a hot part read by every ray that reaches the leaf and a cold
+ * part only read for hits. See primitives.h for the layout.
+ * <p>
+ * Packed layout: the triangle count, the number of one sided triangles, the hot parts of all
+ * triangles (see PackedTriangle.packHot), then the cold parts in the same order. One sided
+ * triangles come first, so the kernel does not need per triangle flags.
+ */
 public class PackedTriangleModel implements Packer {
+    /** Triangles of the leaf, one sided first. */
     public final PackedTriangle[] triangles;
 
     public PackedTriangleModel(Primitive[] primitives,
@@ -21,6 +31,7 @@ public class PackedTriangleModel implements Packer {
                 .filter(p -> p instanceof TexturedTriangle)
                 .map(p -> (TexturedTriangle) p)
                 .map(t -> new PackedTriangle(t, texturePalette, materialPalette))
+                .sorted(Comparator.comparing(PackedTriangle::isDoubleSided))
                 .toArray(PackedTriangle[]::new);
     }
 
@@ -28,8 +39,11 @@ public class PackedTriangleModel implements Packer {
     public IntArrayList pack() {
         IntArrayList out = new IntArrayList();
         out.add(triangles.length);
+        out.add((int) Arrays.stream(triangles).filter(t -> !t.isDoubleSided()).count());
         for (PackedTriangle t : triangles)
-            out.addAll(t.pack());
+            out.addAll(t.packHot());
+        for (PackedTriangle t : triangles)
+            out.addAll(t.packCold());
         return out;
     }
 }
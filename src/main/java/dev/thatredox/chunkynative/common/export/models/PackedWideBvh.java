@@ -0,0 +1,241 @@
+package dev.thatredox.chunkynative.common.export.models;
+
+import dev.thatredox.chunkynative.common.export.Packer;
+import dev.thatredox.chunkynative.common.export.ResourcePalette;
+import dev.thatredox.chunkynative.common.export.primitives.PackedMaterial;
+import dev.thatredox.chunkynative.common.export.texture.AbstractTextureLoader;
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+import it.unimi.dsi.fastutil.ints.IntOpenHashSet;
+import se.llbit.math.bvh.BinaryBVH;
+import se.llbit.math.primitive.Primitive;
+
+/**
+ * BVH with 4 or 8 children per node and child bounds quantized to 8 bits, collapsed from Chunky's
+ * binary BVH. See bvh.h for the layout.
+ * <p>
+ * The first int is the width, the root node follows. A node is the float lower corner of its
+ * bounds, one int of per axis exponents (signed bytes 0-2) and the child count (byte 3), one int
+ * per child, then the quantized child bounds as 6 planes (min x, max x, min y, max y, min z, max z)
+ * of {@code width / 4} ints with one byte per child. A child box is
+ * {@code origin + q * 2^exponent}, rounded outwards. A positive child is the index of a node,
+ * anything else a negated index into the triangle model palette.
+ */
+public class PackedWideBvh implements Packer {
+    /** An empty BVH: a root without children. */
+    public static final int[] EMPTY = new int[] {4, 0, 0, 0, 0};
+
+    // Size of a node in Chunky's packed binary BVH
+    private static final int BINARY_NODE = 7;
+
+    private final int width;
+    private final int base;
+    private final int[] binary;
+    private final int[] leaves;
+    private final IntArrayList out = new IntArrayList();
+
+    public PackedWideBvh(BinaryBVH bvh, int width,
+                         AbstractTextureLoader texturePalette,
+                         ResourcePalette<PackedMaterial> materialPalette,
+                         ResourcePalette<PackedTriangleModel> modelPalette) {
+        this(bvh.packed, bvh.packedPrimitives, width, texturePalette, materialPalette, modelPalette);
+    }
+
+    /**
+     * @param binary           Nodes in the layout of {@code BinaryBVH.packed}.
+     * @param binaryPrimitives Leaves in the layout of {@code BinaryBVH.packedPrimitives}.
+     */
+    public PackedWideBvh(int[] binary, Primitive[][] binaryPrimitives, int width,
+                         AbstractTextureLoader texturePalette,
+                         ResourcePalette<PackedMaterial> materialPalette,
+                         ResourcePalette<PackedTriangleModel> modelPalette) {
+        this(binary, putLeaves(binaryPrimitives, texturePalette, materialPalette, modelPalette), width, 0);
+    }
+
+    /**
+     * @param binary Nodes in the layout of {@code BinaryBVH.packed}.
+     * @param leaves Leaf index of every binary leaf, written negated.
+     * @param base   Added to every node index, for a BVH stored at {@code base} in a larger buffer.
+     */
+    public PackedWideBvh(int[] binary, int[] leaves, int width, int base) {
+        if (width != 4 && width != 8) throw new IllegalArgumentException("BVH width must be 4 or 8");
+        this.width = width;
+        this.base = base;
+        this.binary = binary;
+        this.leaves = leaves;
+
+        out.add(width);
+        if (binary[0] > 0) {
+            emit(0);
+        } else {
+            // The root is a leaf, give it a parent
+            int node = allocate();
+            write(node, new int[] {0}, 1, new int[] {-leaves[-binary[0]]});
+        }
+    }
+
+    /**
+     * Put the triangle models of the leaves of a binary BVH into the palette.
+     *
+     * @return Palette index of every leaf.
+     */
+    public static int[] putLeaves(Primitive[][] binaryPrimitives,
+                                  AbstractTextureLoader texturePalette,
+                                  ResourcePalette<PackedMaterial> materialPalette,
+                                  ResourcePalette<PackedTriangleModel> modelPalette) {
+        int[] leaves = new int[binaryPrimitives.length];
+        for (int i = 0; i < leaves.length; i++) {
+            leaves[i] = modelPalette.put(new PackedTriangleModel(binaryPrimitives[i], texturePalette, materialPalette));
+        }
+        return leaves;
+    }
+
+    private int nodeSize() {
+        return 4 + width + 6 * (width / 4);
+    }
+
+    private int allocate() {
+        int node = out.size();
+        out.size(node + nodeSize());
+        return node;
+    }
+
+    /**
+     * Emit the wide node of a binary interior node. Interior children are opened, largest surface
+     * area first, until the node is full.
+     */
+    private int emit(int binaryNode) {
+        int[] children = new int[width];
+        int count = 0;
+        children[count++] = binaryNode + BINARY_NODE;
+        children[count++] = binary[binaryNode];
+        while (count < width) {
+            int open = -1;
+            float openArea = -1;
+            for (int i = 0; i < count; i++) {
+                if (binary[children[i]] > 0 && area(children[i]) > openArea) {
+                    open = i;
+                    openArea = area(children[i]);
+                }
+            }
+            if (open < 0) break;
+            int node = children[open];
+            children[open] = node + BINARY_NODE;
+            children[count++] = binary[node];
+        }
+
+        int node = allocate();
+        int[] refs = new int[count];
+        for (int i = 0; i < count; i++) {
+            int child = children[i];
+            refs[i] = binary[child] > 0 ? emit(child) : -leaves[-binary[child]];
+        }
+        write(node, children, count, refs);
+        return node;
+    }
+
+    private void write(int node, int[] children, int count, int[] refs) {
+        int planes = width / 4;
+        int exponents = count << 24;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = Float.POSITIVE_INFINITY;
+            float hi = Float.NEGATIVE_INFINITY;
+            for (int i = 0; i < count; i++) {
+                lo = Math.min(lo, bound(children[i], axis, false));
+                hi = Math.max(hi, bound(children[i], axis, true));
+            }
+            if (count == 0) {
+                lo = hi = 0;
+            }
+
+            // Smallest exponent that fits every child in 8 bits
+            int exponent = hi > lo ? Math.max(Math.getExponent((hi - lo) / 255), -126) : -126;
+            int[] qlo = new int[count];
+            int[] qhi = new int[count];
+            while (!quantize(children, count, axis, lo, exponent, qlo, qhi)) {
+                exponent++;
+            }
+
+            out.set(node + axis, Float.floatToIntBits(lo));
+            exponents |= (exponent & 0xFF) << (8 * axis);
+            for (int i = 0; i < count; i++) {
+                int plane = node + 4 + width + 2 * axis * planes;
+                out.set(plane + (i >> 2), out.getInt(plane + (i >> 2)) | qlo[i] << (8 * (i & 3)));
+                out.set(plane + planes + (i >> 2), out.getInt(plane + planes + (i >> 2)) | qhi[i] << (8 * (i & 3)));
+            }
+        }
+        out.set(node + 3, exponents);
+        for (int i = 0; i < count; i++) {
+            out.set(node + 4 + i, refs[i] > 0 ? refs[i] + base : refs[i]);
+        }
+    }
+
+    /**
+     * Quantize the bounds of the children on one axis so that the decoded float boxes contain the
+     * original boxes. Returns false if an exponent does not reach far enough.
+     */
+    private boolean quantize(int[] children, int count, int axis, float origin, int exponent, int[] qlo, int[] qhi) {
+        float scale = Math.scalb(1.0f, exponent);
+        for (int i = 0; i < count; i++) {
+            float lo = bound(children[i], axis, false);
+            float hi = bound(children[i], axis, true);
+            int q = (int) Math.floor((lo - origin) / scale);
+            q = Math.max(q, 0);
+            while (q > 0 && origin + q * scale > lo) q--;
+            qlo[i] = q;
+
+            q = (int) Math.ceil((hi - origin) / scale);
+            while (origin + q * scale < hi) q++;
+            if (q > 255) return false;
+            qhi[i] = q;
+        }
+        return true;
+    }
+
+    private float bound(int binaryNode, int axis, boolean max) {
+        return Float.intBitsToFloat(binary[binaryNode + 1 + 2 * axis + (max ? 1 : 0)]);
+    }
+
+    private float area(int binaryNode) {
+        float x = bound(binaryNode, 0, true) - bound(binaryNode, 0, false);
+        float y = bound(binaryNode, 1, true) - bound(binaryNode, 1, false);
+        float z = bound(binaryNode, 2, true) - bound(binaryNode, 2, false);
+        return x * y + y * z + z * x;
+    }
+
+    /**
+     * Largest number of entries the traversal stack of bvh.h holds for a packed BVH. A visited node
+     * pushes every child, so a path down the tree leaves the other children of every node on it on
+     * the stack: at most depth * (width - 1) + 1. The top and bottom levels of an instanced BVH use
+     * separate stacks.
+     */
+    public static int stackSize(int[] bvh) {
+        if ((bvh[0] & PackedInstancedBvh.INSTANCED) == 0) {
+            return stackSize(bvh, 1);
+        }
+        int count = bvh[1];
+        int size = stackSize(bvh, 2 + PackedInstancedBvh.INSTANCE_SIZE * count);
+        IntOpenHashSet roots = new IntOpenHashSet();
+        for (int i = 0; i < count; i++) {
+            int root = bvh[2 + PackedInstancedBvh.INSTANCE_SIZE * i];
+            if (roots.add(root)) {
+                size = Math.max(size, stackSize(bvh, root));
+            }
+        }
+        return size;
+    }
+
+    private static int stackSize(int[] bvh, int node) {
+        int count = (bvh[node + 3] >>> 24) & 0xFF;
+        int deepest = 0;
+        for (int i = 0; i < count; i++) {
+            int child = bvh[node + 4 + i];
+            deepest = Math.max(deepest, child > 0 ? stackSize(bvh, child) : 1);
+        }
+        return count == 0 ? 0 : count - 1 + deepest;
+    }
+
+    @Override
+    public IntArrayList pack() {
+        return out;
+    }
+}
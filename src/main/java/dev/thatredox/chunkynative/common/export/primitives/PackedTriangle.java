@@ -43,37 +43,55 @@ public class PackedTriangle implements Packer {
         this.material = materialPalette.put(new PackedMaterial(triangle.material, Tint.NONE, texturePalette));
     }
 
+    public boolean isDoubleSided() {
+        return ((flags >> 8) & 1) != 0;
+    }
+
+    /**
+     * Pack the intersection data of this triangle into 12 ints, read as three float4s:
+     * 0-2: origin, 3: geometric normal x
+     * 4-6: e1, 7: geometric normal y
+     * 8-10: e2, 11: geometric normal z
+     * The geometric normal is the unnormalized {@code e1 x e2}.
+     */
+    public IntArrayList packHot() {
+        float nx = vectors[1] * vectors[5] - vectors[2] * vectors[4];
+        float ny = vectors[2] * vectors[3] - vectors[0] * vectors[5];
+        float nz = vectors[0] * vectors[4] - vectors[1] * vectors[3];
+
+        IntArrayList out = new IntArrayList(12);
+        for (int i = 6; i < 9; i++) out.add(Float.floatToIntBits(vectors[i]));
+        out.add(Float.floatToIntBits(nx));
+        for (int i = 0; i < 3; i++) out.add(Float.floatToIntBits(vectors[i]));
+        out.add(Float.floatToIntBits(ny));
+        for (int i = 3; i < 6; i++) out.add(Float.floatToIntBits(vectors[i]));
+        out.add(Float.floatToIntBits(nz));
+        return out;
+    }
+
     /**
-     * Pack this Triangle. This will be compressed into 20 ints:
-     * 0: Flags bitfield:
-     *      Bottom 8 bits the primitive type (1 for triangle)
-     *      9th bit represents if this triangle is double sided
-     * 1: e1 x
-     * 2: e1 y
-     * 3: e1 z
-     * 4: e2 x
-     * 5: e2 y
-     * 6: e2 z
-     * 7: origin x
-     * 8: origin y
-     * 9: origin z
-     * 10: normal x
-     * 11: normal y
-     * 12: normal z
-     * 13: t1 u
-     * 14: t1 v
-     * 15: t2 u
-     * 16: t2 v
-     * 17: t3 u
-     * 18: t3 v
-     * 19: Material reference
+     * Pack the shading data of this triangle into 10 ints:
+     * 0-2: shading normal
+     * 3-4: t1 u, v
+     * 5-6: t2 u, v
+     * 7-8: t3 u, v
+     * 9: Material reference
+     */
+    public IntArrayList packCold() {
+        IntArrayList out = new IntArrayList(10);
+        for (int i = 9; i < 18; i++) out.add(Float.floatToIntBits(vectors[i]));
+        out.add(this.material);
+        return out;
+    }
+
+    /**
+     * Pack this Triangle, the hot part followed by the cold part. Triangles are only packed into
+     * leaves by PackedTriangleModel, which groups the hot parts together.
      */
     @Override
     public IntArrayList pack() {
-        IntArrayList out = new IntArrayList(20);
-        out.add(flags);
-        for (float i : vectors) out.add(Float.floatToIntBits(i));
-        out.add(this.material);
+        IntArrayList out = packHot();
+        out.addAll(packCold());
         return out;
     }
 }
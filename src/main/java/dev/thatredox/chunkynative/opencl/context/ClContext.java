@@ -52,6 +52,18 @@ public class ClContext {
      * @return OpenCL program.
      */
     public cl_program loadProgram(Function<String, String> sourceReader, String kernelName) {
+        return loadProgram(sourceReader, kernelName, "");
+    }
+
+    /**
+     * Load an OpenCL program.
+     *
+     * @param sourceReader  Function to read source files from filenames.
+     * @param kernelName    Kernel entrypoint filename.
+     * @param options       Extra compiler options, such as {@code -D} defines.
+     * @return OpenCL program.
+     */
+    public cl_program loadProgram(Function<String, String> sourceReader, String kernelName, String options) {
         // Load kernel
         String kernel = sourceReader.apply(kernelName);
         cl_program kernelProgram = clCreateProgramWithSource(context, 1, new String[] { kernel },
@@ -85,7 +97,7 @@ public class ClContext {
         Arrays.setAll(includePrograms, i -> headerFiles.get(includeNames[i]));
 
         CL.setExceptionsEnabled(false);
-        int code = clCompileProgram(kernelProgram, 1, deviceArray, "-cl-std=CL1.2 -Werror",
+        int code = clCompileProgram(kernelProgram, 1, deviceArray, ("-cl-std=CL1.2 -Werror " + options).trim(),
                 includePrograms.length, includePrograms, includeNames, null, null);
         if (code != CL_SUCCESS) {
             String error;
@@ -1,10 +1,16 @@
 package dev.thatredox.chunkynative.opencl.context;
 
 import dev.thatredox.chunkynative.opencl.renderer.ClSceneLoader;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.KernelFeatures;
 import org.jocl.CLException;
 import org.jocl.cl_program;
 import se.llbit.log.Log;
 
+import java.util.LinkedHashMap;
+import java.util.Map;
+
+import static org.jocl.CL.clReleaseProgram;
+
 public class ContextManager {
     public final Device device;
     public final ClContext context;
@@ -20,7 +26,7 @@ public class ContextManager {
         this.context = new ClContext(device);
         this.tonemap = new Tonemap(context);
         this.renderer = new Renderer(context);
-        this.sceneLoader = new ClSceneLoader(context);
+        this.sceneLoader = new ClSceneLoader(context, renderer.kernel);
     }
 
     public static ContextManager get() {
@@ -48,10 +54,37 @@ public class ContextManager {
     }
 
     public static class Renderer {
+        /** Generic program, with every scene feature decided at runtime. */
         public final cl_program kernel;
 
+        // Most variants a context keeps compiled. Every scene usually needs one or two.
+        private static final int MAX_VARIANTS = 8;
+
+        private final ClContext context;
+        // Least recently used first
+        private final Map<KernelFeatures, cl_program> variants = new LinkedHashMap<KernelFeatures, cl_program>(16, 0.75f, true) {
+            @Override
+            protected boolean removeEldestEntry(Map.Entry<KernelFeatures, cl_program> eldest) {
+                if (size() <= MAX_VARIANTS) return false;
+                // Kernels created from the program keep it alive until they are released
+                clReleaseProgram(eldest.getValue());
+                return true;
+            }
+        };
+
         private Renderer(ClContext context) {
+            this.context = context;
             this.kernel = KernelLoader.loadProgram(context, "kernel", "rayTracer.c");
         }
+
+        /**
+         * Get the program specialized for the given features. Variants are compiled on first use, and
+         * the least recently used one is released once more than {@link #MAX_VARIANTS} are cached.
+         * Create the kernels right away, the program may be released by a later call.
+         */
+        public synchronized cl_program getProgram(KernelFeatures features) {
+            return variants.computeIfAbsent(features, f ->
+                    KernelLoader.loadProgram(context, "kernel", "rayTracer.c", f.getOptions()));
+        }
     }
 }
@@ -39,6 +39,24 @@ public class Device {
         return out;
     }
 
+    public int computeUnits() {
+        return getInts(CL_DEVICE_MAX_COMPUTE_UNITS, 1)[0];
+    }
+
+    /**
+     * @return Size of the largest single buffer the device can allocate, in bytes.
+     */
+    public long maxAllocSize() {
+        return getDeviceLongs(CL_DEVICE_MAX_MEM_ALLOC_SIZE, 1)[0];
+    }
+
+    /**
+     * @return Size of the device global memory, in bytes.
+     */
+    public long globalMemSize() {
+        return getDeviceLongs(CL_DEVICE_GLOBAL_MEM_SIZE, 1)[0];
+    }
+
     public double computeCapacity() {
         double freq = getInts(CL_DEVICE_MAX_CLOCK_FREQUENCY, 1)[0];
         double units = getInts(CL_DEVICE_MAX_COMPUTE_UNITS, 1)[0];
@@ -58,12 +58,25 @@ public class KernelLoader {
      * @return OpenCL program.
      */
     public static cl_program loadProgram(ClContext context, String base, String kernelName) {
+        return loadProgram(context, base, kernelName, "");
+    }
+
+    /**
+     * Load an OpenCL program.
+     *
+     * @param context       OpenCL context.
+     * @param base          Kernel base directory name.
+     * @param kernelName    Kernel entrypoint filename.
+     * @param options       Extra compiler options, such as {@code -D} defines.
+     * @return OpenCL program.
+     */
+    public static cl_program loadProgram(ClContext context, String base, String kernelName, String options) {
         return context.loadProgram(file -> {
             String program = instance.rawSourceReader.apply(base, file);
             Matcher matcher = openclIncludeMatcher.matcher(program);
             program = matcher.replaceFirst("// #include \"../opencl.h\"");
             return program;
-        }, kernelName);
+        }, kernelName, options);
     }
 
     public static boolean canHotReload() {
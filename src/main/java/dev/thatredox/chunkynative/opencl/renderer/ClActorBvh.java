@@ -0,0 +1,242 @@
+package dev.thatredox.chunkynative.opencl.renderer;
+
+import dev.thatredox.chunkynative.common.export.models.PackedWideBvh;
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.KernelArgBinder;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.RadixSorter;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Pointer;
+import org.jocl.Sizeof;
+import org.jocl.cl_kernel;
+import org.jocl.cl_mem;
+import org.jocl.cl_program;
+
+import java.util.Arrays;
+
+import static org.jocl.CL.*;
+
+/**
+ * Actor BVH built and refitted on the device (see bvh_build.h). The buffer holds the tree followed
+ * by its own one triangle leaves, so actor changes only upload the triangles that changed and
+ * never touch the triangle palette, the texture atlas or the octree.
+ * <p>
+ * If the triangle count is unchanged the tree is refitted, else it is rebuilt from Morton codes.
+ * Refits keep the old topology and get looser as the actors move, so every few refits the tree is
+ * rebuilt anyway.
+ */
+public class ClActorBvh implements AutoCloseable {
+    // Must match BVH_BUILD_* in bvh_build.h
+    private static final int NODE_SIZE = 14;
+    private static final int LEAF_SIZE = 24;
+    private static final int MORTON_BITS = 30;
+    private static final int WIDTH = 4;
+
+    private static final int MAX_REFITS = 8;
+
+    private final ClContext context;
+    private final cl_kernel morton;
+    private final cl_kernel hierarchy;
+    private final cl_kernel refit;
+    // Sorts the Morton codes with the triangle ids, grows with the actor count
+    private final RadixSorter mortonSorter;
+
+    private ClMemory bvh;
+    private ClMemory keys = null;
+    private ClMemory ids = null;
+    private ClMemory parents = null;
+    private ClMemory children = null;
+    private ClMemory bounds = null;
+    private ClMemory counters = null;
+
+    private int[] triangles = new int[0];
+    private int count = 0;
+    private int refits = 0;
+
+    public ClActorBvh(cl_program program, ClContext context) {
+        this.context = context;
+        this.morton = clCreateKernel(program, "bvh_build_morton", null);
+        this.hierarchy = clCreateKernel(program, "bvh_build_hierarchy", null);
+        this.refit = clCreateKernel(program, "bvh_build_refit", null);
+        this.mortonSorter = new RadixSorter(program, context, 0);
+        this.bvh = createBuffer(PackedWideBvh.EMPTY);
+    }
+
+    public cl_mem get() {
+        return bvh.get();
+    }
+
+    /**
+     * @return Traversal stack entries the tree may need. The common prefix of the keys (Morton code,
+     * then the index for equal codes) grows at every level, which bounds the depth of the binary
+     * tree by the Morton bits plus the bits of the index.
+     */
+    public int getStackSize() {
+        if (count == 0) return 0;
+        return MORTON_BITS + (32 - Integer.numberOfLeadingZeros(count - 1)) + 1;
+    }
+
+    /**
+     * Replace the actor triangles and update the tree.
+     *
+     * @param triangles One triangle leaves, see AbstractSceneLoader.packActorTriangles.
+     */
+    public void update(int[] triangles) {
+        int count = triangles.length / LEAF_SIZE;
+        if (count == 0) {
+            releaseBuffers();
+            bvh = createBuffer(PackedWideBvh.EMPTY);
+        } else if (count != this.count || refits >= MAX_REFITS) {
+            rebuild(triangles, count);
+        } else if (upload(triangles)) {
+            refit(count);
+            refits++;
+        }
+        this.triangles = triangles;
+        this.count = count;
+    }
+
+    private static int leafOffset(int count) {
+        return 1 + NODE_SIZE * Math.max(count - 1, 1);
+    }
+
+    /**
+     * Upload the leaves that differ from the last upload.
+     *
+     * @return True if any leaf changed.
+     */
+    private boolean upload(int[] triangles) {
+        int leafOffset = leafOffset(count);
+        boolean changed = false;
+        int start = -1;
+        for (int i = 0; i <= triangles.length; i += LEAF_SIZE) {
+            boolean same = i == triangles.length ||
+                    Arrays.equals(triangles, i, i + LEAF_SIZE, this.triangles, i, i + LEAF_SIZE);
+            if (!same && start < 0) {
+                start = i;
+            } else if (same && start >= 0) {
+                // Upload the run of changed leaves
+                clEnqueueWriteBuffer(context.queue, bvh.get(), CL_FALSE, (long) Sizeof.cl_int * (leafOffset + start),
+                        (long) Sizeof.cl_int * (i - start), Pointer.to(triangles).withByteOffset((long) Sizeof.cl_int * start),
+                        0, null, null);
+                start = -1;
+                changed = true;
+            }
+        }
+        if (changed) {
+            // The host array may be replaced before the writes complete
+            clFinish(context.queue);
+        }
+        return changed;
+    }
+
+    private void rebuild(int[] triangles, int count) {
+        releaseBuffers();
+        int internal = Math.max(count - 1, 1);
+        int leafOffset = leafOffset(count);
+
+        int[] data = new int[leafOffset + triangles.length];
+        data[0] = WIDTH;
+        System.arraycopy(triangles, 0, data, leafOffset, triangles.length);
+        bvh = createBuffer(data);
+        keys = createBuffer(count);
+        ids = createBuffer(count);
+        parents = createBuffer(internal + count);
+        children = createBuffer(2L * internal);
+        bounds = createBuffer(6L * (internal + count));
+        counters = createBuffer(internal);
+        mortonSorter.ensureCapacity(count);
+
+        // Centroid bounds for the Morton codes
+        float[] min = {Float.POSITIVE_INFINITY, Float.POSITIVE_INFINITY, Float.POSITIVE_INFINITY};
+        float[] max = {Float.NEGATIVE_INFINITY, Float.NEGATIVE_INFINITY, Float.NEGATIVE_INFINITY};
+        for (int leaf = 0; leaf < triangles.length; leaf += LEAF_SIZE) {
+            for (int axis = 0; axis < 3; axis++) {
+                // Leaf header, then the origin, e1 and e2 as float4s
+                float o = Float.intBitsToFloat(triangles[leaf + 2 + axis]);
+                float e1 = Float.intBitsToFloat(triangles[leaf + 6 + axis]);
+                float e2 = Float.intBitsToFloat(triangles[leaf + 10 + axis]);
+                float centroid = o + (e1 + e2) / 3;
+                min[axis] = Math.min(min[axis], centroid);
+                max[axis] = Math.max(max[axis], centroid);
+            }
+        }
+
+        KernelArgBinder binder = new KernelArgBinder(morton);
+        binder.setMem(bvh.get());
+        binder.setInt(leafOffset);
+        binder.setInt(count);
+        for (int axis = 0; axis < 3; axis++) binder.setFloat(min[axis]);
+        for (int axis = 0; axis < 3; axis++) binder.setFloat(max[axis] > min[axis] ? 1 / (max[axis] - min[axis]) : 0);
+        binder.setMem(keys.get());
+        binder.setMem(ids.get());
+        enqueue(morton, count);
+
+        mortonSorter.sort(keys, ids, count, MORTON_BITS);
+
+        binder = new KernelArgBinder(hierarchy);
+        binder.setMem(keys.get());
+        binder.setMem(ids.get());
+        binder.setInt(count);
+        binder.setInt(leafOffset);
+        binder.setMem(bvh.get());
+        binder.setMem(parents.get());
+        binder.setMem(children.get());
+        enqueue(hierarchy, internal);
+
+        refit(count);
+        refits = 0;
+    }
+
+    private void refit(int count) {
+        int internal = Math.max(count - 1, 1);
+        int[] zero = {0};
+        clEnqueueFillBuffer(context.queue, counters.get(), Pointer.to(zero), Sizeof.cl_int, 0,
+                (long) Sizeof.cl_int * internal, 0, null, null);
+
+        KernelArgBinder binder = new KernelArgBinder(refit);
+        binder.setMem(bvh.get());
+        binder.setMem(ids.get());
+        binder.setInt(count);
+        binder.setInt(leafOffset(count));
+        binder.setMem(parents.get());
+        binder.setMem(children.get());
+        binder.setMem(bounds.get());
+        binder.setMem(counters.get());
+        enqueue(refit, count);
+    }
+
+    private void enqueue(cl_kernel kernel, long globalSize) {
+        clEnqueueNDRangeKernel(context.queue, kernel, 1, null, new long[] { globalSize }, null,
+                0, null, null);
+    }
+
+    private ClMemory createBuffer(long ints) {
+        return new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE,
+                Sizeof.cl_int * ints, null, null));
+    }
+
+    private ClMemory createBuffer(int[] data) {
+        return new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                (long) Sizeof.cl_int * data.length, Pointer.to(data), null));
+    }
+
+    private void releaseBuffers() {
+        bvh.close();
+        if (keys != null) keys.close();
+        if (ids != null) ids.close();
+        if (parents != null) parents.close();
+        if (children != null) children.close();
+        if (bounds != null) bounds.close();
+        if (counters != null) counters.close();
+        keys = ids = parents = children = bounds = counters = null;
+    }
+
+    @Override
+    public void close() {
+        releaseBuffers();
+        mortonSorter.close();
+        clReleaseKernel(morton);
+        clReleaseKernel(hierarchy);
+        clReleaseKernel(refit);
+    }
+}
@@ -0,0 +1,182 @@
+package dev.thatredox.chunkynative.opencl.renderer;
+
+import dev.thatredox.chunkynative.common.export.PagedOctree;
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.util.ClShardedIntBuffer;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Pointer;
+import org.jocl.Sizeof;
+
+import java.util.Arrays;
+
+import static org.jocl.CL.*;
+
+/**
+ * Streams the pages of a paged world octree into a fixed size page pool on the device.
+ * <p>
+ * The device buffer holds the resident data (the top tree, followed by anything else that must
+ * stay resident), then the page table, then the pool. A page table entry is the buffer index of
+ * the page root if the page is resident, or {@code fallback - 1} if it is not. The kernel flags
+ * every page it enters in the feedback buffer: 1 if it was resident, 2 if it missed. Between
+ * dispatches {@link #update()} loads the missed pages, evicting the pages that were not used for
+ * the longest. Flags add up until the next update, so it does not need to run after every dispatch.
+ */
+public class ClOctreePager implements AutoCloseable {
+    private static final int USED = 1;
+    private static final int MISSED = 2;
+
+    private final ClContext context;
+    private final PagedOctree tree;
+    private final ClShardedIntBuffer data;
+    private final ClMemory feedback;
+
+    private final int pageTableOffset;
+    private final int poolOffset;
+    private final int[] slotPage;
+    private final long[] slotLastUse;
+    private final int[] pageSlot;
+    private final int[] requests;
+    private long epoch = 0;
+    private boolean overCommitted = false;
+
+    /**
+     * @param resident  Data at the start of the buffer, starting with the top tree.
+     * @param poolSize  Size of the page pool in ints.
+     */
+    public ClOctreePager(PagedOctree tree, int[] resident, long poolSize, ClContext context) {
+        this.context = context;
+        this.tree = tree;
+        int pages = tree.getPageCount();
+        // Buffer indices are ints
+        long maxSlots = (Integer.MAX_VALUE - (long) resident.length - pages) / tree.getPageSize();
+        int slots = (int) Math.max(1, Math.min(Math.min(pages, maxSlots), poolSize / tree.getPageSize()));
+
+        this.pageTableOffset = resident.length;
+        this.poolOffset = pageTableOffset + pages;
+        this.slotPage = new int[slots];
+        this.slotLastUse = new long[slots];
+        this.pageSlot = new int[pages];
+        this.requests = new int[Math.max(1, pages)];
+        Arrays.fill(slotPage, -1);
+        Arrays.fill(pageSlot, -1);
+
+        this.data = ClShardedIntBuffer.allocate((long) poolOffset + (long) slots * tree.getPageSize(), context);
+        data.set(resident, 0);
+        if (pages > 0) {
+            int[] pageTable = new int[pages];
+            Arrays.setAll(pageTable, this::missingEntry);
+            data.set(pageTable, pageTableOffset);
+        }
+
+        this.feedback = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                (long) Sizeof.cl_int * requests.length, Pointer.to(requests), null));
+    }
+
+    public ClShardedIntBuffer getData() {
+        return data;
+    }
+
+    public ClMemory getFeedback() {
+        return feedback;
+    }
+
+    public int getPageTableOffset() {
+        return pageTableOffset;
+    }
+
+    private int missingEntry(int page) {
+        return tree.getFallback(page) - 1;
+    }
+
+    /**
+     * Read the page feedback of the dispatches since the last update and load the pages that missed.
+     *
+     * @return Number of pages that missed.
+     */
+    public int update() {
+        epoch++;
+        overCommitted = false;
+        clEnqueueReadBuffer(context.queue, feedback.get(), CL_TRUE, 0,
+                (long) Sizeof.cl_int * requests.length, Pointer.to(requests), 0, null, null);
+
+        boolean any = false;
+        for (int page = 0; page < tree.getPageCount(); page++) {
+            if (requests[page] == USED && pageSlot[page] >= 0) {
+                slotLastUse[pageSlot[page]] = epoch;
+            }
+            any |= requests[page] != 0;
+        }
+        if (!any) {
+            return 0;
+        }
+
+        int missed = 0;
+        for (int page = 0; page < tree.getPageCount(); page++) {
+            if (requests[page] != MISSED) continue;
+            missed++;
+            if (pageSlot[page] >= 0 || overCommitted) continue;
+            int slot = evictionSlot();
+            if (slot < 0) {
+                // Every slot is in use by the last dispatches
+                overCommitted = true;
+                continue;
+            }
+            load(page, slot);
+        }
+
+        Arrays.fill(requests, 0);
+        clEnqueueWriteBuffer(context.queue, feedback.get(), CL_TRUE, 0,
+                (long) Sizeof.cl_int * requests.length, Pointer.to(requests), 0, null, null);
+        return missed;
+    }
+
+    /**
+     * @return True if the last update could not load every missed page, because the pages in use
+     * do not fit in the pool.
+     */
+    public boolean isOverCommitted() {
+        return overCommitted;
+    }
+
+    private int evictionSlot() {
+        int best = -1;
+        for (int slot = 0; slot < slotPage.length; slot++) {
+            if (slotPage[slot] < 0) {
+                return slot;
+            }
+            if (slotLastUse[slot] < epoch && (best < 0 || slotLastUse[slot] < slotLastUse[best])) {
+                best = slot;
+            }
+        }
+        return best;
+    }
+
+    private void load(int page, int slot) {
+        int evicted = slotPage[slot];
+        if (evicted >= 0) {
+            pageSlot[evicted] = -1;
+            data.set(new int[] {missingEntry(evicted)}, pageTableOffset + evicted);
+        }
+
+        // Relocate the child pointers to the slot
+        int base = poolOffset + slot * tree.getPageSize();
+        int[] pageData = tree.getPage(page).clone();
+        for (int i = 0; i < pageData.length; i++) {
+            if (pageData[i] > 0) {
+                pageData[i] += base;
+            }
+        }
+        data.set(pageData, base);
+        data.set(new int[] {base}, pageTableOffset + page);
+
+        slotPage[slot] = page;
+        slotLastUse[slot] = epoch;
+        pageSlot[page] = slot;
+    }
+
+    @Override
+    public void close() {
+        data.close();
+        feedback.close();
+    }
+}
@@ -1,6 +1,13 @@
 package dev.thatredox.chunkynative.opencl.renderer;
 
 import dev.thatredox.chunkynative.common.export.AbstractSceneLoader;
+import dev.thatredox.chunkynative.common.export.BrickTree;
+import dev.thatredox.chunkynative.common.export.ColumnHeightmap;
+import dev.thatredox.chunkynative.common.export.MergedOctree;
+import dev.thatredox.chunkynative.common.export.OctreeDag;
+import dev.thatredox.chunkynative.common.export.OctreeLayout;
+import dev.thatredox.chunkynative.common.export.OctreeLod;
+import dev.thatredox.chunkynative.common.export.PagedOctree;
 import dev.thatredox.chunkynative.common.export.ResourcePalette;
 import dev.thatredox.chunkynative.common.export.models.PackedAabbModel;
 import dev.thatredox.chunkynative.common.export.models.PackedQuadModel;
@@ -14,9 +21,12 @@ import dev.thatredox.chunkynative.common.state.SkyState;
 import dev.thatredox.chunkynative.opencl.context.ClContext;
 import dev.thatredox.chunkynative.opencl.context.ContextManager;
 import dev.thatredox.chunkynative.opencl.renderer.export.ClPackedResourcePalette;
+import dev.thatredox.chunkynative.opencl.renderer.export.ClShardedResourcePalette;
 import dev.thatredox.chunkynative.opencl.renderer.export.ClTextureLoader;
 import dev.thatredox.chunkynative.opencl.renderer.scene.ClSky;
+import dev.thatredox.chunkynative.opencl.ui.ChunkyClTab;
 import dev.thatredox.chunkynative.opencl.util.ClIntBuffer;
+import dev.thatredox.chunkynative.opencl.util.ClShardedIntBuffer;
 import dev.thatredox.chunkynative.opencl.util.ClMemory;
 import dev.thatredox.chunkynative.util.FunctionCache;
 import dev.thatredox.chunkynative.util.Reflection;
@@ -24,10 +34,12 @@ import se.llbit.chunky.renderer.ResetReason;
 import se.llbit.chunky.renderer.scene.Scene;
 import se.llbit.chunky.world.ChunkPosition;
 import se.llbit.chunky.world.biome.Biomes;
+import se.llbit.log.Log;
 import se.llbit.math.Grid;
 import se.llbit.math.Vector3i;
 import org.jocl.Pointer;
 import org.jocl.Sizeof;
+import org.jocl.cl_program;
 
 import java.util.List;
 import java.util.Arrays;
@@ -36,23 +48,41 @@ import java.util.Collection;
 
 import static org.jocl.CL.CL_MEM_COPY_HOST_PTR;
 import static org.jocl.CL.CL_MEM_READ_ONLY;
+import static org.jocl.CL.CL_MEM_READ_WRITE;
 import static org.jocl.CL.clCreateBuffer;
 
 public class ClSceneLoader extends AbstractSceneLoader {
+    /** Chunky's placeholder block type, see OCTREE_ANY_TYPE in octree.h. */
+    private static final int OCTREE_ANY_TYPE = 0x7FFFFFFE;
+    /** Size of an octree page in ints. */
+    private static final int OCTREE_PAGE_SIZE = 1 << 16;
+
     protected final FunctionCache<int[], ClIntBuffer> clWorldBvh;
-    protected final FunctionCache<int[], ClIntBuffer> clActorBvh;
+    protected final ClActorBvh clActorBvh;
     protected final FunctionCache<PackedSun, ClIntBuffer> clPackedSun;
     protected ClSky clSky = null;
     protected SkyState skyState = null;
 
-    protected ClIntBuffer octreeData = null;
+    protected ClShardedIntBuffer octreeData = null;
     protected ClIntBuffer octreeDepth = null;
-    protected ClIntBuffer waterOctreeData = null;
+    protected ClShardedIntBuffer waterOctreeData = null;
     protected ClIntBuffer waterOctreeDepth = null;
+    protected ClIntBuffer columnHeights = null;
+    // Heightmap of the world octree, completed with the water
+    private ColumnHeightmap heightmap = null;
+    // Mapped world octree waiting to be merged with the water
+    private int[] worldOctree = null;
+    private int worldOctreeDepth = 0;
+    private String octreeLayout = "";
+    // Streams the world octree pages, null if the octree is fully resident
+    private ClOctreePager octreePager = null;
+    // Page feedback buffer bound when the octree is not paged
+    private final ClMemory noPageRequests;
     protected ClIntBuffer emitterGridMeta = null;
     protected ClIntBuffer emitterGridCells = null;
     protected ClIntBuffer emitterGridIndexes = null;
     protected ClIntBuffer emitterGridEmitters = null;
+    protected ClIntBuffer emitterGridAlias = null;
     protected ClIntBuffer biomeMeta = null;
     protected ClIntBuffer biomeGrid = null;
     protected ClMemory biomeGrass = null;
@@ -61,11 +91,16 @@ public class ClSceneLoader extends AbstractSceneLoader {
     protected ClMemory biomeWater = null;
     private final ClContext context;
 
-    public ClSceneLoader(ClContext context) {
+    /**
+     * @param program Generic render program, for the actor BVH build kernels.
+     */
+    public ClSceneLoader(ClContext context, cl_program program) {
         this.context = context;
         this.clWorldBvh = new FunctionCache<>(i -> new ClIntBuffer(i, context), ClIntBuffer::close, null);
-        this.clActorBvh = new FunctionCache<>(i -> new ClIntBuffer(i, context), ClIntBuffer::close, null);
+        this.clActorBvh = new ClActorBvh(program, context);
         this.clPackedSun = new FunctionCache<>(i -> new ClIntBuffer(i, context), ClIntBuffer::close, null);
+        this.noPageRequests = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE,
+                Sizeof.cl_int, null, null));
     }
 
     @Override
@@ -95,6 +130,7 @@ public class ClSceneLoader extends AbstractSceneLoader {
         if (emitterGridCells != null) emitterGridCells.close();
         if (emitterGridIndexes != null) emitterGridIndexes.close();
         if (emitterGridEmitters != null) emitterGridEmitters.close();
+        if (emitterGridAlias != null) emitterGridAlias.close();
 
         Grid grid = scene.getEmitterGrid();
         if (grid == null || blockMapping == null) {
@@ -102,6 +138,7 @@ public class ClSceneLoader extends AbstractSceneLoader {
             emitterGridCells = new ClIntBuffer(new int[] {0, 0}, context);
             emitterGridIndexes = new ClIntBuffer(new int[] {0}, context);
             emitterGridEmitters = new ClIntBuffer(new int[] {0, 0, 0, 0}, context);
+            emitterGridAlias = new ClIntBuffer(new int[] {0, 0, 0}, context);
             return;
         }
 
@@ -137,6 +174,91 @@ public class ClSceneLoader extends AbstractSceneLoader {
         emitterGridCells = new ClIntBuffer(constructedGrid == null || constructedGrid.length == 0 ? new int[] {0, 0} : constructedGrid, context);
         emitterGridIndexes = new ClIntBuffer(positionIndexes == null || positionIndexes.length == 0 ? new int[] {0} : positionIndexes, context);
         emitterGridEmitters = new ClIntBuffer(emitters, context);
+
+        int[] alias = constructedGrid == null || positionIndexes == null || positionIndexes.length == 0 ? new int[] {0, 0, 0} :
+                buildEmitterAliasTables(positions, constructedGrid, positionIndexes, cellSize, offsetX, sizeX, offsetY, offsetZ, sizeZ);
+        emitterGridAlias = new ClIntBuffer(alias, context);
+    }
+
+    /**
+     * Build an alias table for every emitter grid cell. Each emitter is weighted by its emittance and
+     * surface area over the squared distance to the cell center. Entries are 3 ints parallel to the
+     * position indexes: acceptance threshold, alias slot (relative to the cell start) and the
+     * probability of picking the slot.
+     */
+    private static int[] buildEmitterAliasTables(List<Grid.EmitterPosition> positions, int[] constructedGrid, int[] positionIndexes,
+                                                 int cellSize, int offsetX, int sizeX, int offsetY, int offsetZ, int sizeZ) {
+        int[] alias = new int[positionIndexes.length * 3];
+        int cellCount = constructedGrid.length / 2;
+
+        for (int cellIndex = 0; cellIndex < cellCount; cellIndex++) {
+            int start = constructedGrid[cellIndex * 2];
+            int count = constructedGrid[cellIndex * 2 + 1];
+            if (count <= 0) continue;
+
+            int gz = cellIndex % sizeZ + offsetZ;
+            int gx = (cellIndex / sizeZ) % sizeX + offsetX;
+            int gy = (cellIndex / sizeZ) / sizeX + offsetY;
+            double cx = (gx + 0.5) * cellSize;
+            double cy = (gy + 0.5) * cellSize;
+            double cz = (gz + 0.5) * cellSize;
+
+            double[] weights = new double[count];
+            double total = 0;
+            for (int i = 0; i < count; i++) {
+                Grid.EmitterPosition pos = positions.get(positionIndexes[start + i]);
+                double area = 0;
+                for (int face = 0; face < pos.block.faceCount(); face++) {
+                    area += pos.block.surfaceArea(face);
+                }
+                double dx = pos.x + 0.5 - cx;
+                double dy = pos.y + 0.5 - cy;
+                double dz = pos.z + 0.5 - cz;
+                double weight = pos.block.emittance * area / Math.max(dx*dx + dy*dy + dz*dz, 1.0);
+                weights[i] = Double.isFinite(weight) ? Math.max(weight, 0) : 0;
+                total += weights[i];
+            }
+
+            // Vose's alias method
+            double[] scaled = new double[count];
+            int[] aliases = new int[count];
+            int[] small = new int[count];
+            int[] large = new int[count];
+            int smallCount = 0;
+            int largeCount = 0;
+            for (int i = 0; i < count; i++) {
+                weights[i] = total > 0 ? weights[i] / total : 1.0 / count;
+                scaled[i] = weights[i] * count;
+                aliases[i] = i;
+                if (scaled[i] < 1) {
+                    small[smallCount++] = i;
+                } else {
+                    large[largeCount++] = i;
+                }
+            }
+            while (smallCount > 0 && largeCount > 0) {
+                int s = small[--smallCount];
+                int l = large[--largeCount];
+                aliases[s] = l;
+                scaled[l] -= 1 - scaled[s];
+                if (scaled[l] < 1) {
+                    small[smallCount++] = l;
+                } else {
+                    large[largeCount++] = l;
+                }
+            }
+            // Whatever is left only differs from 1 by rounding
+            while (smallCount > 0) scaled[small[--smallCount]] = 1;
+            while (largeCount > 0) scaled[large[--largeCount]] = 1;
+
+            for (int i = 0; i < count; i++) {
+                int entry = (start + i) * 3;
+                alias[entry] = Float.floatToIntBits((float) scaled[i]);
+                alias[entry + 1] = aliases[i];
+                alias[entry + 2] = Float.floatToIntBits((float) weights[i]);
+            }
+        }
+        return alias;
     }
 
     private void loadBiomeColors(Scene scene) {
@@ -287,14 +409,124 @@ public class ClSceneLoader extends AbstractSceneLoader {
                 .toArray();
     }
 
+    private static int[] compressOctree(int[] octree) {
+        if (ChunkyClTab.octreeDag) {
+            // Deduplicate after mapping, different Chunky blocks may share a packed block
+            OctreeDag dag = OctreeDag.build(octree);
+            Log.infof("Octree DAG: %d -> %d ints (%.2fx smaller)",
+                    dag.getSourceSize(), dag.getTree().length, dag.getCompressionRatio());
+            octree = dag.getTree();
+        }
+        if (ChunkyClTab.reorderOctree) {
+            octree = OctreeLayout.reorder(octree);
+        }
+        return octree;
+    }
+
+    /**
+     * @return Name of the world octree layout, for the render timer.
+     */
+    public String getOctreeLayout() {
+        return octreeLayout;
+    }
+
+    /**
+     * Upload the world octree. The depth buffer layout is described in octree.h.
+     *
+     * @param pairs Merged water pair table, or null.
+     */
+    private void uploadWorldOctree(int[] octree, int depth, int[] pairs) {
+        int[] tree = compressOctree(octree);
+        int format = 0;
+        PagedOctree paged = null;
+        if (ChunkyClTab.octreePagePool > 0) {
+            // Paging takes precedence over the brick tree, the top tree and the pages are packed octrees
+            paged = PagedOctree.build(tree, depth, OCTREE_PAGE_SIZE);
+            tree = paged.getTop();
+            format = PagedOctree.FORMAT;
+            octreeLayout = "paged, " + (ChunkyClTab.reorderOctree ? "traversal order" : "allocation order");
+            Log.infof("Octree paging: %d resident ints, %d pages", tree.length, paged.getPageCount());
+        } else if (ChunkyClTab.brickTree) {
+            tree = BrickTree.build(tree, depth);
+            format = BrickTree.FORMAT;
+            octreeLayout = "brick tree";
+        } else {
+            octreeLayout = ChunkyClTab.reorderOctree ? "traversal order" : "allocation order";
+        }
+        if (ChunkyClTab.octreeDag) {
+            octreeLayout += ", DAG";
+        }
+
+        int[] lod = null;
+        if (ChunkyClTab.lodThreshold > 0 && format == 0 && blockColors != null) {
+            lod = buildOctreeLod(tree, pairs);
+        }
+
+        int pairOffset = -1;
+        if (pairs != null) {
+            pairOffset = tree.length;
+            tree = Arrays.copyOf(tree, tree.length + pairs.length);
+            System.arraycopy(pairs, 0, tree, pairOffset, pairs.length);
+        }
+
+        int lodOffset = -1;
+        if (lod != null) {
+            lodOffset = tree.length;
+            tree = Arrays.copyOf(tree, tree.length + lod.length);
+            System.arraycopy(lod, 0, tree, lodOffset, lod.length);
+        }
+
+        int pageTableOffset = -1;
+        if (paged != null) {
+            // ChunkyClTab.octreePagePool is in megabytes
+            octreePager = new ClOctreePager(paged, tree, (long) ChunkyClTab.octreePagePool << 18, context);
+            octreeData = octreePager.getData();
+            pageTableOffset = octreePager.getPageTableOffset();
+        } else {
+            octreeData = new ClShardedIntBuffer(tree, context);
+        }
+        octreeDepth = new ClIntBuffer(new int[] {depth, format, pairOffset, pageTableOffset,
+                ClShardedIntBuffer.getShardShift(context), lodOffset}, context);
+    }
+
+    private int[] buildOctreeLod(int[] tree, int[] pairs) {
+        int[] lod = OctreeLod.build(tree, data -> {
+            if (pairs != null && data >= MergedOctree.MERGED_LEAF && data != OCTREE_ANY_TYPE) {
+                // Merged water leaf, the world block unless it is air
+                int pair = 2 * (data - MergedOctree.MERGED_LEAF);
+                return pairs[pair] != 0 ? -pairs[pair] : -pairs[pair + 1];
+            }
+            return data;
+        }, block -> blockColors.getOrDefault(block, 0));
+        if (lod == null) {
+            Log.warn("Octree LOD is not available for this octree layout");
+        }
+        return lod;
+    }
+
     @Override
     protected boolean loadWorldOctree(int[] octree, int depth, int[] blockMapping, ResourcePalette<PackedBlock> blockPalette) {
-        if (octreeData != null) octreeData.close();
+        if (octreePager != null) {
+            // The pager owns the octree data
+            octreePager.close();
+        } else if (octreeData != null) {
+            octreeData.close();
+        }
         if (octreeDepth != null) octreeDepth.close();
+        octreePager = null;
+        octreeData = null;
+        octreeDepth = null;
 
         int[] mappedOctree = mapOctree(octree, blockMapping);
-        octreeData = new ClIntBuffer(mappedOctree, context);
-        octreeDepth = new ClIntBuffer(depth, context);
+        heightmap = new ColumnHeightmap(depth);
+        heightmap.add(mappedOctree, depth);
+        if (ChunkyClTab.mergeWater) {
+            // Uploaded together with the water
+            worldOctree = mappedOctree;
+            worldOctreeDepth = depth;
+        } else {
+            uploadWorldOctree(mappedOctree, depth, null);
+        }
         return true;
     }
 
@@ -304,11 +536,53 @@ public class ClSceneLoader extends AbstractSceneLoader {
         if (waterOctreeDepth != null) waterOctreeDepth.close();
 
         int[] mappedOctree = mapOctree(octree, blockMapping);
-        waterOctreeData = new ClIntBuffer(mappedOctree, context);
-        waterOctreeDepth = new ClIntBuffer(depth, context);
+        if (columnHeights != null) columnHeights.close();
+        if (heightmap == null || !heightmap.add(mappedOctree, depth)) {
+            heightmap = new ColumnHeightmap(depth);
+            heightmap.fill();
+        }
+        columnHeights = new ClIntBuffer(heightmap, context);
+        heightmap = null;
+
+        if (worldOctree != null) {
+            if (depth == worldOctreeDepth) {
+                MergedOctree merged = MergedOctree.build(worldOctree, mappedOctree);
+                uploadWorldOctree(merged.getTree(), depth, merged.getPairs());
+                // The water octree is left empty
+                mappedOctree = new int[] {0};
+                hasWater = false;
+            } else {
+                Log.warn("Water octree depth does not match the world, not merging water");
+                uploadWorldOctree(worldOctree, worldOctreeDepth, null);
+            }
+            worldOctree = null;
+        }
+
+        waterOctreeData = new ClShardedIntBuffer(compressOctree(mappedOctree), context);
+        waterOctreeDepth = new ClIntBuffer(new int[] {depth, 0, -1, -1, ClShardedIntBuffer.getShardShift(context), -1}, context);
         return true;
     }
 
+    @Override
+    protected void loadActorTriangles(int[] triangles) {
+        clActorBvh.update(triangles);
+    }
+
+    @Override
+    protected int getBvhWidth() {
+        return ChunkyClTab.bvh8 ? 8 : 4;
+    }
+
+    @Override
+    protected int getBvhLeafSize() {
+        return ChunkyClTab.bvhLeafSize;
+    }
+
+    @Override
+    protected boolean useInstancing() {
+        return ChunkyClTab.entityInstancing;
+    }
+
     @Override
     protected AbstractTextureLoader createTextureLoader() {
         return new ClTextureLoader(context);
@@ -341,10 +615,10 @@ public class ClSceneLoader extends AbstractSceneLoader {
 
     @Override
     protected ResourcePalette<PackedTriangleModel> createTriangleModelPalette() {
-        return new ClPackedResourcePalette<>(context);
+        return new ClShardedResourcePalette<>(context);
     }
 
-    public ClIntBuffer getOctreeData() {
+    public ClShardedIntBuffer getOctreeData() {
         assert octreeData != null;
         return octreeData;
     }
@@ -354,11 +628,36 @@ public class ClSceneLoader extends AbstractSceneLoader {
         return octreeDepth;
     }
 
-    public ClIntBuffer getWaterOctreeData() {
+    public ClShardedIntBuffer getWaterOctreeData() {
         assert waterOctreeData != null;
         return waterOctreeData;
     }
 
+    public ClIntBuffer getColumnHeights() {
+        assert columnHeights != null;
+        return columnHeights;
+    }
+
+    /**
+     * @return Pager of the world octree, or null if the octree is fully resident.
+     */
+    public ClOctreePager getOctreePager() {
+        return octreePager;
+    }
+
+    /**
+     * @return True if any scene buffer is split across more than one shard.
+     */
+    public boolean isSharded() {
+        return (octreeData != null && octreeData.getShardCount() > 1)
+                || (waterOctreeData != null && waterOctreeData.getShardCount() > 1)
+                || (trigPalette != null && getTrigPalette().get().getShardCount() > 1);
+    }
+
+    public ClMemory getOctreePageRequests() {
+        return octreePager != null ? octreePager.getFeedback() : noPageRequests;
+    }
+
     public ClIntBuffer getWaterOctreeDepth() {
         assert waterOctreeDepth != null;
         return waterOctreeDepth;
@@ -394,17 +693,24 @@ public class ClSceneLoader extends AbstractSceneLoader {
         return (ClPackedResourcePalette<PackedWaterModel>) waterPalette;
     }
 
-    public ClPackedResourcePalette<PackedTriangleModel> getTrigPalette() {
-        assert trigPalette instanceof ClPackedResourcePalette;
-        return (ClPackedResourcePalette<PackedTriangleModel>) trigPalette;
+    public ClShardedResourcePalette<PackedTriangleModel> getTrigPalette() {
+        assert trigPalette instanceof ClShardedResourcePalette;
+        return (ClShardedResourcePalette<PackedTriangleModel>) trigPalette;
     }
 
     public ClIntBuffer getWorldBvh() {
         return clWorldBvh.apply(this.worldBvh);
     }
 
-    public ClIntBuffer getActorBvh() {
-        return clActorBvh.apply(this.actorBvh);
+    public ClActorBvh getActorBvh() {
+        return clActorBvh;
+    }
+
+    /**
+     * @return Traversal stack entries the BVHs of the scene need, see FEATURE_BVH_STACK_SIZE.
+     */
+    public int getBvhStackSize() {
+        return Math.max(hasWorldBvh() ? worldBvhStackSize : 0, hasActorBvh() ? clActorBvh.getStackSize() : 0);
     }
 
     public ClSky getSky() {
@@ -436,6 +742,11 @@ public class ClSceneLoader extends AbstractSceneLoader {
         return emitterGridEmitters;
     }
 
+    public ClIntBuffer getEmitterGridAlias() {
+        assert emitterGridAlias != null;
+        return emitterGridAlias;
+    }
+
     public ClIntBuffer getBiomeMeta() {
         assert biomeMeta != null;
         return biomeMeta;
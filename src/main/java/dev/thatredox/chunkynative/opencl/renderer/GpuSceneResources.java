@@ -3,6 +3,7 @@ package dev.thatredox.chunkynative.opencl.renderer;
 import static org.jocl.CL.*;
 
 import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.tonemap.Denoiser;
 import dev.thatredox.chunkynative.opencl.ui.ChunkyClTab;
 import dev.thatredox.chunkynative.opencl.util.ClIntBuffer;
 import dev.thatredox.chunkynative.opencl.util.ClMemory;
@@ -14,19 +15,22 @@ import se.llbit.chunky.renderer.scene.Scene;
 public class GpuSceneResources implements AutoCloseable {
     private final ClContext context;
     private final ClMemory buffer;
-    private final ClMemory randomSeed;
-    private final ClMemory bufferSpp;
     private final ClIntBuffer canvasConfig;
     private final ClIntBuffer rayDepth;
     private final ClMemory sceneSettings;
+    private final boolean writeGuides;
+    private final ClMemory guides;
 
-    public GpuSceneResources(ClContext context, Scene scene, float[] passBuffer) {
+    /**
+     * @param lodScale Footprint scale of the world octree LOD (see octree.h), 0 to always trace the
+     *                 leaves. Passed with the scene settings of this render since the octree is
+     *                 shared with the preview.
+     */
+    public GpuSceneResources(ClContext context, Scene scene, float[] passBuffer, float lodScale) {
         this.context = context;
 
         this.buffer = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
                 (long) Sizeof.cl_float * passBuffer.length, Pointer.to(passBuffer), null));
-        this.randomSeed = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_ONLY, Sizeof.cl_int, null, null));
-        this.bufferSpp = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_ONLY, Sizeof.cl_int, null, null));
 
         this.canvasConfig = new ClIntBuffer(new int[] {
                 scene.canvasConfig.getWidth(), scene.canvasConfig.getHeight(),
@@ -37,7 +41,7 @@ public class GpuSceneResources implements AutoCloseable {
 
         this.sceneSettings = new ClMemory(
                 clCreateBuffer(context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                        (long) Sizeof.cl_float * 7,
+                        (long) Sizeof.cl_float * 9,
                         Pointer.to(new float[] {
                                 ((Double) Reflection.getFieldValue(scene, "transmissivityCap", Double.class)).floatValue(),
                                 ((Boolean) Reflection.getFieldValue(scene, "fancierTranslucency", Boolean.class)) ? 1.0f : 0.0f,
@@ -45,8 +49,16 @@ public class GpuSceneResources implements AutoCloseable {
                                 scene.getSunSamplingStrategy().isSunLuminosity() ? 1.0f : 0.0f,
                                 scene.getSunSamplingStrategy().isStrictDirectLight() ? 1.0f : 0.0f,
                                 ChunkyClTab.russianRouletteThreshold,
-                                (float) ChunkyClTab.virtualDepth
+                                (float) ChunkyClTab.virtualDepth,
+                                (float) ChunkyClTab.sampler.ordinal(),
+                                lodScale
                         }), null));
+
+        // First hit guides for the denoiser, see Denoiser
+        this.writeGuides = ChunkyClTab.denoiserIterations > 0;
+        int guideSize = writeGuides ? passBuffer.length / 3 * Denoiser.GUIDE_SIZE : 1;
+        this.guides = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                (long) Sizeof.cl_float * guideSize, Pointer.to(new float[guideSize]), null));
     }
 
     public ClContext getContext() {
@@ -57,14 +69,6 @@ public class GpuSceneResources implements AutoCloseable {
         return buffer;
     }
 
-    public ClMemory getRandomSeed() {
-        return randomSeed;
-    }
-
-    public ClMemory getBufferSpp() {
-        return bufferSpp;
-    }
-
     public ClIntBuffer getCanvasConfig() {
         return canvasConfig;
     }
@@ -77,13 +81,23 @@ public class GpuSceneResources implements AutoCloseable {
         return sceneSettings;
     }
 
+    /**
+     * @return True if the render kernel should write the denoiser guides.
+     */
+    public boolean writesGuides() {
+        return writeGuides;
+    }
+
+    public ClMemory getGuides() {
+        return guides;
+    }
+
     @Override
     public void close() {
+        guides.close();
         sceneSettings.close();
         rayDepth.close();
         canvasConfig.close();
-        bufferSpp.close();
-        randomSeed.close();
         buffer.close();
     }
 }
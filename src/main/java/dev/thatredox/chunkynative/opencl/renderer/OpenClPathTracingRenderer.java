@@ -2,13 +2,21 @@ package dev.thatredox.chunkynative.opencl.renderer;
 
 import static org.jocl.CL.*;
 
+import dev.thatredox.chunkynative.opencl.context.ClContext;
 import dev.thatredox.chunkynative.opencl.context.ContextManager;
 import dev.thatredox.chunkynative.opencl.renderer.ClSceneLoader;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.AdaptiveKernel;
 import dev.thatredox.chunkynative.opencl.renderer.kernel.DispatchParams;
 import dev.thatredox.chunkynative.opencl.renderer.kernel.KernelBindings;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.KernelFeatures;
 import dev.thatredox.chunkynative.opencl.renderer.kernel.PathTraceKernel;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.PersistentKernel;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.RenderKernel;
 import dev.thatredox.chunkynative.opencl.renderer.kernel.SceneConstants;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.WavefrontKernel;
 import dev.thatredox.chunkynative.opencl.renderer.scene.*;
+import dev.thatredox.chunkynative.opencl.tonemap.Denoiser;
+import dev.thatredox.chunkynative.opencl.ui.ChunkyClTab;
 import dev.thatredox.chunkynative.opencl.ui.OpenClRenderTimer;
 import org.jocl.*;
 
@@ -26,7 +34,15 @@ import java.util.function.BooleanSupplier;
 
 public class OpenClPathTracingRenderer implements Renderer {
 
+    // Dispatches between reads of the octree page feedback, once the pages in view are loaded
+    private static final int PAGE_FEEDBACK_INTERVAL = 8;
+    // Passes a render may throw away because they traced pages that were not loaded yet
+    private static final int MAX_DISCARDED_PASSES = 16;
+
     private BooleanSupplier postRender = () -> true;
+    // Samples per tile of the last adaptive render, so a resumed or extended render keeps the per
+    // tile weights of the sample buffer. Cleared with the sample buffer.
+    private volatile int[] adaptiveTileSamples = null;
 
     @Override
     public String getId() {
@@ -64,13 +80,32 @@ public class OpenClPathTracingRenderer implements Renderer {
             // Ensure the scene is loaded
             sceneLoader.ensureLoad(manager.bufferedScene);
 
+            SceneConstants constants = SceneConstants.fromScene(scene);
+
             try (ClCamera camera = new ClCamera(scene, context.context);
-                 GpuSceneResources gpu = new GpuSceneResources(context.context, scene, passBuffer);
-                 PathTraceKernel kernel = new PathTraceKernel(context.renderer.kernel, context.context.queue)) {
+                 GpuSceneResources gpu = new GpuSceneResources(context.context, scene, passBuffer,
+                         camera.getPixelAngle() * ChunkyClTab.lodThreshold);
+                 RenderKernel kernel = createKernel(
+                         context.renderer.getProgram(KernelFeatures.fromScene(scene, constants, sceneLoader, camera)),
+                         context.context, scene, adaptiveTileSamples)) {
                 RenderScheduler scheduler = new RenderScheduler(context.context.queue);
                 // Generate initial camera rays
                 camera.generate(renderLock, true);
-                kernel.setStaticArgs(new KernelBindings(camera, sceneLoader, gpu, SceneConstants.fromScene(scene)));
+                kernel.setStaticArgs(new KernelBindings(camera, sceneLoader, gpu, constants));
+                AdaptiveKernel adaptive = kernel instanceof AdaptiveKernel ? (AdaptiveKernel) kernel : null;
+                if (gpu.writesGuides()) {
+                    Denoiser.ensureGuides(context, sampleBuffer, scene.canvasConfig.getWidth(), scene.canvasConfig.getHeight());
+                }
+                // Ray sorting is off by default, timing it separately shows whether it pays off for a scene
+                String timingKey = kernel instanceof WavefrontKernel && ChunkyClTab.sortRays
+                        ? sceneLoader.getOctreeLayout() + ", sorted rays" : sceneLoader.getOctreeLayout();
+
+                ClOctreePager pager = sceneLoader.getOctreePager();
+                // The pool starts empty, so the page feedback is read after every dispatch until the
+                // pages in view are loaded
+                boolean pagesLoading = pager != null;
+                int dispatchesSinceFeedback = 0;
+                int discardedPasses = 0;
 
                 int bufferSppReal = 0;
                 int logicalSpp = scene.spp;
@@ -85,21 +120,49 @@ public class OpenClPathTracingRenderer implements Renderer {
                 // This is the main rendering loop. This deals with dispatching rendering tasks. The majority of time is spent
                 // waiting for the OpenCL renderer to complete.
                 while (logicalSpp < scene.getTargetSpp()) {
+                    // Trace several samples per dispatch, without overshooting the target spp. Pre-generated
+                    // camera rays are the same for every sample of a dispatch, so those trace one sample
+                    // and get new rays in between.
+                    int samples = camera.needGenerate ? 1 : Math.max(1, Math.min(ChunkyClTab.samplesPerDispatch,
+                            scene.getTargetSpp() - logicalSpp - bufferSppReal));
+
                     renderLock.lock();
-                    kernel.setPerDispatchArgs(new DispatchParams(rand.nextInt(), bufferSppReal));
+                    long dispatchStart = System.nanoTime();
+                    kernel.setPerDispatchArgs(new DispatchParams(rand.nextInt(), bufferSppReal, samples, logicalSpp + bufferSppReal));
                     cl_event renderEvent = kernel.dispatch(passBuffer.length / 3, null, null);
                     scheduler.waitFor(renderEvent);
+                    OpenClRenderTimer.addKernelTime(timingKey, System.nanoTime() - dispatchStart, samples);
+                    int missedPages = 0;
+                    if (pager != null && (pagesLoading || ++dispatchesSinceFeedback >= PAGE_FEEDBACK_INTERVAL)) {
+                        // Stream in the pages the dispatches missed
+                        missedPages = pager.update();
+                        dispatchesSinceFeedback = 0;
+                        pagesLoading = missedPages > 0 && !pager.isOverCommitted();
+                    }
                     renderLock.unlock();
-                    bufferSppReal += 1;
-                    scene.spp += 1;
+                    bufferSppReal += samples;
+                    scene.spp += samples;
+
+                    if (missedPages > 0 && !pager.isOverCommitted() && discardedPasses < MAX_DISCARDED_PASSES) {
+                        // Missing pages were traced as their fallback leaf. Throw the pass away and trace
+                        // it again with the pages loaded, the next dispatch overwrites the pass buffer.
+                        // Adaptive sampling gets back the tiles the pass retired, so it cannot have
+                        // converged with the discarded samples.
+                        discardedPasses++;
+                        scene.spp -= bufferSppReal;
+                        bufferSppReal = 0;
+                        if (adaptive != null) adaptive.discardPass();
+                        continue;
+                    }
 
                     if (camera.needGenerate && cameraGenTask.isDone()) {
                         cameraGenTask = Chunky.getCommonThreads().submit(() -> camera.generate(renderLock, true));
                     }
 
                     boolean saveEvent = isSaveEvent(manager.getSnapshotControl(), scene, logicalSpp + bufferSppReal);
-                    if (bufferMergeTask.isDone() || saveEvent) {
-                        if (!scene.shouldFinalizeBuffer() && !saveEvent) {
+                    boolean converged = adaptive != null && adaptive.isConverged();
+                    if (bufferMergeTask.isDone() || saveEvent || converged) {
+                        if (!scene.shouldFinalizeBuffer() && !saveEvent && !converged) {
                             long time = System.currentTimeMillis();
                             if (time - lastCallback > 100 && !manager.shouldFinalize()) {
                                 lastCallback = time;
@@ -117,10 +180,23 @@ public class OpenClPathTracingRenderer implements Renderer {
                         int sampSpp = sceneSpp[0];
                         int passSpp = bufferSppReal;
                         double sinv = 1.0 / (sampSpp + passSpp);
+                        int[] passTileSpp = adaptive != null ? adaptive.endPass() : null;
+                        if (gpu.writesGuides()) {
+                            // Guides stay on the device, merged before the next dispatch overwrites them
+                            if (adaptive != null) {
+                                adaptive.mergeGuides(sampleBuffer, gpu.getGuides(), passTileSpp);
+                            } else {
+                                Denoiser.mergeGuides(sampleBuffer, gpu.getGuides(), passSpp);
+                            }
+                        }
                         bufferSppReal = 0;
 
                         bufferMergeTask = Chunky.getCommonThreads().submit(() -> {
-                            Arrays.parallelSetAll(sampleBuffer, i -> (sampleBuffer[i] * sampSpp + passBuffer[i] * passSpp) * sinv);
+                            if (adaptive != null) {
+                                adaptive.merge(sampleBuffer, passBuffer, passTileSpp);
+                            } else {
+                                Arrays.parallelSetAll(sampleBuffer, i -> (sampleBuffer[i] * sampSpp + passBuffer[i] * passSpp) * sinv);
+                            }
                             sceneSpp[0] += passSpp;
                             scene.postProcessFrame(TaskTracker.Task.NONE);
                             manager.redrawScreen();
@@ -130,11 +206,20 @@ public class OpenClPathTracingRenderer implements Renderer {
                             bufferMergeTask.join();
                             if (postRender.getAsBoolean()) break;
                         }
+                        if (converged) {
+                            // Every tile is below the error threshold. The render is complete, so count it
+                            // as reaching the target and let the manager finish it. The real samples per
+                            // tile are kept for when the target is raised.
+                            bufferMergeTask.join();
+                            scene.spp = Math.max(scene.spp, scene.getTargetSpp());
+                            break;
+                        }
                     }
                 }
 
                 cameraGenTask.join();
                 bufferMergeTask.join();
+                adaptiveTileSamples = adaptive != null ? adaptive.getTileSamples() : null;
             }
 
         } finally {
@@ -142,6 +227,26 @@ public class OpenClPathTracingRenderer implements Renderer {
         }
     }
 
+    private static RenderKernel createKernel(cl_program program, ClContext context, Scene scene, int[] tileSamples) {
+        int width = scene.canvasConfig.getWidth();
+        int height = scene.canvasConfig.getHeight();
+        int pixelCount = width * height;
+        switch (ChunkyClTab.integrator) {
+            case WAVEFRONT:
+                return new WavefrontKernel(program, context, pixelCount, ChunkyClTab.sortRays);
+            case PERSISTENT:
+                return new PersistentKernel(program, context, pixelCount);
+            case MEGAKERNEL:
+            default:
+                // Adaptive sampling is a mode of the megakernel
+                if (ChunkyClTab.adaptiveThreshold > 0) {
+                    return new AdaptiveKernel(program, context, width, height, scene.spp, tileSamples,
+                            ChunkyClTab.adaptiveThreshold / 100.0f);
+                }
+                return new PathTraceKernel(program, context.queue);
+        }
+    }
+
     private boolean isSaveEvent(SnapshotControl control, Scene scene, int spp) {
         return control.saveSnapshot(scene, spp) || control.saveRenderDump(scene, spp);
     }
@@ -154,6 +259,8 @@ public class OpenClPathTracingRenderer implements Renderer {
     @Override
     public void sceneReset(DefaultRenderManager manager, ResetReason reason, int resetCount) {
         boolean fullClear = reason == ResetReason.SCENE_LOADED || reason == ResetReason.MATERIALS_CHANGED;
+        Denoiser.clearGuides(manager.bufferedScene.getSampleBuffer());
+        adaptiveTileSamples = null;
         synchronized (manager.bufferedScene) {
             Arrays.fill(manager.bufferedScene.getSampleBuffer(), 0.0);
             manager.bufferedScene.spp = 0;
@@ -2,9 +2,11 @@ package dev.thatredox.chunkynative.opencl.renderer;
 
 import dev.thatredox.chunkynative.opencl.context.ContextManager;
 import dev.thatredox.chunkynative.opencl.renderer.ClSceneLoader;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.KernelFeatures;
 import dev.thatredox.chunkynative.opencl.renderer.scene.*;
 import dev.thatredox.chunkynative.opencl.util.ClIntBuffer;
 import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import dev.thatredox.chunkynative.opencl.util.ClShardedIntBuffer;
 import org.jocl.*;
 import se.llbit.chunky.renderer.DefaultRenderManager;
 import se.llbit.chunky.renderer.Renderer;
@@ -53,8 +55,10 @@ public class OpenClPreviewRenderer implements Renderer {
         // Ensure the scene is loaded
         sceneLoader.ensureLoad(manager.bufferedScene);
 
-        // Load the kernel
-        cl_kernel kernel = clCreateKernel(context.renderer.kernel, "preview", null);
+        // Load the kernel, from a variant if the BVHs are too deep for the generic program
+        KernelFeatures features = KernelFeatures.forPreview(sceneLoader);
+        cl_kernel kernel = clCreateKernel(features == null ? context.renderer.kernel
+                : context.renderer.getProgram(features), "preview", null);
 
         ClCamera camera = new ClCamera(scene, context.context);
         ClMemory buffer = new ClMemory(clCreateBuffer(context.context.context, CL_MEM_WRITE_ONLY,
@@ -79,9 +83,15 @@ public class OpenClPreviewRenderer implements Renderer {
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(camera.cameraSettings.get()));
 
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getOctreeDepth().get()));
-            clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getOctreeData().get()));
+            for (int i = 0; i < ClShardedIntBuffer.SHARDS; i++) {
+                clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getOctreeData().get(i)));
+            }
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getWaterOctreeDepth().get()));
-            clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getWaterOctreeData().get()));
+            for (int i = 0; i < ClShardedIntBuffer.SHARDS; i++) {
+                clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getWaterOctreeData().get(i)));
+            }
+            clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getColumnHeights().get()));
+            clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getOctreePageRequests().get()));
 
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getBlockPalette().get()));
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getQuadPalette().get()));
@@ -90,7 +100,9 @@ public class OpenClPreviewRenderer implements Renderer {
 
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getWorldBvh().get()));
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getActorBvh().get()));
-            clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getTrigPalette().get()));
+            for (int i = 0; i < ClShardedIntBuffer.SHARDS; i++) {
+                clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getTrigPalette().get().get(i)));
+            }
 
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getTexturePalette().getAtlas()));
             clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(sceneLoader.getMaterialPalette().get()));
@@ -114,6 +126,9 @@ public class OpenClPreviewRenderer implements Renderer {
             clEnqueueReadBuffer(context.context.queue, buffer.get(), CL_TRUE, 0,
                     (long) Sizeof.cl_int * imageData.length, Pointer.to(imageData),
                     1, renderEvent, null);
+            if (sceneLoader.getOctreePager() != null) {
+                sceneLoader.getOctreePager().update();
+            }
 
             manager.redrawScreen();
             postRender.getAsBoolean();
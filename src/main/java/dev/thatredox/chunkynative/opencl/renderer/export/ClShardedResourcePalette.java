@@ -0,0 +1,53 @@
+package dev.thatredox.chunkynative.opencl.renderer.export;
+
+import dev.thatredox.chunkynative.common.export.Packer;
+import dev.thatredox.chunkynative.common.export.ResourcePalette;
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.util.ClShardedIntBuffer;
+import it.unimi.dsi.fastutil.ints.IntArrayList;
+
+/**
+ * Packed resource palette that may grow past the device allocation limit. Resources never straddle
+ * two shards, so the kernel can read a resource through a single shard pointer.
+ */
+public class ClShardedResourcePalette<T extends Packer> implements ResourcePalette<T>, AutoCloseable {
+    protected ClShardedIntBuffer buffer = null;
+    protected IntArrayList palette = new IntArrayList();
+    protected final ClContext context;
+    private final int shift;
+
+    public ClShardedResourcePalette(ClContext context) {
+        this.context = context;
+        this.shift = ClShardedIntBuffer.getShardShift(context);
+    }
+
+    @Override
+    public int put(T resource) {
+        if (buffer != null) throw new IllegalStateException("Attempted to modify a locked palette.");
+        IntArrayList packed = resource.pack();
+        int ptr = palette.size();
+        if (packed.size() > 1 && (ptr >> shift) != ((ptr + packed.size() - 1) >> shift)) {
+            // Move the resource to the start of the next shard
+            ptr = ((ptr >> shift) + 1) << shift;
+            palette.size(ptr);
+        }
+        palette.addAll(packed);
+        return ptr;
+    }
+
+    public ClShardedIntBuffer build() {
+        if (buffer == null) {
+            buffer = new ClShardedIntBuffer(palette.elements(), palette.size(), context);
+        }
+        return buffer;
+    }
+
+    public ClShardedIntBuffer get() {
+        return build();
+    }
+
+    @Override
+    public void close() {
+        buffer.close();
+    }
+}
@@ -0,0 +1,326 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import static org.jocl.CL.*;
+
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.tonemap.Denoiser;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Pointer;
+import org.jocl.Sizeof;
+import org.jocl.cl_event;
+import org.jocl.cl_kernel;
+import org.jocl.cl_program;
+
+import java.util.Arrays;
+import java.util.stream.IntStream;
+
+/**
+ * Adaptive sampling mode of the megakernel path tracer. Only the tiles that have not converged are
+ * rendered, and the pass buffer keeps a sample count per tile (see {@code integrator/adaptive.h}).
+ */
+public class AdaptiveKernel implements RenderKernel {
+    // Must match ADAPTIVE_TILE_SIZE in adaptive.h
+    public static final int TILE_SIZE = 16;
+    private static final int TILE_PIXELS = TILE_SIZE * TILE_SIZE;
+
+    private final ClContext context;
+    private final int width;
+    private final int tilesX;
+    private final int tileCount;
+    private final float threshold;
+
+    private final cl_kernel render;
+    private final cl_kernel tileError;
+    private final cl_kernel mergeStats;
+    private final KernelArgBinder renderBinder;
+    private final KernelArgBinder errorBinder;
+    private final KernelArgBinder mergeBinder;
+
+    private final ClMemory[] tileLists;
+    // Active tile list at the start of the pass, restored when the pass is discarded
+    private final ClMemory passTileList;
+    private final ClMemory tileListSize;
+    private final ClMemory tileSpp;
+    private final ClMemory resSquared;
+    // Statistics of all merged passes, for the error estimate
+    private final ClMemory totalMean;
+    private final ClMemory totalSquared;
+    private final ClMemory tileTotal;
+    private final ClMemory tileBaseSpp;
+
+    // Index of the per-dispatch arguments
+    private int renderDispatchArg;
+    private int renderSamplesArg;
+    private int errorListArg;
+
+    private final int[] intValue = new int[1];
+    private int samples = 1;
+    private int current = 0;
+    private int activeTiles;
+    private int passActiveTiles;
+
+    // Samples per tile already merged into the sample buffer
+    private final int[] tileSamples;
+
+    /**
+     * @param baseSpp     Samples per pixel already in the sample buffer.
+     * @param tileSamples Samples per tile already in the sample buffer, from an earlier adaptive render
+     *                    of the same sample buffer. Ignored if null or not for this canvas size.
+     */
+    public AdaptiveKernel(cl_program program, ClContext context, int width, int height, int baseSpp,
+                          int[] tileSamples, float threshold) {
+        this.context = context;
+        this.width = width;
+        this.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        this.tileCount = tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE);
+        this.threshold = threshold;
+
+        this.render = clCreateKernel(program, "render_tiles", null);
+        this.tileError = clCreateKernel(program, "adaptive_tile_error", null);
+        this.mergeStats = clCreateKernel(program, "adaptive_merge_stats", null);
+        this.renderBinder = new KernelArgBinder(render);
+        this.errorBinder = new KernelArgBinder(tileError);
+        this.mergeBinder = new KernelArgBinder(mergeStats);
+
+        int[] allTiles = IntStream.range(0, tileCount).toArray();
+        this.tileLists = new ClMemory[] {
+                new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                        (long) Sizeof.cl_int * tileCount, Pointer.to(allTiles), null)),
+                createBuffer((long) Sizeof.cl_int * tileCount)
+        };
+        this.passTileList = createBuffer((long) Sizeof.cl_int * tileCount);
+        this.tileListSize = createBuffer(Sizeof.cl_int);
+        this.tileSpp = createBuffer((long) Sizeof.cl_int * tileCount);
+        this.resSquared = createBuffer((long) Sizeof.cl_float * width * height * 3);
+        this.totalMean = createBuffer((long) Sizeof.cl_float * width * height * 3);
+        this.totalSquared = createBuffer((long) Sizeof.cl_float * width * height * 3);
+        this.tileTotal = createBuffer((long) Sizeof.cl_int * tileCount);
+        fill(tileSpp, (long) Sizeof.cl_int * tileCount);
+        fill(resSquared, (long) Sizeof.cl_float * width * height * 3);
+        fill(totalMean, (long) Sizeof.cl_float * width * height * 3);
+        fill(totalSquared, (long) Sizeof.cl_float * width * height * 3);
+        fill(tileTotal, (long) Sizeof.cl_int * tileCount);
+
+        this.activeTiles = tileCount;
+        if (tileSamples != null && tileSamples.length == tileCount) {
+            this.tileSamples = tileSamples.clone();
+        } else {
+            this.tileSamples = new int[tileCount];
+            Arrays.fill(this.tileSamples, baseSpp);
+        }
+        this.tileBaseSpp = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                (long) Sizeof.cl_int * tileCount, Pointer.to(this.tileSamples), null));
+        beginPass();
+    }
+
+    private ClMemory createBuffer(long size) {
+        return new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE, size, null, null));
+    }
+
+    private void copyTiles(ClMemory src, ClMemory dst, int tiles) {
+        if (tiles == 0) return;
+        clEnqueueCopyBuffer(context.queue, src.get(), dst.get(), 0, 0, (long) Sizeof.cl_int * tiles,
+                0, null, null);
+    }
+
+    private void beginPass() {
+        passActiveTiles = activeTiles;
+        copyTiles(tileLists[current], passTileList, activeTiles);
+    }
+
+    private void fill(ClMemory buffer, long size) {
+        intValue[0] = 0;
+        clEnqueueFillBuffer(context.queue, buffer.get(), Pointer.to(intValue), Sizeof.cl_int, 0, size,
+                0, null, null);
+    }
+
+    @Override
+    public void setStaticArgs(KernelBindings bindings) {
+        SceneConstants constants = bindings.getSceneConstants();
+
+        renderBinder.reset();
+        renderBinder.setMem(bindings.getCamera().projectorType.get());
+        renderBinder.setMem(bindings.getCamera().cameraSettings.get());
+        bindings.bindScene(renderBinder);
+        renderDispatchArg = renderBinder.getIndex();
+        renderBinder.setInt(0);
+        renderBinder.setInt(0);
+        renderBinder.setInt(0);
+        renderBinder.setMem(bindings.getGpu().getCanvasConfig().get());
+        renderBinder.setMem(bindings.getGpu().getRayDepth().get());
+        renderBinder.setMem(bindings.getGpu().getSceneSettings().get());
+        renderBinder.setInt(constants.getEmittersEnabled());
+        renderBinder.setFloat(constants.getEmitterIntensity());
+        renderBinder.setInt(constants.getEmitterSamplingStrategy());
+        renderBinder.setInt(constants.getPreventNormalEmitterWithSampling());
+        renderSamplesArg = renderBinder.getIndex();
+        renderBinder.setInt(1);
+        renderBinder.setMem(tileLists[0].get());
+        renderBinder.setMem(tileSpp.get());
+        renderBinder.setMem(bindings.getGpu().getBuffer().get());
+        renderBinder.setMem(resSquared.get());
+        renderBinder.setInt(bindings.getGpu().writesGuides() ? 1 : 0);
+        renderBinder.setMem(bindings.getGpu().getGuides().get());
+
+        errorBinder.reset();
+        errorBinder.setMem(bindings.getGpu().getCanvasConfig().get());
+        errorBinder.setMem(bindings.getGpu().getBuffer().get());
+        errorBinder.setMem(resSquared.get());
+        errorBinder.setMem(totalMean.get());
+        errorBinder.setMem(totalSquared.get());
+        errorBinder.setMem(tileTotal.get());
+        errorBinder.setMem(tileBaseSpp.get());
+        errorListArg = errorBinder.getIndex();
+        errorBinder.setMem(tileLists[0].get());
+        errorBinder.setMem(tileSpp.get());
+        errorBinder.setInt(1);
+        errorBinder.setFloat(threshold);
+        errorBinder.setMem(tileLists[1].get());
+        errorBinder.setMem(tileListSize.get());
+
+        mergeBinder.reset();
+        mergeBinder.setMem(bindings.getGpu().getCanvasConfig().get());
+        mergeBinder.setMem(bindings.getGpu().getBuffer().get());
+        mergeBinder.setMem(resSquared.get());
+        mergeBinder.setMem(tileSpp.get());
+        mergeBinder.setMem(totalMean.get());
+        mergeBinder.setMem(totalSquared.get());
+        mergeBinder.setMem(tileTotal.get());
+    }
+
+    @Override
+    public void setPerDispatchArgs(DispatchParams params) {
+        renderBinder.setIndex(renderDispatchArg);
+        renderBinder.setInt(params.getRngSeed());
+        renderBinder.setInt(params.getBufferSpp());
+        renderBinder.setInt(params.getSampleIndex());
+        samples = params.getSamples();
+    }
+
+    /**
+     * Render the active tiles and compact the ones that have not converged into the next tile list.
+     * The global size is ignored since the work is given by the active tile list.
+     */
+    @Override
+    public cl_event dispatch(long globalSize, long[] localSize, cl_event[] waitEvents) {
+        int next = 1 - current;
+        int waitCount = waitEvents == null ? 0 : waitEvents.length;
+        if (activeTiles == 0) {
+            // Nothing left to render, and an empty range is not a valid global size
+            cl_event event = new cl_event();
+            clEnqueueMarkerWithWaitList(context.queue, waitCount, waitEvents, event);
+            return event;
+        }
+
+        renderBinder.setIndex(renderSamplesArg);
+        renderBinder.setInt(samples);
+        renderBinder.setMem(tileLists[current].get());
+        clEnqueueNDRangeKernel(context.queue, render, 1, null, new long[] { (long) activeTiles * TILE_PIXELS },
+                null, waitCount, waitEvents, null);
+
+        fill(tileListSize, Sizeof.cl_int);
+        errorBinder.setIndex(errorListArg);
+        errorBinder.setMem(tileLists[current].get());
+        errorBinder.setMem(tileSpp.get());
+        errorBinder.setInt(samples);
+        errorBinder.setFloat(threshold);
+        errorBinder.setMem(tileLists[next].get());
+        cl_event event = new cl_event();
+        clEnqueueNDRangeKernel(context.queue, tileError, 1, null, new long[] { activeTiles },
+                null, 0, null, event);
+
+        clEnqueueReadBuffer(context.queue, tileListSize.get(), CL_TRUE, 0, Sizeof.cl_int,
+                Pointer.to(intValue), 0, null, null);
+        activeTiles = intValue[0];
+        current = next;
+        return event;
+    }
+
+    /**
+     * @return True if every tile has converged.
+     */
+    public boolean isConverged() {
+        return activeTiles == 0;
+    }
+
+    /**
+     * Read the number of samples of each tile in the pass buffer, fold the pass into the error
+     * statistics, and start a new pass.
+     */
+    public int[] endPass() {
+        int[] passTileSpp = new int[tileCount];
+        clEnqueueReadBuffer(context.queue, tileSpp.get(), CL_TRUE, 0, (long) Sizeof.cl_int * tileCount,
+                Pointer.to(passTileSpp), 0, null, null);
+        clEnqueueNDRangeKernel(context.queue, mergeStats, 1, null, new long[] { tileCount },
+                null, 0, null, null);
+        fill(tileSpp, (long) Sizeof.cl_int * tileCount);
+        beginPass();
+        return passTileSpp;
+    }
+
+    /**
+     * Throw away the samples of the current pass, and bring back the tiles it retired. The next
+     * dispatch overwrites the pass buffer.
+     */
+    public void discardPass() {
+        fill(tileSpp, (long) Sizeof.cl_int * tileCount);
+        activeTiles = passActiveTiles;
+        copyTiles(passTileList, tileLists[current], activeTiles);
+    }
+
+    /**
+     * @return Samples per tile merged into the sample buffer so far.
+     */
+    public int[] getTileSamples() {
+        return tileSamples.clone();
+    }
+
+    private int tileOf(int pixel) {
+        return (pixel / width / TILE_SIZE) * tilesX + (pixel % width) / TILE_SIZE;
+    }
+
+    /**
+     * Merge the pass guides into the guides of the sample buffer with the same per tile weights as
+     * {@link #merge}. Call this before merging the pass.
+     */
+    public void mergeGuides(double[] sampleBuffer, ClMemory passGuides, int[] passTileSpp) {
+        Denoiser.mergeGuides(sampleBuffer, passGuides, TILE_SIZE, tileSamples, passTileSpp);
+    }
+
+    /**
+     * Merge a pass buffer into the sample buffer, weighting every pixel by the samples of its tile.
+     */
+    public void merge(double[] sampleBuffer, float[] passBuffer, int[] passTileSpp) {
+        IntStream.range(0, sampleBuffer.length / 3).parallel().forEach(pixel -> {
+            int tile = tileOf(pixel);
+            int sampSpp = tileSamples[tile];
+            int passSpp = passTileSpp[tile];
+            if (passSpp == 0) return;
+
+            double sinv = 1.0 / (sampSpp + passSpp);
+            for (int i = pixel * 3; i < pixel * 3 + 3; i++) {
+                sampleBuffer[i] = (sampleBuffer[i] * sampSpp + passBuffer[i] * passSpp) * sinv;
+            }
+        });
+        for (int tile = 0; tile < tileCount; tile++) {
+            tileSamples[tile] += passTileSpp[tile];
+        }
+    }
+
+    @Override
+    public void close() {
+        clReleaseKernel(render);
+        clReleaseKernel(tileError);
+        clReleaseKernel(mergeStats);
+
+        for (ClMemory list : tileLists) list.close();
+        passTileList.close();
+        tileListSize.close();
+        tileSpp.close();
+        resSquared.close();
+        totalMean.close();
+        totalSquared.close();
+        tileTotal.close();
+        tileBaseSpp.close();
+    }
+}
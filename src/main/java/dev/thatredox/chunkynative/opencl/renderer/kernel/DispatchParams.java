@@ -3,10 +3,14 @@ package dev.thatredox.chunkynative.opencl.renderer.kernel;
 public class DispatchParams {
     private final int rngSeed;
     private final int bufferSpp;
+    private final int samples;
+    private final int sampleIndex;
 
-    public DispatchParams(int rngSeed, int bufferSpp) {
+    public DispatchParams(int rngSeed, int bufferSpp, int samples, int sampleIndex) {
         this.rngSeed = rngSeed;
         this.bufferSpp = bufferSpp;
+        this.samples = samples;
+        this.sampleIndex = sampleIndex;
     }
 
     public int getRngSeed() {
@@ -16,4 +20,19 @@ public class DispatchParams {
     public int getBufferSpp() {
         return bufferSpp;
     }
+
+    /**
+     * @return Number of samples per pixel traced by this dispatch.
+     */
+    public int getSamples() {
+        return samples;
+    }
+
+    /**
+     * @return Index of the first sample of this dispatch over the whole render. Unlike the buffer spp
+     *         this does not restart when the pass buffer is merged.
+     */
+    public int getSampleIndex() {
+        return sampleIndex;
+    }
 }
@@ -0,0 +1,18 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+public enum Integrator {
+    MEGAKERNEL("Megakernel"),
+    WAVEFRONT("Wavefront"),
+    PERSISTENT("Persistent Threads");
+
+    private final String name;
+
+    Integrator(String name) {
+        this.name = name;
+    }
+
+    @Override
+    public String toString() {
+        return name;
+    }
+}
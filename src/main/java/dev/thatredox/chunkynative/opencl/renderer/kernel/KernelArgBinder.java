@@ -22,6 +22,14 @@ public class KernelArgBinder {
         this.argIndex = 0;
     }
 
+    public int getIndex() {
+        return argIndex;
+    }
+
+    public void setIndex(int argIndex) {
+        this.argIndex = argIndex;
+    }
+
     public void setMem(cl_mem mem) {
         clSetKernelArg(kernel, argIndex++, Sizeof.cl_mem, Pointer.to(mem));
     }
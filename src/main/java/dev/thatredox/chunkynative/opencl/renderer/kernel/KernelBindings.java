@@ -3,6 +3,7 @@ package dev.thatredox.chunkynative.opencl.renderer.kernel;
 import dev.thatredox.chunkynative.opencl.renderer.ClSceneLoader;
 import dev.thatredox.chunkynative.opencl.renderer.GpuSceneResources;
 import dev.thatredox.chunkynative.opencl.renderer.scene.ClCamera;
+import dev.thatredox.chunkynative.opencl.util.ClShardedIntBuffer;
 
 public class KernelBindings {
     private final ClCamera camera;
@@ -32,4 +33,52 @@ public class KernelBindings {
     public SceneConstants getSceneConstants() {
         return sceneConstants;
     }
+
+    /**
+     * Bind the scene buffers in the order of the {@code SCENE_KERNEL_ARGS} kernel arguments.
+     */
+    public void bindScene(KernelArgBinder binder) {
+        binder.setMem(sceneLoader.getOctreeDepth().get());
+        bindSharded(binder, sceneLoader.getOctreeData());
+        binder.setMem(sceneLoader.getWaterOctreeDepth().get());
+        bindSharded(binder, sceneLoader.getWaterOctreeData());
+        binder.setMem(sceneLoader.getColumnHeights().get());
+        binder.setMem(sceneLoader.getOctreePageRequests().get());
+
+        binder.setMem(sceneLoader.getBlockPalette().get());
+        binder.setMem(sceneLoader.getQuadPalette().get());
+        binder.setMem(sceneLoader.getAabbPalette().get());
+        binder.setMem(sceneLoader.getWaterPalette().get());
+
+        binder.setMem(sceneLoader.getWorldBvh().get());
+        binder.setMem(sceneLoader.getActorBvh().get());
+        bindSharded(binder, sceneLoader.getTrigPalette().get());
+
+        binder.setMem(sceneLoader.getTexturePalette().getAtlas());
+        binder.setMem(sceneLoader.getMaterialPalette().get());
+        binder.setMem(sceneLoader.getBiomeMeta().get());
+        binder.setMem(sceneLoader.getBiomeGrid().get());
+        binder.setMem(sceneLoader.getBiomeGrass().get());
+        binder.setMem(sceneLoader.getBiomeFoliage().get());
+        binder.setMem(sceneLoader.getBiomeDryFoliage().get());
+        binder.setMem(sceneLoader.getBiomeWater().get());
+        binder.setMem(sceneLoader.getEmitterGridMeta().get());
+        binder.setMem(sceneLoader.getEmitterGridCells().get());
+        binder.setMem(sceneLoader.getEmitterGridIndexes().get());
+        binder.setMem(sceneLoader.getEmitterGridEmitters().get());
+        binder.setMem(sceneLoader.getEmitterGridAlias().get());
+
+        binder.setMem(sceneLoader.getSky().skyTexture.get());
+        binder.setMem(sceneLoader.getSky().skyIntensity.get());
+        binder.setMem(sceneLoader.getSun().get());
+    }
+
+    /**
+     * Bind every shard argument of a {@code SHARDED_KERNEL_ARG}.
+     */
+    private static void bindSharded(KernelArgBinder binder, ClShardedIntBuffer buffer) {
+        for (int i = 0; i < ClShardedIntBuffer.SHARDS; i++) {
+            binder.setMem(buffer.get(i));
+        }
+    }
 }
@@ -0,0 +1,94 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import dev.thatredox.chunkynative.opencl.renderer.ClSceneLoader;
+import dev.thatredox.chunkynative.opencl.renderer.scene.ClCamera;
+import dev.thatredox.chunkynative.opencl.ui.ChunkyClTab;
+import dev.thatredox.chunkynative.util.Reflection;
+import se.llbit.chunky.renderer.scene.Scene;
+
+/**
+ * Scene features a render program is specialized for, passed to the compiler as {@code -D} defines
+ * (see {@code features.h}). Programs are cached by their features, so renders that only differ in
+ * other settings share a compiled variant.
+ */
+public class KernelFeatures {
+    /** BVH traversal stack of the generic program, FEATURE_BVH_STACK_SIZE in features.h. */
+    public static final int GENERIC_BVH_STACK_SIZE = 64;
+
+    private final String options;
+
+    private KernelFeatures(String options) {
+        this.options = options;
+    }
+
+    public static KernelFeatures fromScene(Scene scene, SceneConstants constants, ClSceneLoader sceneLoader, ClCamera camera) {
+        StringBuilder options = new StringBuilder();
+        define(options, "FEATURE_WATER", sceneLoader.hasWater());
+        define(options, "FEATURE_WORLD_BVH", sceneLoader.hasWorldBvh());
+        define(options, "FEATURE_ACTOR_BVH", sceneLoader.hasActorBvh());
+        define(options, "FEATURE_SHARDED", sceneLoader.isSharded());
+        define(options, "FEATURE_OCTREE_DDA", ChunkyClTab.octreeDda);
+        define(options, "FEATURE_PROJECTOR_TYPE", camera.getProjectorType());
+        define(options, "FEATURE_EMITTERS_ENABLED", constants.getEmittersEnabled());
+        define(options, "FEATURE_EMITTER_SAMPLING_STRATEGY", constants.getEmitterSamplingStrategy());
+        define(options, "FEATURE_SUN_SAMPLING", scene.getSunSamplingStrategy().doSunSampling());
+        define(options, "FEATURE_FANCIER_TRANSLUCENCY",
+                (boolean) Reflection.getFieldValue(scene, "fancierTranslucency", Boolean.class));
+        define(options, "FEATURE_STRICT_DIRECT_LIGHT", scene.getSunSamplingStrategy().isStrictDirectLight());
+        define(options, "FEATURE_BVH_STACK_SIZE", bvhStackSize(sceneLoader));
+        return new KernelFeatures(options.toString().trim());
+    }
+
+    /**
+     * Features of the preview program. The preview decides every other feature at runtime, only the
+     * BVH stack must fit the scene.
+     *
+     * @return The features, or null if the generic program fits the scene.
+     */
+    public static KernelFeatures forPreview(ClSceneLoader sceneLoader) {
+        int stackSize = bvhStackSize(sceneLoader);
+        if (stackSize <= GENERIC_BVH_STACK_SIZE) {
+            return null;
+        }
+        StringBuilder options = new StringBuilder();
+        define(options, "FEATURE_BVH_STACK_SIZE", stackSize);
+        return new KernelFeatures(options.toString().trim());
+    }
+
+    // Rounded up so scenes of similar depth share a variant
+    private static int bvhStackSize(ClSceneLoader sceneLoader) {
+        return Math.max(16, (sceneLoader.getBvhStackSize() + 15) & ~15);
+    }
+
+    private static void define(StringBuilder options, String name, boolean value) {
+        define(options, name, value ? 1 : 0);
+    }
+
+    private static void define(StringBuilder options, String name, int value) {
+        options.append(" -D").append(name).append('=').append(value);
+    }
+
+    /**
+     * @return Compiler options for this variant.
+     */
+    public String getOptions() {
+        return options;
+    }
+
+    @Override
+    public boolean equals(Object o) {
+        if (this == o) return true;
+        if (!(o instanceof KernelFeatures)) return false;
+        return options.equals(((KernelFeatures) o).options);
+    }
+
+    @Override
+    public int hashCode() {
+        return options.hashCode();
+    }
+
+    @Override
+    public String toString() {
+        return options;
+    }
+}
@@ -0,0 +1,109 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import static org.jocl.CL.*;
+
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.context.Device;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Pointer;
+import org.jocl.Sizeof;
+import org.jocl.cl_event;
+import org.jocl.cl_kernel;
+import org.jocl.cl_program;
+
+/**
+ * Persistent threads path tracer. Launches just enough work items to fill the device, which then
+ * pull pixels from a global job counter (see {@code integrator/persistent.h}).
+ */
+public class PersistentKernel implements RenderKernel {
+    // Work items per compute unit. Enough to hide latency on current GPUs.
+    private static final int THREADS_PER_COMPUTE_UNIT = 2048;
+
+    private final cl_kernel kernel;
+    private final ClContext context;
+    private final KernelArgBinder binder;
+    private final int pixelCount;
+    private final long threadCount;
+    private final ClMemory jobCounter;
+
+    // Index of the per-dispatch arguments
+    private int dispatchArg;
+    private int samplesArg;
+    private final int[] zero = new int[1];
+
+    public PersistentKernel(cl_program program, ClContext context, int pixelCount) {
+        this.kernel = clCreateKernel(program, "render_persistent", null);
+        this.context = context;
+        this.binder = new KernelArgBinder(kernel);
+        this.pixelCount = pixelCount;
+
+        Device device = context.device;
+        int threadsPerUnit = device.type() == Device.DeviceType.GPU ? THREADS_PER_COMPUTE_UNIT : 1;
+        this.threadCount = Math.min(pixelCount, (long) device.computeUnits() * threadsPerUnit);
+
+        this.jobCounter = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE, Sizeof.cl_int, null, null));
+    }
+
+    @Override
+    public void setStaticArgs(KernelBindings bindings) {
+        binder.reset();
+
+        binder.setMem(bindings.getCamera().projectorType.get());
+        binder.setMem(bindings.getCamera().cameraSettings.get());
+
+        bindings.bindScene(binder);
+
+        dispatchArg = binder.getIndex();
+        binder.setInt(0);
+        binder.setInt(0);
+        binder.setInt(0);
+        binder.setMem(bindings.getGpu().getCanvasConfig().get());
+        binder.setMem(bindings.getGpu().getRayDepth().get());
+        binder.setMem(bindings.getGpu().getSceneSettings().get());
+        binder.setInt(bindings.getSceneConstants().getEmittersEnabled());
+        binder.setFloat(bindings.getSceneConstants().getEmitterIntensity());
+        binder.setInt(bindings.getSceneConstants().getEmitterSamplingStrategy());
+        binder.setInt(bindings.getSceneConstants().getPreventNormalEmitterWithSampling());
+        samplesArg = binder.getIndex();
+        binder.setInt(1);
+        binder.setInt(pixelCount);
+        binder.setMem(jobCounter.get());
+        binder.setMem(bindings.getGpu().getBuffer().get());
+        binder.setInt(bindings.getGpu().writesGuides() ? 1 : 0);
+        binder.setMem(bindings.getGpu().getGuides().get());
+    }
+
+    @Override
+    public void setPerDispatchArgs(DispatchParams params) {
+        binder.setIndex(dispatchArg);
+        binder.setInt(params.getRngSeed());
+        binder.setInt(params.getBufferSpp());
+        binder.setInt(params.getSampleIndex());
+        binder.setIndex(samplesArg);
+        binder.setInt(params.getSamples());
+    }
+
+    /**
+     * The global size is ignored since the work items loop over the pixels themselves.
+     */
+    @Override
+    public cl_event dispatch(long globalSize, long[] localSize, cl_event[] waitEvents) {
+        clEnqueueFillBuffer(context.queue, jobCounter.get(), Pointer.to(zero), Sizeof.cl_int, 0, Sizeof.cl_int,
+                0, null, null);
+
+        long workSize = threadCount;
+        if (localSize != null) {
+            workSize = (workSize + localSize[0] - 1) / localSize[0] * localSize[0];
+        }
+        cl_event event = new cl_event();
+        int waitCount = waitEvents == null ? 0 : waitEvents.length;
+        clEnqueueNDRangeKernel(context.queue, kernel, 1, null, new long[] { workSize }, localSize, waitCount, waitEvents, event);
+        return event;
+    }
+
+    @Override
+    public void close() {
+        clReleaseKernel(kernel);
+        jobCounter.close();
+    }
+}
@@ -0,0 +1,130 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import static org.jocl.CL.*;
+
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Sizeof;
+import org.jocl.cl_kernel;
+import org.jocl.cl_program;
+
+/**
+ * Stable radix sort of non-negative int keys with an int value each, on the device (see
+ * {@code integrator/ray_sort.h}). The scratch buffers grow with the largest count sorted and are
+ * kept between sorts.
+ */
+public class RadixSorter implements AutoCloseable {
+    // Must match the RAY_SORT_* defines in ray_sort.h
+    static final int BLOCK = 256;
+    private static final int SCAN_SIZE = 256;
+    private static final int RADIX_BITS = 4;
+    private static final int RADIX = 1 << RADIX_BITS;
+
+    private final ClContext context;
+
+    private final cl_kernel histogram;
+    private final cl_kernel scan;
+    private final cl_kernel scatter;
+
+    private int capacity = 0;
+    private ClMemory keyBuffer = null;
+    private ClMemory valueBuffer = null;
+    private ClMemory histogramBuffer = null;
+
+    public RadixSorter(cl_program program, ClContext context, int capacity) {
+        this.context = context;
+
+        this.histogram = clCreateKernel(program, "ray_sort_histogram", null);
+        this.scan = clCreateKernel(program, "ray_sort_scan", null);
+        this.scatter = clCreateKernel(program, "ray_sort_scatter", null);
+
+        ensureCapacity(capacity);
+    }
+
+    /**
+     * Grow the scratch buffers to sort at least {@code capacity} elements.
+     */
+    public void ensureCapacity(int capacity) {
+        if (capacity <= this.capacity) return;
+        releaseBuffers();
+        this.capacity = capacity;
+        int blocks = (capacity + BLOCK - 1) / BLOCK;
+        this.keyBuffer = createBuffer(capacity);
+        this.valueBuffer = createBuffer(capacity);
+        this.histogramBuffer = createBuffer((long) blocks * RADIX);
+    }
+
+    private ClMemory createBuffer(long ints) {
+        return new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE,
+                Sizeof.cl_int * ints, null, null));
+    }
+
+    /**
+     * Sort the first {@code count} non-negative keys of a buffer and the values with them, in
+     * place. Both buffers must hold at least {@code count} ints.
+     *
+     * @param keyBits Number of low key bits to sort by.
+     */
+    public void sort(ClMemory keys, ClMemory values, int count, int keyBits) {
+        if (count <= 1) return;
+        ensureCapacity(count);
+
+        int blocks = (count + BLOCK - 1) / BLOCK;
+        ClMemory[] keyPair = { keys, keyBuffer };
+        ClMemory[] valuePair = { values, valueBuffer };
+        // An even number of passes leaves the result in the original buffers
+        int passes = (keyBits + RADIX_BITS - 1) / RADIX_BITS;
+        passes += passes & 1;
+
+        int current = 0;
+        for (int pass = 0; pass < passes; pass++) {
+            int shift = pass * RADIX_BITS;
+            int next = 1 - current;
+
+            KernelArgBinder binder = new KernelArgBinder(histogram);
+            binder.setMem(keyPair[current].get());
+            binder.setInt(count);
+            binder.setInt(shift);
+            binder.setMem(histogramBuffer.get());
+            enqueue(histogram, (long) blocks * BLOCK, BLOCK);
+
+            binder = new KernelArgBinder(scan);
+            binder.setInt(count);
+            binder.setMem(histogramBuffer.get());
+            enqueue(scan, SCAN_SIZE, SCAN_SIZE);
+
+            binder = new KernelArgBinder(scatter);
+            binder.setMem(keyPair[current].get());
+            binder.setMem(valuePair[current].get());
+            binder.setInt(count);
+            binder.setInt(shift);
+            binder.setMem(histogramBuffer.get());
+            binder.setMem(keyPair[next].get());
+            binder.setMem(valuePair[next].get());
+            enqueue(scatter, (long) blocks * BLOCK, BLOCK);
+
+            current = next;
+        }
+    }
+
+    // The histogram, scan and scatter kernels work in local memory and need whole work groups
+    private void enqueue(cl_kernel kernel, long globalSize, long localSize) {
+        clEnqueueNDRangeKernel(context.queue, kernel, 1, null, new long[] { globalSize },
+                new long[] { localSize }, 0, null, null);
+    }
+
+    private void releaseBuffers() {
+        if (keyBuffer != null) keyBuffer.close();
+        if (valueBuffer != null) valueBuffer.close();
+        if (histogramBuffer != null) histogramBuffer.close();
+        keyBuffer = valueBuffer = histogramBuffer = null;
+    }
+
+    @Override
+    public void close() {
+        clReleaseKernel(histogram);
+        clReleaseKernel(scan);
+        clReleaseKernel(scatter);
+        releaseBuffers();
+    }
+}
@@ -0,0 +1,57 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import static org.jocl.CL.*;
+
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Sizeof;
+import org.jocl.cl_kernel;
+import org.jocl.cl_program;
+
+/**
+ * Radix sort of a wavefront ray queue by ray coherence (see {@code integrator/ray_sort.h}). The
+ * keys are built from the paths, then the queue is sorted by them with a {@link RadixSorter}.
+ */
+public class RaySorter implements AutoCloseable {
+    // Must match RAY_SORT_KEY_BITS in ray_sort.h
+    private static final int KEY_BITS = 24;
+
+    private final ClContext context;
+
+    private final cl_kernel keys;
+    private final ClMemory keyBuffer;
+    private final RadixSorter sorter;
+
+    public RaySorter(cl_program program, ClContext context, int capacity) {
+        this.context = context;
+        this.keys = clCreateKernel(program, "ray_sort_keys", null);
+        this.keyBuffer = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE,
+                (long) Sizeof.cl_int * capacity, null, null));
+        this.sorter = new RadixSorter(program, context, capacity);
+    }
+
+    /**
+     * Sort the first {@code count} path indices of a ray queue in place.
+     */
+    public void sort(ClMemory paths, ClMemory hits, ClMemory queue, int count) {
+        if (count <= RadixSorter.BLOCK) return;
+
+        KernelArgBinder binder = new KernelArgBinder(keys);
+        binder.setMem(paths.get());
+        binder.setMem(hits.get());
+        binder.setMem(queue.get());
+        binder.setInt(count);
+        binder.setMem(keyBuffer.get());
+        clEnqueueNDRangeKernel(context.queue, keys, 1, null, new long[] { count }, null,
+                0, null, null);
+
+        sorter.sort(keyBuffer, queue, count, KEY_BITS);
+    }
+
+    @Override
+    public void close() {
+        clReleaseKernel(keys);
+        keyBuffer.close();
+        sorter.close();
+    }
+}
@@ -0,0 +1,17 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import org.jocl.cl_event;
+
+/**
+ * A path tracing integrator that renders one sample per pixel into the pass buffer per dispatch.
+ */
+public interface RenderKernel extends AutoCloseable {
+    void setStaticArgs(KernelBindings bindings);
+
+    void setPerDispatchArgs(DispatchParams params);
+
+    cl_event dispatch(long globalSize, long[] localSize, cl_event[] waitEvents);
+
+    @Override
+    void close();
+}
@@ -0,0 +1,21 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+/**
+ * Sample generator used by the render kernels. The ordinal is passed to the kernel in the scene
+ * settings and must match the SAMPLER_* ids in sampler.h.
+ */
+public enum Sampler {
+    PCG("Random (PCG)"),
+    SOBOL("Owen-scrambled Sobol");
+
+    private final String name;
+
+    Sampler(String name) {
+        this.name = name;
+    }
+
+    @Override
+    public String toString() {
+        return name;
+    }
+}
@@ -1,8 +1,13 @@
 package dev.thatredox.chunkynative.opencl.renderer.kernel;
 
+import dev.thatredox.chunkynative.opencl.ui.ChunkyClTab;
+import se.llbit.chunky.renderer.EmitterSamplingStrategy;
 import se.llbit.chunky.renderer.scene.Scene;
 
 public class SceneConstants {
+    /** Kernel strategy id for alias table sampling. Follows the ids of {@link EmitterSamplingStrategy}. */
+    public static final int EMITTER_SAMPLING_ALIAS = 4;
+
     private final int emittersEnabled;
     private final float emitterIntensity;
     private final int emitterSamplingStrategy;
@@ -19,11 +24,19 @@ public class SceneConstants {
         return new SceneConstants(
                 scene.getEmittersEnabled() ? 1 : 0,
                 (float) scene.getEmitterIntensity(),
-                scene.getEmitterSamplingStrategy().ordinal(),
+                emitterSamplingStrategy(scene),
                 scene.isPreventNormalEmitterWithSampling() ? 1 : 0
         );
     }
 
+    private static int emitterSamplingStrategy(Scene scene) {
+        EmitterSamplingStrategy strategy = scene.getEmitterSamplingStrategy();
+        if (ChunkyClTab.emitterAliasSampling && strategy != EmitterSamplingStrategy.NONE) {
+            return EMITTER_SAMPLING_ALIAS;
+        }
+        return strategy.ordinal();
+    }
+
     public int getEmittersEnabled() {
         return emittersEnabled;
     }
@@ -0,0 +1,295 @@
+package dev.thatredox.chunkynative.opencl.renderer.kernel;
+
+import static org.jocl.CL.*;
+
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.Pointer;
+import org.jocl.Sizeof;
+import org.jocl.cl_event;
+import org.jocl.cl_kernel;
+import org.jocl.cl_program;
+
+/**
+ * Wavefront path tracer. Each bounce is split into extend, shade and connect kernels which
+ * communicate through compacted path queues (see {@code integrator/wavefront.h}).
+ */
+public class WavefrontKernel implements RenderKernel {
+    // Must match the WAVEFRONT_*_SIZE defines in wavefront.h
+    private static final int PATH_SIZE = 23;
+    private static final int HIT_SIZE = 16;
+    private static final int LIGHT_SIZE = 24;
+
+    private final ClContext context;
+    private final int pathCount;
+
+    private final cl_kernel generate;
+    private final cl_kernel extend;
+    private final cl_kernel shade;
+    private final cl_kernel connect;
+    private final cl_kernel accumulate;
+
+    private final KernelArgBinder generateBinder;
+    private final KernelArgBinder extendBinder;
+    private final KernelArgBinder shadeBinder;
+    private final KernelArgBinder connectBinder;
+    private final KernelArgBinder accumulateBinder;
+
+    private final ClMemory paths;
+    private final ClMemory hits;
+    private final ClMemory lights;
+    private final ClMemory[] rayQueues;
+    private final ClMemory[] rayQueueSizes;
+    private final ClMemory hitQueue;
+    private final ClMemory hitQueueSize;
+    private final ClMemory shadowQueue;
+    private final ClMemory shadowQueueSize;
+    private final RaySorter sorter;
+
+    // Index of the first per-bounce argument of the extend and shade kernels
+    private int extendQueueArg;
+    private int shadeQueueArg;
+    // Index of the per-dispatch arguments of the generate, extend and accumulate kernels, and of the
+    // sample index within the dispatch that follows them
+    private int generateDispatchArg;
+    private int extendDispatchArg;
+    private int accumulateDispatchArg;
+    private int generateSampleArg;
+    private int extendSampleArg;
+    private int accumulateSampleArg;
+    private int samples = 1;
+
+    private final int[] queueSize = new int[1];
+
+    public WavefrontKernel(cl_program program, ClContext context, int pathCount, boolean sortRays) {
+        this.context = context;
+        this.pathCount = pathCount;
+
+        this.generate = clCreateKernel(program, "wavefront_generate", null);
+        this.extend = clCreateKernel(program, "wavefront_extend", null);
+        this.shade = clCreateKernel(program, "wavefront_shade", null);
+        this.connect = clCreateKernel(program, "wavefront_connect", null);
+        this.accumulate = clCreateKernel(program, "wavefront_accumulate", null);
+
+        this.generateBinder = new KernelArgBinder(generate);
+        this.extendBinder = new KernelArgBinder(extend);
+        this.shadeBinder = new KernelArgBinder(shade);
+        this.connectBinder = new KernelArgBinder(connect);
+        this.accumulateBinder = new KernelArgBinder(accumulate);
+
+        this.paths = createBuffer((long) pathCount * PATH_SIZE);
+        this.hits = createBuffer((long) pathCount * HIT_SIZE);
+        this.lights = createBuffer((long) pathCount * LIGHT_SIZE);
+        this.rayQueues = new ClMemory[] { createBuffer(pathCount), createBuffer(pathCount) };
+        this.rayQueueSizes = new ClMemory[] { createBuffer(1), createBuffer(1) };
+        this.hitQueue = createBuffer(pathCount);
+        this.hitQueueSize = createBuffer(1);
+        this.shadowQueue = createBuffer(pathCount);
+        this.shadowQueueSize = createBuffer(1);
+        this.sorter = sortRays ? new RaySorter(program, context, pathCount) : null;
+    }
+
+    private ClMemory createBuffer(long ints) {
+        return new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_WRITE,
+                Sizeof.cl_int * ints, null, null));
+    }
+
+    @Override
+    public void setStaticArgs(KernelBindings bindings) {
+        SceneConstants constants = bindings.getSceneConstants();
+
+        generateBinder.reset();
+        generateBinder.setMem(bindings.getCamera().projectorType.get());
+        generateBinder.setMem(bindings.getCamera().cameraSettings.get());
+        bindings.bindScene(generateBinder);
+        generateBinder.setMem(bindings.getGpu().getCanvasConfig().get());
+        generateBinder.setMem(bindings.getGpu().getSceneSettings().get());
+        generateDispatchArg = generateBinder.getIndex();
+        generateBinder.setInt(0);
+        generateBinder.setInt(0);
+        generateSampleArg = generateBinder.getIndex();
+        generateBinder.setInt(0);
+        generateBinder.setInt(pathCount);
+        generateBinder.setMem(paths.get());
+        generateBinder.setMem(rayQueues[0].get());
+
+        extendBinder.reset();
+        bindings.bindScene(extendBinder);
+        extendBinder.setMem(bindings.getGpu().getSceneSettings().get());
+        extendDispatchArg = extendBinder.getIndex();
+        extendBinder.setInt(0);
+        extendSampleArg = extendBinder.getIndex();
+        extendBinder.setInt(0);
+        extendBinder.setInt(bindings.getGpu().writesGuides() ? 1 : 0);
+        extendBinder.setMem(bindings.getGpu().getGuides().get());
+        extendBinder.setMem(paths.get());
+        extendBinder.setMem(hits.get());
+        extendQueueArg = extendBinder.getIndex();
+        extendBinder.setMem(rayQueues[0].get());
+        extendBinder.setMem(rayQueueSizes[0].get());
+        extendBinder.setMem(hitQueue.get());
+        extendBinder.setMem(hitQueueSize.get());
+
+        shadeBinder.reset();
+        bindings.bindScene(shadeBinder);
+        shadeBinder.setMem(bindings.getGpu().getRayDepth().get());
+        shadeBinder.setMem(bindings.getGpu().getSceneSettings().get());
+        shadeBinder.setInt(constants.getEmittersEnabled());
+        shadeBinder.setFloat(constants.getEmitterIntensity());
+        shadeBinder.setInt(constants.getEmitterSamplingStrategy());
+        shadeBinder.setInt(constants.getPreventNormalEmitterWithSampling());
+        shadeBinder.setMem(paths.get());
+        shadeBinder.setMem(hits.get());
+        shadeBinder.setMem(lights.get());
+        shadeBinder.setMem(hitQueue.get());
+        shadeBinder.setMem(hitQueueSize.get());
+        shadeBinder.setMem(shadowQueue.get());
+        shadeBinder.setMem(shadowQueueSize.get());
+        shadeQueueArg = shadeBinder.getIndex();
+        shadeBinder.setMem(rayQueues[1].get());
+        shadeBinder.setMem(rayQueueSizes[1].get());
+
+        connectBinder.reset();
+        bindings.bindScene(connectBinder);
+        connectBinder.setMem(bindings.getGpu().getRayDepth().get());
+        connectBinder.setMem(bindings.getGpu().getSceneSettings().get());
+        connectBinder.setInt(constants.getEmittersEnabled());
+        connectBinder.setFloat(constants.getEmitterIntensity());
+        connectBinder.setInt(constants.getEmitterSamplingStrategy());
+        connectBinder.setInt(constants.getPreventNormalEmitterWithSampling());
+        connectBinder.setMem(paths.get());
+        connectBinder.setMem(lights.get());
+        connectBinder.setMem(shadowQueue.get());
+        connectBinder.setMem(shadowQueueSize.get());
+
+        accumulateBinder.reset();
+        accumulateDispatchArg = accumulateBinder.getIndex();
+        accumulateBinder.setInt(0);
+        accumulateSampleArg = accumulateBinder.getIndex();
+        accumulateBinder.setInt(0);
+        accumulateBinder.setInt(pathCount);
+        accumulateBinder.setMem(paths.get());
+        accumulateBinder.setMem(bindings.getGpu().getBuffer().get());
+    }
+
+    @Override
+    public void setPerDispatchArgs(DispatchParams params) {
+        generateBinder.setIndex(generateDispatchArg);
+        generateBinder.setInt(params.getRngSeed());
+        generateBinder.setInt(params.getSampleIndex());
+        extendBinder.setIndex(extendDispatchArg);
+        extendBinder.setInt(params.getBufferSpp());
+        accumulateBinder.setIndex(accumulateDispatchArg);
+        accumulateBinder.setInt(params.getBufferSpp());
+        samples = params.getSamples();
+    }
+
+    @Override
+    public cl_event dispatch(long globalSize, long[] localSize, cl_event[] waitEvents) {
+        int waitCount = waitEvents == null ? 0 : waitEvents.length;
+        cl_event event = null;
+        for (int sample = 0; sample < samples; sample++) {
+            generateBinder.setIndex(generateSampleArg);
+            generateBinder.setInt(sample);
+            enqueue(generate, pathCount, localSize, sample == 0 ? waitCount : 0, sample == 0 ? waitEvents : null, null);
+            setQueueSize(rayQueueSizes[0], pathCount);
+
+            // The first extend writes the denoiser guides of the sample
+            extendBinder.setIndex(extendSampleArg);
+            extendBinder.setInt(sample);
+            traceBounces(localSize);
+
+            if (event != null) clReleaseEvent(event);
+            event = new cl_event();
+            accumulateBinder.setIndex(accumulateSampleArg);
+            accumulateBinder.setInt(sample);
+            enqueue(accumulate, pathCount, localSize, 0, null, event);
+        }
+        return event;
+    }
+
+    private void traceBounces(long[] localSize) {
+        // The queue is in order, so the stages only need to synchronize to read back the queue sizes.
+        int current = 0;
+        int rayCount = pathCount;
+        while (rayCount > 0) {
+            int next = 1 - current;
+            setQueueSize(rayQueueSizes[next], 0);
+            setQueueSize(hitQueueSize, 0);
+            setQueueSize(shadowQueueSize, 0);
+
+            extendBinder.setIndex(extendQueueArg);
+            extendBinder.setMem(rayQueues[current].get());
+            extendBinder.setMem(rayQueueSizes[current].get());
+            shadeBinder.setIndex(shadeQueueArg);
+            shadeBinder.setMem(rayQueues[next].get());
+            shadeBinder.setMem(rayQueueSizes[next].get());
+
+            enqueue(extend, rayCount, localSize);
+            int hitCount = getQueueSize(hitQueueSize);
+            if (hitCount == 0) break;
+
+            enqueue(shade, hitCount, localSize);
+            int shadowCount = getQueueSize(shadowQueueSize);
+            if (shadowCount > 0) {
+                enqueue(connect, shadowCount, localSize);
+            }
+
+            rayCount = getQueueSize(rayQueueSizes[next]);
+            if (sorter != null) {
+                // Reorder the secondary rays so the next extend traces coherent rays together
+                sorter.sort(paths, hits, rayQueues[next], rayCount);
+            }
+            current = next;
+        }
+    }
+
+    private void enqueue(cl_kernel kernel, int size, long[] localSize) {
+        enqueue(kernel, size, localSize, 0, null, null);
+    }
+
+    /**
+     * Enqueue one work item per element, rounded up to whole work groups. The kernels skip the
+     * work items past the end.
+     */
+    private void enqueue(cl_kernel kernel, int size, long[] localSize, int waitCount, cl_event[] waitEvents, cl_event event) {
+        long globalSize = size;
+        if (localSize != null) {
+            globalSize = (globalSize + localSize[0] - 1) / localSize[0] * localSize[0];
+        }
+        clEnqueueNDRangeKernel(context.queue, kernel, 1, null, new long[] { globalSize }, localSize,
+                waitCount, waitEvents, event);
+    }
+
+    private void setQueueSize(ClMemory size, int value) {
+        queueSize[0] = value;
+        clEnqueueFillBuffer(context.queue, size.get(), Pointer.to(queueSize), Sizeof.cl_int, 0,
+                Sizeof.cl_int, 0, null, null);
+    }
+
+    private int getQueueSize(ClMemory size) {
+        clEnqueueReadBuffer(context.queue, size.get(), CL_TRUE, 0, Sizeof.cl_int,
+                Pointer.to(queueSize), 0, null, null);
+        return queueSize[0];
+    }
+
+    @Override
+    public void close() {
+        clReleaseKernel(generate);
+        clReleaseKernel(extend);
+        clReleaseKernel(shade);
+        clReleaseKernel(connect);
+        clReleaseKernel(accumulate);
+
+        paths.close();
+        hits.close();
+        lights.close();
+        for (ClMemory queue : rayQueues) queue.close();
+        for (ClMemory size : rayQueueSizes) size.close();
+        hitQueue.close();
+        hitQueueSize.close();
+        shadowQueue.close();
+        shadowQueueSize.close();
+        if (sorter != null) sorter.close();
+    }
+}
@@ -28,6 +28,7 @@ public class ClCamera implements AutoCloseable {
     public ClMemory projectorType;
     public ClMemory cameraSettings;
     public final boolean needGenerate;
+    private final int projectorTypeValue;
 
     private final Scene scene;
     private final ClContext context;
@@ -66,6 +67,7 @@ public class ClCamera implements AutoCloseable {
         }
 
         needGenerate = projType == -1;
+        projectorTypeValue = projType;
 
         projectorType = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                 Sizeof.cl_int, Pointer.to(new int[] {projType}), null));
@@ -174,6 +176,24 @@ public class ClCamera implements AutoCloseable {
         return Math.min(currentMax, Math.max(t1, t2));
     }
 
+    /**
+     * @return Projector type passed to the kernel, or -1 if the camera rays are pre-generated.
+     */
+    public int getProjectorType() {
+        return projectorTypeValue;
+    }
+
+    /**
+     * @return Approximate angle subtended by a pixel, in radians: the footprint width of a primary
+     * ray at a distance of 1. 0 for parallel projection, where the footprint does not grow.
+     */
+    public float getPixelAngle() {
+        if (projectionMode == ProjectionMode.PARALLEL) {
+            return 0;
+        }
+        return (float) (Camera.clampedFovTan(scene.camera().getFov()) / scene.canvasConfig.getCropHeight());
+    }
+
     @Override
     public void close() {
         this.projectorType.close();
@@ -0,0 +1,216 @@
+package dev.thatredox.chunkynative.opencl.tonemap;
+
+import dev.thatredox.chunkynative.opencl.context.ContextManager;
+import dev.thatredox.chunkynative.opencl.ui.ChunkyClTab;
+import dev.thatredox.chunkynative.opencl.util.ClMemory;
+import org.jocl.*;
+
+import java.util.Map;
+import java.util.WeakHashMap;
+
+import static org.jocl.CL.*;
+
+/**
+ * Edge-avoiding a-trous denoiser run on the sample buffer before tone mapping (see {@code denoise.h}).
+ * The renderer merges the first hit guides of every pass into a guide buffer kept on the device here,
+ * the same way it merges the color into the sample buffer. Guides belong to the sample buffer they
+ * were rendered for, so other scenes and canvas sizes are never denoised with them.
+ */
+public class Denoiser {
+    /** Floats per pixel in the guide buffer. Must match DENOISE_GUIDE_SIZE in denoise.h. */
+    public static final int GUIDE_SIZE = 7;
+    // Must roughly match the squared color difference of neighbouring pixels at low spp, relative to
+    // their brightness
+    private static final float COLOR_PHI = 1.0f;
+
+    private static final class Guides implements AutoCloseable {
+        final ContextManager ctx;
+        final int width;
+        final int height;
+        final ClMemory data;
+        int spp = 0;
+
+        // Filter buffers, created on the first denoised frame
+        ClMemory colorA = null;
+        ClMemory colorB = null;
+
+        Guides(ContextManager ctx, int width, int height) {
+            this.ctx = ctx;
+            this.width = width;
+            this.height = height;
+            int size = width * height * GUIDE_SIZE;
+            this.data = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                    (long) Sizeof.cl_float * size, Pointer.to(new float[size]), null));
+        }
+
+        void ensureColorBuffers() {
+            if (colorA != null) return;
+            colorA = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_WRITE,
+                    (long) Sizeof.cl_float * width * height * 3, null, null));
+            colorB = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_WRITE,
+                    (long) Sizeof.cl_float * width * height * 3, null, null));
+        }
+
+        @Override
+        public void close() {
+            data.close();
+            if (colorA != null) colorA.close();
+            if (colorB != null) colorB.close();
+        }
+    }
+
+    // Guides by the identity of the sample buffer they belong to
+    private static final Map<double[], Guides> guides = new WeakHashMap<>();
+
+    // Kernels of the tonemap program of kernelContext, created once and reused for every frame
+    private static ContextManager kernelContext = null;
+    private static cl_kernel load;
+    private static cl_kernel atrous;
+    private static cl_kernel store;
+    private static cl_kernel merge;
+
+    private Denoiser() {
+    }
+
+    private static void ensureKernels(ContextManager ctx) {
+        if (kernelContext == ctx) return;
+        if (kernelContext != null) {
+            clReleaseKernel(load);
+            clReleaseKernel(atrous);
+            clReleaseKernel(store);
+            clReleaseKernel(merge);
+        }
+        kernelContext = ctx;
+        load = clCreateKernel(ctx.tonemap.simpleFilter, "denoise_load", null);
+        atrous = clCreateKernel(ctx.tonemap.simpleFilter, "denoise_atrous", null);
+        store = clCreateKernel(ctx.tonemap.simpleFilter, "denoise_store", null);
+        merge = clCreateKernel(ctx.tonemap.simpleFilter, "denoise_merge_guides", null);
+    }
+
+    /**
+     * Make sure a sample buffer has a guide buffer that fits the canvas. Existing guides are kept if
+     * the size and context did not change.
+     */
+    public static synchronized void ensureGuides(ContextManager ctx, double[] sampleBuffer, int width, int height) {
+        Guides current = guides.get(sampleBuffer);
+        if (current == null || current.ctx != ctx || current.width != width || current.height != height) {
+            if (current != null) current.close();
+            guides.put(sampleBuffer, new Guides(ctx, width, height));
+        }
+    }
+
+    public static synchronized void clearGuides(double[] sampleBuffer) {
+        Guides current = guides.remove(sampleBuffer);
+        if (current != null) current.close();
+    }
+
+    /**
+     * Merge the guides of a render pass into the guide buffer of a sample buffer, on the device.
+     */
+    public static void mergeGuides(double[] sampleBuffer, ClMemory passGuides, int passSpp) {
+        mergeGuides(sampleBuffer, passGuides, Integer.MAX_VALUE, null, new int[] {passSpp});
+    }
+
+    /**
+     * Merge the guides of an adaptive render pass, weighting every pixel by the samples of its tile
+     * like the color.
+     *
+     * @param tileSize    Width and height of the tiles.
+     * @param tileSamples Samples per tile already merged into the sample buffer, or null to use the
+     *                    samples merged into the guides so far for every tile.
+     * @param passTileSpp Samples per tile in the pass.
+     */
+    public static synchronized void mergeGuides(double[] sampleBuffer, ClMemory passGuides, int tileSize,
+                                                int[] tileSamples, int[] passTileSpp) {
+        Guides current = guides.get(sampleBuffer);
+        if (current == null) return;
+        ContextManager ctx = current.ctx;
+        ensureKernels(ctx);
+
+        // Fresh guides have nothing to keep, even if the sample buffer does
+        int[] mergedSpp = new int[passTileSpp.length];
+        if (current.spp > 0) {
+            for (int i = 0; i < mergedSpp.length; i++) {
+                mergedSpp[i] = tileSamples != null ? tileSamples[i] : current.spp;
+            }
+        }
+        int passSpp = 0;
+        for (int spp : passTileSpp) passSpp = Math.max(passSpp, spp);
+        if (passSpp <= 0) return;
+
+        tileSize = Math.min(tileSize, Math.max(current.width, current.height));
+        try (
+                ClMemory mergedMem = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        (long) Sizeof.cl_int * mergedSpp.length, Pointer.to(mergedSpp), null));
+                ClMemory passMem = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        (long) Sizeof.cl_int * passTileSpp.length, Pointer.to(passTileSpp), null));
+        ) {
+            clSetKernelArg(merge, 0, Sizeof.cl_int, Pointer.to(new int[] {current.width}));
+            clSetKernelArg(merge, 1, Sizeof.cl_int, Pointer.to(new int[] {current.height}));
+            clSetKernelArg(merge, 2, Sizeof.cl_int, Pointer.to(new int[] {tileSize}));
+            clSetKernelArg(merge, 3, Sizeof.cl_mem, Pointer.to(mergedMem.get()));
+            clSetKernelArg(merge, 4, Sizeof.cl_mem, Pointer.to(passMem.get()));
+            clSetKernelArg(merge, 5, Sizeof.cl_mem, Pointer.to(passGuides.get()));
+            clSetKernelArg(merge, 6, Sizeof.cl_mem, Pointer.to(current.data.get()));
+            // The queue keeps the buffers alive until the merge ran
+            clEnqueueNDRangeKernel(ctx.context.queue, merge, 1, null,
+                    new long[] {(long) current.width * current.height}, null, 0, null, null);
+        }
+        current.spp += passSpp;
+    }
+
+    /**
+     * Denoise a sample buffer in place. Does nothing if the denoiser is off or the buffer has no
+     * guides for this frame size. The filter is only enqueued, commands enqueued after it on the
+     * same queue see the denoised input.
+     *
+     * @param samples Sample buffer of the frame, used to find its guides.
+     * @param input   Buffer of {@code width * height * 3} doubles.
+     */
+    public static synchronized void denoise(ContextManager ctx, double[] samples, ClMemory input, int width, int height) {
+        int iterations = ChunkyClTab.denoiserIterations;
+        Guides current = guides.get(samples);
+        if (iterations <= 0 || current == null || current.spp == 0 || current.ctx != ctx ||
+                current.width != width || current.height != height) {
+            return;
+        }
+        ensureKernels(ctx);
+        current.ensureColorBuffers();
+
+        long[] globalSize = new long[] {(long) width * height};
+        Pointer widthArg = Pointer.to(new int[] {width});
+        Pointer heightArg = Pointer.to(new int[] {height});
+        ClMemory guideMem = current.data;
+
+        clSetKernelArg(load, 0, Sizeof.cl_int, widthArg);
+        clSetKernelArg(load, 1, Sizeof.cl_int, heightArg);
+        clSetKernelArg(load, 2, Sizeof.cl_mem, Pointer.to(input.get()));
+        clSetKernelArg(load, 3, Sizeof.cl_mem, Pointer.to(guideMem.get()));
+        clSetKernelArg(load, 4, Sizeof.cl_mem, Pointer.to(current.colorA.get()));
+        clEnqueueNDRangeKernel(ctx.context.queue, load, 1, null, globalSize, null, 0, null, null);
+
+        ClMemory src = current.colorA;
+        ClMemory dst = current.colorB;
+        for (int i = 0; i < iterations; i++) {
+            clSetKernelArg(atrous, 0, Sizeof.cl_int, widthArg);
+            clSetKernelArg(atrous, 1, Sizeof.cl_int, heightArg);
+            clSetKernelArg(atrous, 2, Sizeof.cl_int, Pointer.to(new int[] {1 << i}));
+            clSetKernelArg(atrous, 3, Sizeof.cl_float, Pointer.to(new float[] {COLOR_PHI / (1 << i)}));
+            clSetKernelArg(atrous, 4, Sizeof.cl_mem, Pointer.to(src.get()));
+            clSetKernelArg(atrous, 5, Sizeof.cl_mem, Pointer.to(guideMem.get()));
+            clSetKernelArg(atrous, 6, Sizeof.cl_mem, Pointer.to(dst.get()));
+            clEnqueueNDRangeKernel(ctx.context.queue, atrous, 1, null, globalSize, null, 0, null, null);
+
+            ClMemory tmp = src;
+            src = dst;
+            dst = tmp;
+        }
+
+        clSetKernelArg(store, 0, Sizeof.cl_int, widthArg);
+        clSetKernelArg(store, 1, Sizeof.cl_int, heightArg);
+        clSetKernelArg(store, 2, Sizeof.cl_mem, Pointer.to(src.get()));
+        clSetKernelArg(store, 3, Sizeof.cl_mem, Pointer.to(guideMem.get()));
+        clSetKernelArg(store, 4, Sizeof.cl_mem, Pointer.to(input.get()));
+        clEnqueueNDRangeKernel(ctx.context.queue, store, 1, null, globalSize, null, 0, null, null);
+    }
+}
@@ -33,11 +33,13 @@ public abstract class SimpleGpuPostProcessingFilter implements PostProcessingFil
         ContextManager ctx = ContextManager.get();
         cl_kernel kernel = clCreateKernel(ctx.tonemap.simpleFilter, entryPoint, null);
         try (
-                ClMemory inputMem = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                ClMemory inputMem = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
                         (long) Sizeof.cl_ulong * input.length, Pointer.to(input), null));
                 ClMemory outputMem = new ClMemory(clCreateBuffer(ctx.context.context, CL_MEM_WRITE_ONLY,
                         (long) Sizeof.cl_int * output.data.length, null, null));
         ) {
+            Denoiser.denoise(ctx, input, inputMem, width, height);
+
             clSetKernelArg(kernel, 0, Sizeof.cl_int, Pointer.to(new int[] {width}));
             clSetKernelArg(kernel, 1, Sizeof.cl_int, Pointer.to(new int[] {height}));
             clSetKernelArg(kernel, 2, Sizeof.cl_float, Pointer.to(new float[] {(float) exposure}));
@@ -2,11 +2,15 @@ package dev.thatredox.chunkynative.opencl.ui;
 
 import dev.thatredox.chunkynative.opencl.context.ContextManager;
 import dev.thatredox.chunkynative.opencl.context.KernelLoader;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.Integrator;
+import dev.thatredox.chunkynative.opencl.renderer.kernel.Sampler;
 import javafx.animation.KeyFrame;
 import javafx.animation.Timeline;
 import javafx.geometry.Insets;
 import javafx.scene.Node;
 import javafx.scene.control.Button;
+import javafx.scene.control.CheckBox;
+import javafx.scene.control.ChoiceBox;
 import javafx.scene.control.Label;
 import javafx.scene.layout.VBox;
 import javafx.util.Duration;
@@ -20,11 +24,29 @@ public class ChunkyClTab implements RenderControlsTab {
     protected final VBox box;
     private Scene scene;
     private final Label renderTimeLabel;
+    private final Label kernelTimeLabel;
     private final Timeline renderTimeTicker;
 
     // 靜態變數供渲染器存取
     public static float russianRouletteThreshold = 50.0f;
     public static int virtualDepth = 16;
+    public static boolean octreeDda = false;
+    public static Integrator integrator = Integrator.MEGAKERNEL;
+    public static Sampler sampler = Sampler.PCG;
+    public static int samplesPerDispatch = 1;
+    public static float adaptiveThreshold = 0.0f;
+    public static boolean sortRays = false;
+    public static boolean emitterAliasSampling = false;
+    public static int denoiserIterations = 0;
+    public static boolean octreeDag = false;
+    public static boolean brickTree = false;
+    public static boolean mergeWater = false;
+    public static boolean reorderOctree = false;
+    public static int octreePagePool = 0;
+    public static float lodThreshold = 0;
+    public static boolean bvh8 = false;
+    public static int bvhLeafSize = 0;
+    public static boolean entityInstancing = false;
 
     public ChunkyClTab(Scene scene) {
         this.scene = scene;
@@ -33,8 +55,10 @@ public class ChunkyClTab implements RenderControlsTab {
         box.setPadding(new Insets(10.0));
 
         renderTimeLabel = new Label();
+        kernelTimeLabel = new Label();
         updateRenderTimeLabel();
         box.getChildren().add(renderTimeLabel);
+        box.getChildren().add(kernelTimeLabel);
 
         // Russian Roulette UI
         Label rrLabel = new Label("Russian Roulette Threshold: 50%");
@@ -62,6 +86,177 @@ public class ChunkyClTab implements RenderControlsTab {
         });
         box.getChildren().addAll(vdLabel, vdSlider);
 
+        // The integer cell walk does not use ray offsets, so it has no use for the virtual depth
+        CheckBox octreeDdaBox = new CheckBox("Integer octree traversal (ignores virtual depth)");
+        octreeDdaBox.setSelected(octreeDda);
+        vdSlider.setDisable(octreeDda);
+        octreeDdaBox.selectedProperty().addListener((obs, oldVal, newVal) -> {
+            octreeDda = newVal;
+            vdSlider.setDisable(newVal);
+            scene.softRefresh();
+        });
+        box.getChildren().add(octreeDdaBox);
+
+        // Samples per Dispatch UI
+        Label spdLabel = new Label("Samples per Dispatch: 1");
+        Slider spdSlider = new Slider(1, 16, 1);
+        spdSlider.setMajorTickUnit(5);
+        spdSlider.setMinorTickCount(4);
+        spdSlider.setSnapToTicks(true);
+        spdSlider.setShowTickLabels(true);
+        spdSlider.valueProperty().addListener((obs, oldVal, newVal) -> {
+            samplesPerDispatch = newVal.intValue();
+            spdLabel.setText(String.format("Samples per Dispatch: %d", samplesPerDispatch));
+            scene.softRefresh();
+        });
+        box.getChildren().addAll(spdLabel, spdSlider);
+
+        // Adaptive Sampling UI
+        // Adaptive sampling is a mode of the megakernel, the slider is disabled for the other integrators
+        Label asLabel = new Label("Adaptive Sampling Threshold: Off");
+        Slider asSlider = new Slider(0, 10, 0);
+        asSlider.setShowTickLabels(true);
+        asSlider.setDisable(integrator != Integrator.MEGAKERNEL);
+        asSlider.valueProperty().addListener((obs, oldVal, newVal) -> {
+            adaptiveThreshold = newVal.floatValue();
+            asLabel.setText(adaptiveThreshold > 0
+                    ? String.format("Adaptive Sampling Threshold: %.1f%% Error (Megakernel)", adaptiveThreshold)
+                    : "Adaptive Sampling Threshold: Off");
+            scene.softRefresh();
+        });
+        box.getChildren().addAll(asLabel, asSlider);
+
+        // Denoiser UI
+        Label dnLabel = new Label("Denoiser Iterations: Off");
+        Slider dnSlider = new Slider(0, 5, 0);
+        dnSlider.setMajorTickUnit(1);
+        dnSlider.setMinorTickCount(0);
+        dnSlider.setSnapToTicks(true);
+        dnSlider.setShowTickLabels(true);
+        dnSlider.valueProperty().addListener((obs, oldVal, newVal) -> {
+            denoiserIterations = newVal.intValue();
+            dnLabel.setText(denoiserIterations > 0
+                    ? String.format("Denoiser Iterations: %d", denoiserIterations)
+                    : "Denoiser Iterations: Off");
+            scene.softRefresh();
+        });
+        box.getChildren().addAll(dnLabel, dnSlider);
+
+        // Integrator UI
+        Label integratorLabel = new Label("Integrator:");
+        ChoiceBox<Integrator> integratorBox = new ChoiceBox<>();
+        integratorBox.getItems().addAll(Integrator.values());
+        integratorBox.setValue(integrator);
+        integratorBox.valueProperty().addListener((obs, oldVal, newVal) -> {
+            integrator = newVal;
+            asSlider.setDisable(newVal != Integrator.MEGAKERNEL);
+            scene.softRefresh();
+        });
+        box.getChildren().add(new HBox(10.0, integratorLabel, integratorBox));
+
+        Label samplerLabel = new Label("Sampler:");
+        ChoiceBox<Sampler> samplerBox = new ChoiceBox<>();
+        samplerBox.getItems().addAll(Sampler.values());
+        samplerBox.setValue(sampler);
+        samplerBox.valueProperty().addListener((obs, oldVal, newVal) -> {
+            sampler = newVal;
+            scene.softRefresh();
+        });
+        box.getChildren().add(new HBox(10.0, samplerLabel, samplerBox));
+
+        CheckBox sortRaysBox = new CheckBox("Sort secondary rays (Wavefront)");
+        sortRaysBox.setSelected(sortRays);
+        sortRaysBox.selectedProperty().addListener((obs, oldVal, newVal) -> {
+            sortRays = newVal;
+            scene.softRefresh();
+        });
+        box.getChildren().add(sortRaysBox);
+
+        CheckBox emitterAliasBox = new CheckBox("Importance sample emitters (alias tables)");
+        emitterAliasBox.setSelected(emitterAliasSampling);
+        emitterAliasBox.selectedProperty().addListener((obs, oldVal, newVal) -> {
+            emitterAliasSampling = newVal;
+            scene.softRefresh();
+        });
+        box.getChildren().add(emitterAliasBox);
+
+        CheckBox octreeDagBox = new CheckBox("Deduplicate octree subtrees (on next scene load)");
+        octreeDagBox.setSelected(octreeDag);
+        octreeDagBox.selectedProperty().addListener((obs, oldVal, newVal) -> octreeDag = newVal);
+        box.getChildren().add(octreeDagBox);
+
+        CheckBox brickTreeBox = new CheckBox("Use 4x4x4 brick tree for the world (on next scene load)");
+        brickTreeBox.setSelected(brickTree);
+        brickTreeBox.selectedProperty().addListener((obs, oldVal, newVal) -> brickTree = newVal);
+        box.getChildren().add(brickTreeBox);
+
+        CheckBox mergeWaterBox = new CheckBox("Merge water into the world octree (on next scene load)");
+        mergeWaterBox.setSelected(mergeWater);
+        mergeWaterBox.selectedProperty().addListener((obs, oldVal, newVal) -> mergeWater = newVal);
+        box.getChildren().add(mergeWaterBox);
+
+        CheckBox reorderOctreeBox = new CheckBox("Reorder octree nodes for traversal (on next scene load)");
+        reorderOctreeBox.setSelected(reorderOctree);
+        reorderOctreeBox.selectedProperty().addListener((obs, oldVal, newVal) -> reorderOctree = newVal);
+        box.getChildren().add(reorderOctreeBox);
+
+        CheckBox bvh8Box = new CheckBox("8-wide entity BVH nodes (on next scene load)");
+        bvh8Box.setSelected(bvh8);
+        bvh8Box.selectedProperty().addListener((obs, oldVal, newVal) -> bvh8 = newVal);
+        box.getChildren().add(bvh8Box);
+
+        CheckBox instancingBox = new CheckBox("Share repeated entity models (on next scene load)");
+        instancingBox.setSelected(entityInstancing);
+        instancingBox.selectedProperty().addListener((obs, oldVal, newVal) -> entityInstancing = newVal);
+        box.getChildren().add(instancingBox);
+
+        // Entity BVH UI, 0 keeps the tree Chunky built, else the plugin builds it with this leaf size
+        Label leafLabel = new Label("Entity BVH: Chunky's tree");
+        Slider leafSlider = new Slider(0, 16, 0);
+        leafSlider.setMajorTickUnit(4);
+        leafSlider.setMinorTickCount(3);
+        leafSlider.setSnapToTicks(true);
+        leafSlider.setShowTickLabels(true);
+        leafSlider.valueProperty().addListener((obs, oldVal, newVal) -> {
+            bvhLeafSize = newVal.intValue();
+            leafLabel.setText(bvhLeafSize > 0
+                    ? String.format("Entity BVH: SAH, %d triangles per leaf (on next scene load)", bvhLeafSize)
+                    : "Entity BVH: Chunky's tree");
+        });
+        box.getChildren().addAll(leafLabel, leafSlider);
+
+        // Octree paging UI, the pool size is in megabytes
+        Label ppLabel = new Label("Octree Page Pool: Off");
+        Slider ppSlider = new Slider(0, 8192, 0);
+        ppSlider.setMajorTickUnit(2048);
+        ppSlider.setMinorTickCount(3);
+        ppSlider.setSnapToTicks(true);
+        ppSlider.setShowTickLabels(true);
+        ppSlider.valueProperty().addListener((obs, oldVal, newVal) -> {
+            octreePagePool = newVal.intValue();
+            ppLabel.setText(octreePagePool > 0
+                    ? String.format("Octree Page Pool: %d MB (on next scene load)", octreePagePool)
+                    : "Octree Page Pool: Off");
+        });
+        box.getChildren().addAll(ppLabel, ppSlider);
+
+        // Far-field LOD UI, the threshold is the largest octree node a ray may stop at in pixels.
+        // The levels are built with the scene, the threshold applies on the next render.
+        Label lodLabel = new Label("Far-field LOD: Off");
+        Slider lodSlider = new Slider(0, 8, 0);
+        lodSlider.setMajorTickUnit(1);
+        lodSlider.setMinorTickCount(1);
+        lodSlider.setSnapToTicks(true);
+        lodSlider.setShowTickLabels(true);
+        lodSlider.valueProperty().addListener((obs, oldVal, newVal) -> {
+            lodThreshold = newVal.floatValue();
+            lodLabel.setText(lodThreshold > 0
+                    ? String.format("Far-field LOD: %.1f px (built on next scene load)", lodThreshold)
+                    : "Far-field LOD: Off");
+            scene.softRefresh();
+        });
+        box.getChildren().addAll(lodLabel, lodSlider);
+
         Button deviceSelectorButton = new Button("Select OpenCL Device");
         deviceSelectorButton.setOnMouseClicked(event -> {
             DeviceSelector selector = new DeviceSelector();
@@ -106,5 +301,6 @@ public class ChunkyClTab implements RenderControlsTab {
         double seconds = millis / 1000.0;
         String suffix = OpenClRenderTimer.isRunning() ? " (running)" : "";
         renderTimeLabel.setText(String.format("Render Time: %.1f s%s", seconds, suffix));
+        kernelTimeLabel.setText("Kernel Time: " + OpenClRenderTimer.getKernelTimeSummary());
     }
 }
@@ -1,16 +1,50 @@
 package dev.thatredox.chunkynative.opencl.ui;
 
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.stream.Collectors;
+
 public final class OpenClRenderTimer {
     private static volatile boolean running = false;
     private static volatile long startNanos = 0L;
     private static volatile long lastElapsedNanos = 0L;
 
+    // Kernel time of the current render
+    private static long kernelNanos = 0L;
+    private static int kernelSamples = 0;
+    // Kernel time per sample of the last render with each octree layout and ray sorting setting, to
+    // compare them
+    private static final Map<String, Double> layoutMillisPerSpp = new LinkedHashMap<>();
+
     private OpenClRenderTimer() {}
 
     public static void start() {
         running = true;
         startNanos = System.nanoTime();
         lastElapsedNanos = 0L;
+        synchronized (OpenClRenderTimer.class) {
+            kernelNanos = 0L;
+            kernelSamples = 0;
+        }
+    }
+
+    /**
+     * Add the time spent waiting for a dispatch.
+     *
+     * @param layout  Octree layout the dispatch traced, and whether its rays were sorted.
+     * @param nanos   Dispatch time.
+     * @param samples Samples per pixel traced by the dispatch.
+     */
+    public static synchronized void addKernelTime(String layout, long nanos, int samples) {
+        kernelNanos += nanos;
+        kernelSamples += samples;
+        layoutMillisPerSpp.put(layout, kernelNanos / 1e6 / kernelSamples);
+    }
+
+    public static synchronized String getKernelTimeSummary() {
+        return layoutMillisPerSpp.entrySet().stream()
+                .map(entry -> String.format("%.2f ms/spp (%s)", entry.getValue(), entry.getKey()))
+                .collect(Collectors.joining(", "));
     }
 
     public static void stop() {
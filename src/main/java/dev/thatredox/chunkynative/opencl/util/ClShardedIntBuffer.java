@@ -0,0 +1,107 @@
+package dev.thatredox.chunkynative.opencl.util;
+
+import dev.thatredox.chunkynative.opencl.context.ClContext;
+import org.jocl.Pointer;
+import org.jocl.Sizeof;
+import org.jocl.cl_mem;
+
+import static org.jocl.CL.*;
+
+/**
+ * Int buffer split across up to {@link #SHARDS} device buffers, for arrays larger than the device
+ * allows in a single allocation. Index {@code i} is in shard {@code i >> shift} at offset
+ * {@code i & ((1 << shift) - 1)}. The shift only depends on the device, see ShardedBuffer in
+ * sharded.h.
+ */
+public class ClShardedIntBuffer implements AutoCloseable {
+    /** Number of shard kernel arguments. Must match SHARD_COUNT in sharded.h. */
+    public static final int SHARDS = 4;
+
+    private final ClMemory[] shards;
+    private final int shift;
+    private final ClContext context;
+
+    private ClShardedIntBuffer(long length, int[] buffer, ClContext context) {
+        this.context = context;
+        this.shift = getShardShift(context);
+
+        long shardSize = 1L << shift;
+        int count = (int) Math.max(1, (length + shardSize - 1) >> shift);
+        if (count > SHARDS) {
+            throw new IllegalArgumentException(String.format(
+                    "Buffer of %d ints does not fit in %d allocations of at most %d MB",
+                    length, SHARDS, (shardSize * Sizeof.cl_int) >> 20));
+        }
+
+        this.shards = new ClMemory[count];
+        for (int i = 0; i < count; i++) {
+            long start = (long) i << shift;
+            long size = Math.max(1, Math.min(shardSize, length - start));
+            if (buffer != null && length > 0) {
+                shards[i] = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        (long) Sizeof.cl_int * size, Pointer.to(buffer).withByteOffset(Sizeof.cl_int * start), null));
+            } else {
+                shards[i] = new ClMemory(clCreateBuffer(context.context, CL_MEM_READ_ONLY,
+                        (long) Sizeof.cl_int * size, null, null));
+            }
+        }
+    }
+
+    public ClShardedIntBuffer(int[] buffer, int length, ClContext context) {
+        this(length, buffer, context);
+    }
+
+    public ClShardedIntBuffer(int[] buffer, ClContext context) {
+        this(buffer.length, buffer, context);
+    }
+
+    /**
+     * Create an uninitialized buffer, to be filled with {@link #set(int[], int)}.
+     */
+    public static ClShardedIntBuffer allocate(long length, ClContext context) {
+        return new ClShardedIntBuffer(length, null, context);
+    }
+
+    /**
+     * Log2 of the shard size in ints: the largest power of two that fits in one allocation on the
+     * device, capped so that every int index fits in {@link #SHARDS} shards.
+     */
+    public static int getShardShift(ClContext context) {
+        long maxInts = context.device.maxAllocSize() / Sizeof.cl_int;
+        int shift = 63 - Long.numberOfLeadingZeros(Math.max(1, maxInts));
+        return Math.min(shift, 30);
+    }
+
+    /**
+     * @return The shard to bind as shard argument {@code shard}. Unused arguments get the first
+     * shard, they are never read.
+     */
+    public cl_mem get(int shard) {
+        return shards[shard < shards.length ? shard : 0].get();
+    }
+
+    public int getShardCount() {
+        return shards.length;
+    }
+
+    public void set(int[] values, int offset) {
+        int written = 0;
+        while (written < values.length) {
+            long index = (long) offset + written;
+            int shard = (int) (index >> shift);
+            long shardOffset = index & ((1L << shift) - 1);
+            int count = (int) Math.min(values.length - written, (1L << shift) - shardOffset);
+            clEnqueueWriteBuffer(context.queue, shards[shard].get(), CL_TRUE, (long) Sizeof.cl_int * shardOffset,
+                    (long) Sizeof.cl_int * count, Pointer.to(values).withByteOffset((long) Sizeof.cl_int * written),
+                    0, null, null);
+            written += count;
+        }
+    }
+
+    @Override
+    public void close() {
+        for (ClMemory shard : shards) {
+            shard.close();
+        }
+    }
+}
@@ -5,6 +5,7 @@ import se.llbit.util.annotation.NotNull;
 import se.llbit.util.annotation.Nullable;
 
 import java.lang.reflect.Field;
+import java.lang.reflect.Modifier;
 import java.util.Objects;
 
 public class Reflection {
@@ -50,6 +51,30 @@ public class Reflection {
 
     }
 
+    /**
+     * Find the value of the first non-static field of a type, searching the class and then its
+     * superclasses.
+     *
+     * @return The value, or null if there is no such field or it cannot be read.
+     */
+    @Nullable
+    @SuppressWarnings("unchecked")
+    public static <T> T findFieldOfType(Object obj, Class<T> cls) {
+        for (Class<?> c = obj.getClass(); c != null; c = c.getSuperclass()) {
+            for (Field field : c.getDeclaredFields()) {
+                if (Modifier.isStatic(field.getModifiers()) || field.getType() != cls) continue;
+                try {
+                    field.setAccessible(true);
+                    Object o = field.get(obj);
+                    if (o != null) return (T) o;
+                } catch (IllegalAccessException | RuntimeException e) {
+                    Log.warn("Failed to read field " + field.getName() + " of " + c.getName(), e);
+                }
+            }
+        }
+        return null;
+    }
+
     /**
      * Copy public fields between objects.
      * @param o1 Object to copy from
@@ -2,23 +2,113 @@
 #define CHUNKYCL_PLUGIN_BVH
 
 #include "../opencl.h"
+#include "features.h"
 #include "material.h"
 #include "primitives.h"
+#include "sharded.h"
+
+// Wide BVH with quantized child bounds (see PackedWideBvh.java). The first int is the width, 4 or 8,
+// and the root node is at index 1. A node is:
+//   0-2: float lower corner of the node
+//   3:   signed per axis exponents in bytes 0-2, child count in byte 3
+//   4:   one int per child, a node index if positive, else a negated leaf index into trigs
+//   then six planes of width / 4 ints (min x, max x, min y, max y, min z, max z) with one byte per
+//   child. A child box is corner + q * 2^exponent per axis.
+//
+// An instanced BVH (see PackedInstancedBvh.java) has BVH_INSTANCED set next to the width. The
+// width is followed by the instance count and the instances, each the root node of a bottom level
+// BVH and a float translation, then the top level root. Leaves of the top level are negated
+// instance indices into the BVH, leaves of the bottom levels are triangles as usual.
+#define BVH_MAX_WIDTH 8
+#define BVH_INSTANCED (1 << 8)
+#define BVH_INSTANCE_SIZE 4
+// Children are pushed nearest last. The host sizes the stack for the deepest path of the scene's
+// BVHs, every child of every node on it: depth * (width - 1) + 1 entries (see features.h).
+#define BVH_STACK_SIZE FEATURE_BVH_STACK_SIZE
 
 typedef struct {
     __global const int* bvh;
-    __global const int* trigs;
+    int width;
+    bool instanced;
+    int root;
+    // Leaves: triangle count followed by the triangles. A leaf never straddles two shards.
+    ShardedBuffer trigs;
     MaterialPalette* materialPalette;
 } Bvh;
 
-Bvh Bvh_new(__global const int* bvh, __global const int* trigs, MaterialPalette* materialPalette) {
+Bvh Bvh_new(__global const int* bvh, ShardedBuffer trigs, MaterialPalette* materialPalette) {
     Bvh b;
     b.bvh = bvh;
+    b.width = bvh[0] & 0xFF;
+    b.instanced = (bvh[0] & BVH_INSTANCED) != 0;
+    b.root = b.instanced ? 2 + BVH_INSTANCE_SIZE * bvh[1] : 1;
     b.trigs = trigs;
     b.materialPalette = materialPalette;
     return b;
 }
 
+// Test the children of a node against a ray and push the ones that are hit within maxDistance,
+// farthest first, with their entry distances.
+void Bvh_pushChildren(Bvh* self, int node, float3 origin, float3 invDir, float maxDistance, int* stack, float* stackDist, int* toVisit) {
+    __global const int* bvh = self->bvh + node;
+    int header = bvh[3];
+    int count = (header >> 24) & 0xFF;
+    float3 corner = (float3) (as_float(bvh[0]), as_float(bvh[1]), as_float(bvh[2]));
+    float3 scale = (float3) (ldexp(1.0f, (header << 24) >> 24),
+                             ldexp(1.0f, (header << 16) >> 24),
+                             ldexp(1.0f, (header << 8) >> 24));
+    int planes = self->width >> 2;
+    __global const int* bounds = bvh + 4 + self->width;
+
+    int refs[BVH_MAX_WIDTH];
+    float dists[BVH_MAX_WIDTH];
+    int hits = 0;
+    for (int i = 0; i < count; i++) {
+        int shift = 8 * (i & 3);
+        int plane = i >> 2;
+        float3 qlo = (float3) ((bounds[plane] >> shift) & 0xFF,
+                               (bounds[2 * planes + plane] >> shift) & 0xFF,
+                               (bounds[4 * planes + plane] >> shift) & 0xFF);
+        float3 qhi = (float3) ((bounds[planes + plane] >> shift) & 0xFF,
+                               (bounds[3 * planes + plane] >> shift) & 0xFF,
+                               (bounds[5 * planes + plane] >> shift) & 0xFF);
+        float3 t1 = (corner + qlo * scale - origin) * invDir;
+        float3 t2 = (corner + qhi * scale - origin) * invDir;
+        float3 tmins = fmin(t1, t2);
+        float3 tmaxs = fmax(t1, t2);
+        float tmin = fmax(fmax(tmins.x, tmins.y), fmax(tmins.z, 0.0f));
+        float tmax = fmin(tmaxs.x, fmin(tmaxs.y, tmaxs.z));
+        if (tmax < tmin || tmin > maxDistance) {
+            continue;
+        }
+
+        // Insertion sort, nearest first
+        int j = hits++;
+        while (j > 0 && dists[j - 1] > tmin) {
+            refs[j] = refs[j - 1];
+            dists[j] = dists[j - 1];
+            j--;
+        }
+        refs[j] = bvh[4 + i];
+        dists[j] = tmin;
+    }
+
+    for (int i = hits - 1; i >= 0; i--) {
+        stack[*toVisit] = refs[i];
+        stackDist[*toVisit] = dists[i];
+        (*toVisit)++;
+    }
+}
+
+// Ray of a bottom level BVH of an instance. Instances are only translated, so distances along the
+// ray are the same on both levels.
+Ray Bvh_instanceRay(Bvh* self, int instance, Ray ray, int* root) {
+    __global const int* data = self->bvh + instance;
+    *root = data[0];
+    ray.origin -= (float3) (as_float(data[1]), as_float(data[2]), as_float(data[3]));
+    return ray;
+}
+
 bool Bvh_intersect(Bvh self, image2d_array_t atlas, MaterialPalette palette, BiomeColors biome, Ray ray, IntersectionRecord* record, MaterialSample* sample);
 
 #endif
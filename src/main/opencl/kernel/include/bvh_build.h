@@ -0,0 +1,286 @@
+#ifndef CHUNKYCL_BVH_BUILD_H
+#define CHUNKYCL_BVH_BUILD_H
+
+#include "../opencl.h"
+#include "bvh.h"
+#include "primitives.h"
+
+// Device builder for the actor BVH (see ClActorBvh.java): a linear BVH over one triangle leaves,
+// as in Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees" (2012).
+// The tree is written in the wide BVH layout of bvh.h with two children per node, so the regular
+// traversal reads it.
+//
+// Buffer layout: the width (4), n - 1 internal nodes (at least one), then the n leaves, each a
+// triangle leaf of one triangle (see primitives.h). The host uploads the leaves, the kernels fill in the
+// nodes:
+//   bvh_build_morton    -> Morton code of every triangle centroid, sorted by the radix sort kernels
+//                          of ray_sort.h (see RadixSorter.java)
+//   bvh_build_hierarchy -> children and parents of the internal nodes from the sorted codes
+//   bvh_build_refit     -> bounds of every node, bottom up
+// After the triangles move, only bvh_build_refit runs again.
+
+#define BVH_BUILD_NODE_SIZE 14
+#define BVH_BUILD_LEAF_SIZE (TRIANGLE_LEAF_HEADER + TRIANGLE_SIZE)
+#define BVH_BUILD_MORTON_BITS 30
+
+int BvhBuild_internalCount(int count) {
+    return max(count - 1, 1);
+}
+
+int BvhBuild_node(int node) {
+    return 1 + BVH_BUILD_NODE_SIZE * node;
+}
+
+int BvhBuild_leaf(int leafOffset, int leaf) {
+    return leafOffset + BVH_BUILD_LEAF_SIZE * leaf;
+}
+
+// Bounds of the triangle of a leaf
+void BvhBuild_triangleBounds(__global const int* bvh, int leaf, float3* lo, float3* hi) {
+    Triangle t = Triangle_new(bvh + leaf, 0);
+    float3 b = t.o + t.e1;
+    float3 c = t.o + t.e2;
+    *lo = fmin(t.o, fmin(b, c));
+    *hi = fmax(t.o, fmax(b, c));
+}
+
+// Spread the low 10 bits of a value to every third bit
+unsigned int BvhBuild_expandBits(unsigned int v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// One work item per leaf.
+__kernel void bvh_build_morton(
+    __global const int* bvh,
+    int leafOffset,
+    int count,
+    float minX, float minY, float minZ,
+    float invExtentX, float invExtentY, float invExtentZ,
+    __global int* keys,
+    __global int* ids
+) {
+    int index = get_global_id(0);
+    if (index >= count) return;
+
+    Triangle t = Triangle_new(bvh + BvhBuild_leaf(leafOffset, index), 0);
+    float3 centroid = t.o + (t.e1 + t.e2) / 3;
+    float3 p = clamp((centroid - (float3) (minX, minY, minZ)) * (float3) (invExtentX, invExtentY, invExtentZ), 0.0f, 1.0f);
+    uint3 q = convert_uint3(p * 1023.0f);
+    keys[index] = (BvhBuild_expandBits(q.x) << 2) | (BvhBuild_expandBits(q.y) << 1) | BvhBuild_expandBits(q.z);
+    ids[index] = index;
+}
+
+// Length of the common prefix of two sorted keys, with the index breaking ties. -1 out of range.
+int BvhBuild_delta(__global const int* keys, int count, int i, int j) {
+    if (j < 0 || j >= count) {
+        return -1;
+    }
+    unsigned int a = keys[i];
+    unsigned int b = keys[j];
+    return a == b ? 32 + clz((unsigned int) (i ^ j)) : clz(a ^ b);
+}
+
+// Child reference and scratch index of the element at a sorted position. Scratch indices of the
+// internal nodes come first, then the leaves.
+void BvhBuild_child(__global const int* ids, int count, int leafOffset, int position, bool leaf, int* ref, int* scratch) {
+    if (leaf) {
+        *ref = -BvhBuild_leaf(leafOffset, ids[position]);
+        *scratch = BvhBuild_internalCount(count) + position;
+    } else {
+        *ref = BvhBuild_node(position);
+        *scratch = position;
+    }
+}
+
+// One work item per internal node, at least one.
+__kernel void bvh_build_hierarchy(
+    __global const int* keys,
+    __global const int* ids,
+    int count,
+    int leafOffset,
+    __global int* bvh,
+    __global int* parents,
+    __global int* children
+) {
+    int i = get_global_id(0);
+    if (i >= BvhBuild_internalCount(count)) return;
+
+    int node = BvhBuild_node(i);
+    int ref, scratch;
+    if (count == 1) {
+        // A root with a single leaf
+        BvhBuild_child(ids, count, leafOffset, 0, true, &ref, &scratch);
+        bvh[node + 4] = ref;
+        children[0] = scratch;
+        children[1] = -1;
+        parents[0] = -1;
+        parents[scratch] = 0;
+        return;
+    }
+
+    // Direction and extent of the range of the node
+    int d = BvhBuild_delta(keys, count, i, i + 1) > BvhBuild_delta(keys, count, i, i - 1) ? 1 : -1;
+    int deltaMin = BvhBuild_delta(keys, count, i, i - d);
+    int lengthMax = 2;
+    while (BvhBuild_delta(keys, count, i, i + lengthMax * d) > deltaMin) {
+        lengthMax *= 2;
+    }
+    int length = 0;
+    for (int t = lengthMax / 2; t >= 1; t /= 2) {
+        if (BvhBuild_delta(keys, count, i, i + (length + t) * d) > deltaMin) {
+            length += t;
+        }
+    }
+    int j = i + length * d;
+
+    // Split position, where the common prefix gets longer
+    int deltaNode = BvhBuild_delta(keys, count, i, j);
+    int s = 0;
+    int t = length;
+    do {
+        t = (t + 1) >> 1;
+        if (BvhBuild_delta(keys, count, i, i + (s + t) * d) > deltaNode) {
+            s += t;
+        }
+    } while (t > 1);
+    int split = i + s * d + min(d, 0);
+
+    BvhBuild_child(ids, count, leafOffset, split, min(i, j) == split, &ref, &scratch);
+    bvh[node + 4] = ref;
+    children[2 * i] = scratch;
+    parents[scratch] = i;
+
+    BvhBuild_child(ids, count, leafOffset, split + 1, max(i, j) == split + 1, &ref, &scratch);
+    bvh[node + 5] = ref;
+    children[2 * i + 1] = scratch;
+    parents[scratch] = i;
+
+    if (i == 0) {
+        parents[0] = -1;
+    }
+}
+
+// Quantize the bounds of two children on one axis (see PackedWideBvh.java). Returns the exponent.
+int BvhBuild_quantize(float origin, float2 lo, float2 hi, int2* qlo, int2* qhi) {
+    float extent = fmax(hi.x, hi.y) - origin;
+    int exponent = extent > 0 ? max(ilogb(extent / 255), -126) : -126;
+    while (true) {
+        float scale = ldexp(1.0f, exponent);
+        int2 l = max(convert_int2(floor((lo - origin) / scale)), 0);
+        int2 h = convert_int2(ceil((hi - origin) / scale));
+        l.x -= l.x > 0 && origin + l.x * scale > lo.x ? 1 : 0;
+        l.y -= l.y > 0 && origin + l.y * scale > lo.y ? 1 : 0;
+        h.x += origin + h.x * scale < hi.x ? 1 : 0;
+        h.y += origin + h.y * scale < hi.y ? 1 : 0;
+        if (h.x <= 255 && h.y <= 255) {
+            *qlo = l;
+            *qhi = h;
+            return exponent;
+        }
+        exponent++;
+    }
+}
+
+// Write the corner, exponents and quantized bounds of a node with one or two children.
+void BvhBuild_writeNode(__global int* bvh, int node, int childCount, float3 lo0, float3 hi0, float3 lo1, float3 hi1) {
+    if (childCount == 1) {
+        lo1 = lo0;
+        hi1 = hi0;
+    }
+    float3 corner = fmin(lo0, lo1);
+    int2 qlo, qhi;
+    int header = childCount << 24;
+    int planes[6];
+
+    header |= (BvhBuild_quantize(corner.x, (float2) (lo0.x, lo1.x), (float2) (hi0.x, hi1.x), &qlo, &qhi) & 0xFF);
+    planes[0] = qlo.x | (qlo.y << 8);
+    planes[1] = qhi.x | (qhi.y << 8);
+    header |= (BvhBuild_quantize(corner.y, (float2) (lo0.y, lo1.y), (float2) (hi0.y, hi1.y), &qlo, &qhi) & 0xFF) << 8;
+    planes[2] = qlo.x | (qlo.y << 8);
+    planes[3] = qhi.x | (qhi.y << 8);
+    header |= (BvhBuild_quantize(corner.z, (float2) (lo0.z, lo1.z), (float2) (hi0.z, hi1.z), &qlo, &qhi) & 0xFF) << 16;
+    planes[4] = qlo.x | (qlo.y << 8);
+    planes[5] = qhi.x | (qhi.y << 8);
+
+    bvh[node] = as_int(corner.x);
+    bvh[node + 1] = as_int(corner.y);
+    bvh[node + 2] = as_int(corner.z);
+    bvh[node + 3] = header;
+    for (int i = 0; i < 6; i++) {
+        bvh[node + 8 + i] = planes[i];
+    }
+}
+
+// The bounds of the two children of a node are written and read by work items of different work
+// groups. Plain stores may stay in a cache the other work group does not see, even after a fence,
+// so the bounds are float bits only accessed with atomics, which are performed at the device's
+// point of coherence like the counters.
+void BvhBuild_storeBounds(__global volatile int* bounds, int scratch, float3 lo, float3 hi) {
+    atomic_xchg(&bounds[6 * scratch], as_int(lo.x));
+    atomic_xchg(&bounds[6 * scratch + 1], as_int(lo.y));
+    atomic_xchg(&bounds[6 * scratch + 2], as_int(lo.z));
+    atomic_xchg(&bounds[6 * scratch + 3], as_int(hi.x));
+    atomic_xchg(&bounds[6 * scratch + 4], as_int(hi.y));
+    atomic_xchg(&bounds[6 * scratch + 5], as_int(hi.z));
+}
+
+float BvhBuild_loadBound(__global volatile int* bounds, int index) {
+    return as_float(atomic_or(&bounds[index], 0));
+}
+
+void BvhBuild_loadBounds(__global volatile int* bounds, int scratch, float3* lo, float3* hi) {
+    *lo = (float3) (BvhBuild_loadBound(bounds, 6 * scratch),
+                    BvhBuild_loadBound(bounds, 6 * scratch + 1),
+                    BvhBuild_loadBound(bounds, 6 * scratch + 2));
+    *hi = (float3) (BvhBuild_loadBound(bounds, 6 * scratch + 3),
+                    BvhBuild_loadBound(bounds, 6 * scratch + 4),
+                    BvhBuild_loadBound(bounds, 6 * scratch + 5));
+}
+
+// One work item per leaf. Every internal node is finished by the second child to reach it, the
+// counters must be cleared before each refit.
+__kernel void bvh_build_refit(
+    __global int* bvh,
+    __global const int* ids,
+    int count,
+    int leafOffset,
+    __global const int* parents,
+    __global const int* children,
+    __global volatile int* bounds,
+    __global volatile int* counters
+) {
+    int position = get_global_id(0);
+    if (position >= count) return;
+
+    float3 lo, hi;
+    BvhBuild_triangleBounds(bvh, BvhBuild_leaf(leafOffset, ids[position]), &lo, &hi);
+    int scratch = BvhBuild_internalCount(count) + position;
+    BvhBuild_storeBounds(bounds, scratch, lo, hi);
+
+    int node = parents[scratch];
+    while (node >= 0) {
+        // The bounds of this child are stored before the counter is incremented, the second child
+        // reads them after
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+        int childCount = children[2 * node + 1] < 0 ? 1 : 2;
+        if (atomic_inc(&counters[node]) == 0 && childCount == 2) {
+            return;
+        }
+
+        int c0 = children[2 * node];
+        int c1 = childCount == 2 ? children[2 * node + 1] : c0;
+        float3 lo0, hi0, lo1, hi1;
+        BvhBuild_loadBounds(bounds, c0, &lo0, &hi0);
+        BvhBuild_loadBounds(bounds, c1, &lo1, &hi1);
+        BvhBuild_writeNode(bvh, BvhBuild_node(node), childCount, lo0, hi0, lo1, hi1);
+
+        BvhBuild_storeBounds(bounds, node, fmin(lo0, lo1), fmax(hi0, hi1));
+        node = parents[node];
+    }
+}
+
+#endif
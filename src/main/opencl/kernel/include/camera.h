@@ -3,7 +3,7 @@
 
 #include "../opencl.h"
 #include "rt.h"
-#include "random.h"
+#include "sampler.h"
 
 Ray Camera_preGenerated(__global const float* rays, int index) {
     Ray ray;
@@ -24,8 +24,9 @@ Ray Camera_pinHole(float x, float y, Random random, __global const float* projec
     if (aperature > 0) {
         ray.direction *= subjectDistance / ray.direction.z;
 
-        float r = sqrt(Random_nextFloat(random)) * aperature;
-        float theta = Random_nextFloat(random) * M_PI_F * 2.0;
+        float2 u = Sampler_next2D(random, SAMPLER_LENS);
+        float r = sqrt(u.x) * aperature;
+        float theta = u.y * M_PI_F * 2.0;
         float rx = cos(theta) * r;
         float ry = sin(theta) * r;
 
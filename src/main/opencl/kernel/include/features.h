@@ -0,0 +1,49 @@
+// Compile time scene features. The host builds a program variant per scene with these defined by
+// -D options (see KernelFeatures.java), so branches on settings that are fixed for a whole render
+// and traversals of empty structures compile away. Without them every feature is decided at
+// runtime, which is what the generic program (used by the preview) does.
+//
+// Structure features are 0 if the structure is empty:
+//   FEATURE_WATER, FEATURE_WORLD_BVH, FEATURE_ACTOR_BVH
+//
+// FEATURE_SHARDED is 0 if every sharded buffer fits in its first shard (see sharded.h).
+//
+// FEATURE_OCTREE_DDA selects the integer cell walk through octrees (see Octree_ddaCell), it is off
+// by default.
+//
+// FEATURE_BVH_STACK_SIZE is the BVH traversal stack size the scene's BVHs need (see
+// PackedWideBvh.stackSize). The generic program uses 64, the preview gets a variant if that is too
+// small.
+//
+// Setting features replace the runtime value of the same setting if defined:
+//   FEATURE_PROJECTOR_TYPE, FEATURE_EMITTERS_ENABLED, FEATURE_EMITTER_SAMPLING_STRATEGY,
+//   FEATURE_SUN_SAMPLING, FEATURE_FANCIER_TRANSLUCENCY, FEATURE_STRICT_DIRECT_LIGHT
+
+#ifndef CHUNKYCL_FEATURES_H
+#define CHUNKYCL_FEATURES_H
+
+#ifndef FEATURE_WATER
+#define FEATURE_WATER 1
+#endif
+
+#ifndef FEATURE_WORLD_BVH
+#define FEATURE_WORLD_BVH 1
+#endif
+
+#ifndef FEATURE_ACTOR_BVH
+#define FEATURE_ACTOR_BVH 1
+#endif
+
+#ifndef FEATURE_OCTREE_DDA
+#define FEATURE_OCTREE_DDA 0
+#endif
+
+#ifndef FEATURE_SHARDED
+#define FEATURE_SHARDED 1
+#endif
+
+#ifndef FEATURE_BVH_STACK_SIZE
+#define FEATURE_BVH_STACK_SIZE 64
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+// Tile based adaptive sampling. The canvas is split into ADAPTIVE_TILE_SIZE^2 pixel tiles and only
+// the tiles in the active tile list are rendered. Alongside the mean, render_tiles keeps the mean
+// of the squared samples of the pass. adaptive_merge_stats folds every merged pass into running
+// totals, so adaptive_tile_error estimates the error of each tile from all of its samples and
+// compacts the tiles that have not converged yet into the next tile list.
+
+#include "kernel.h"
+#include "camera.h"
+#include "sky.h"
+
+#define ADAPTIVE_TILE_SIZE 16
+#define ADAPTIVE_TILE_PIXELS (ADAPTIVE_TILE_SIZE * ADAPTIVE_TILE_SIZE)
+// Tiles need this many samples before their error estimate is trusted
+#define ADAPTIVE_MIN_SPP 16
+
+int Adaptive_tilesX(__global const int* canvasConfig) {
+    return (canvasConfig[0] + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+}
+
+// Get the pixel index of the given pixel in a tile, or -1 if it lies outside the canvas.
+int Adaptive_pixel(__global const int* canvasConfig, int tile, int tilePixel) {
+    int tilesX = Adaptive_tilesX(canvasConfig);
+    int px = (tile % tilesX) * ADAPTIVE_TILE_SIZE + tilePixel % ADAPTIVE_TILE_SIZE;
+    int py = (tile / tilesX) * ADAPTIVE_TILE_SIZE + tilePixel / ADAPTIVE_TILE_SIZE;
+    if (px >= canvasConfig[0] || py >= canvasConfig[1]) {
+        return -1;
+    }
+    return py * canvasConfig[0] + px;
+}
+
+__kernel void render_tiles(
+    __global const int* projectorType,
+    __global const float* cameraSettings,
+
+    SCENE_KERNEL_ARGS,
+
+    int randomSeed,
+    int bufferSpp,
+    int sampleOffset,
+    __global const int* canvasConfig,
+    __global const int* rayDepth,
+    __global const float* sceneSettings,
+    int emittersEnabled,
+    float emitterIntensity,
+    int emitterSamplingStrategy,
+    int preventNormalEmitterWithSampling,
+    int samplesPerDispatch,
+    __global const int* tileList,
+    __global const int* tileSpp,
+    __global float* res,
+    __global float* resSquared,
+    int writeGuides,
+    __global float* guides
+) {
+    int gid = get_global_id(0);
+    int tile = tileList[gid / ADAPTIVE_TILE_PIXELS];
+    int pixel = Adaptive_pixel(canvasConfig, tile, gid % ADAPTIVE_TILE_PIXELS);
+    if (pixel < 0) return;
+
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    Sun sun = Sun_new(sunData);
+    PathTracerSettings settings = PathTracerSettings_new(rayDepth, sceneSettings,
+            emittersEnabled, emitterIntensity, emitterSamplingStrategy, preventNormalEmitterWithSampling);
+
+    // Tiles render at different rates, so the pass sample count is tracked per tile
+    int spp = tileSpp[tile];
+
+    float3 color = (float3) (0.0f);
+    float3 squared = (float3) (0.0f);
+    PathGuide guideSum = { (float3) (0.0f), (float3) (0.0f), 0.0f };
+    for (int i = 0; i < samplesPerDispatch; i++) {
+        RandomState randomState;
+        Random random = &randomState;
+        Random_seed(random, randomSeed, pixel, i);
+        // Sample indices restart with every pass, so each pass gets its own scramble
+        Sampler_init(random, (int) sceneSettings[7], pixel, spp + i, sampleOffset - bufferSpp);
+        Ray ray = ray_to_camera(projectorType, cameraSettings, canvasConfig, pixel, random);
+
+        initialize_ray_medium(scene, &ray);
+        ray.flags = 0;
+
+        PathGuide guide;
+        float3 sample = PathTracer_trace(scene, textureAtlas, skyTexture, *skyIntensity, sun, settings, ray, random,
+                writeGuides ? &guide : NULL);
+        color += sample;
+        squared += sample * sample;
+        if (writeGuides) {
+            guideSum.albedo += guide.albedo;
+            guideSum.normal += guide.normal;
+            guideSum.distance += guide.distance;
+        }
+    }
+
+    float3 bufferColor = vload3(pixel, res);
+    bufferColor = (bufferColor * spp + color) / (spp + samplesPerDispatch);
+    vstore3(bufferColor, pixel, res);
+
+    float3 bufferSquared = vload3(pixel, resSquared);
+    bufferSquared = (bufferSquared * spp + squared) / (spp + samplesPerDispatch);
+    vstore3(bufferSquared, pixel, resSquared);
+
+    if (writeGuides) {
+        PathGuide_store(guides, pixel, guideSum, spp, samplesPerDispatch);
+    }
+}
+
+// One work item per active tile. Counts the samples just rendered and pushes the tile to the next
+// tile list unless its mean relative standard error is below the threshold. The error combines
+// the merged totals with the current pass. Samples from before the statistics were started
+// (tileBaseSpp) count towards the error of the image but not towards the variance estimate.
+__kernel void adaptive_tile_error(
+    __global const int* canvasConfig,
+    __global const float* res,
+    __global const float* resSquared,
+    __global const float* totalMean,
+    __global const float* totalSquared,
+    __global const int* tileTotal,
+    __global const int* tileBaseSpp,
+    __global const int* tileList,
+    __global int* tileSpp,
+    int samplesPerDispatch,
+    float threshold,
+    __global int* nextTileList,
+    __global int* nextTileListSize
+) {
+    int gid = get_global_id(0);
+    int tile = tileList[gid];
+
+    int passSpp = tileSpp[tile] + samplesPerDispatch;
+    tileSpp[tile] = passSpp;
+
+    int totalSpp = tileTotal[tile];
+    int spp = totalSpp + passSpp;
+    int baseSpp = tileBaseSpp[tile];
+    if (spp < ADAPTIVE_MIN_SPP) {
+        nextTileList[atomic_inc(nextTileListSize)] = tile;
+        return;
+    }
+
+    float error = 0.0f;
+    int pixels = 0;
+    for (int i = 0; i < ADAPTIVE_TILE_PIXELS; i++) {
+        int pixel = Adaptive_pixel(canvasConfig, tile, i);
+        if (pixel < 0) continue;
+
+        float3 mean = (vload3(pixel, totalMean) * totalSpp + vload3(pixel, res) * passSpp) / spp;
+        float3 squared = (vload3(pixel, totalSquared) * totalSpp + vload3(pixel, resSquared) * passSpp) / spp;
+        float3 variance = fmax(squared - mean * mean, 0.0f);
+        float3 stdError = sqrt(variance / (baseSpp + spp));
+
+        // Relative to the brightness so dark areas are not held to an absolute threshold. The
+        // offset keeps near black pixels from never converging.
+        error += (stdError.x + stdError.y + stdError.z) / (mean.x + mean.y + mean.z + 1e-2f);
+        pixels++;
+    }
+
+    if (pixels > 0 && error / pixels > threshold) {
+        nextTileList[atomic_inc(nextTileListSize)] = tile;
+    }
+}
+
+// One work item per tile. Folds the pass statistics of a tile into its running totals when the
+// pass is merged. The host starts a new pass by clearing tileSpp afterwards.
+__kernel void adaptive_merge_stats(
+    __global const int* canvasConfig,
+    __global const float* res,
+    __global const float* resSquared,
+    __global const int* tileSpp,
+    __global float* totalMean,
+    __global float* totalSquared,
+    __global int* tileTotal
+) {
+    int tile = get_global_id(0);
+    int passSpp = tileSpp[tile];
+    if (passSpp == 0) return;
+
+    int totalSpp = tileTotal[tile];
+    int spp = totalSpp + passSpp;
+    for (int i = 0; i < ADAPTIVE_TILE_PIXELS; i++) {
+        int pixel = Adaptive_pixel(canvasConfig, tile, i);
+        if (pixel < 0) continue;
+
+        vstore3((vload3(pixel, totalMean) * totalSpp + vload3(pixel, res) * passSpp) / spp, pixel, totalMean);
+        vstore3((vload3(pixel, totalSquared) * totalSpp + vload3(pixel, resSquared) * passSpp) / spp,
+                pixel, totalSquared);
+    }
+    tileTotal[tile] = spp;
+}
@@ -3,11 +3,11 @@
 #include "material.h"
 #include "sky.h"
 
-bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRecord* record, MaterialSample* sample, Material* mat);
+bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRecord* record, MaterialSample* sample, Material* mat, Random random);
 void initialize_ray_medium(Scene scene, Ray* ray);
 float computeDiffuseProbability(float4 color, bool fancierTranslucency);
 float computeAbsorption(float4 color, float pDiffuse, bool fancierTranslucency);
-float4 getDirectLightAttenuation(Scene scene, image2d_array_t textureAtlas, Ray ray, bool strictDirectLight);
+float4 getDirectLightAttenuation(Scene scene, image2d_array_t textureAtlas, Ray ray, bool strictDirectLight, Random random);
 float3 sampleEmitters(Scene scene, image2d_array_t textureAtlas, float3 hitPoint, float3 shadingNormal, int strategy, float emitterIntensity, bool fancierTranslucency, float transmissivityCap, Random random);
 void intersectSky(image2d_t skyTexture, float skyIntensity, Sun sun, image2d_array_t atlas, Ray ray, MaterialSample* sample);
 
@@ -19,7 +19,12 @@ Ray ray_to_camera(
         Random random
 ) {
     Ray ray;
-    if (*projectorType != -1) {
+#ifdef FEATURE_PROJECTOR_TYPE
+    int projector = FEATURE_PROJECTOR_TYPE;
+#else
+    int projector = *projectorType;
+#endif
+    if (projector != -1) {
         float3 cameraPos = vload3(0, cameraSettings);
         float3 m1s = vload3(1, cameraSettings);
         float3 m2s = vload3(2, cameraSettings);
@@ -34,10 +39,11 @@ Ray ray_to_camera(
 
         float halfWidth = fullWidth / (2.0 * fullHeight);
         float invHeight = 1.0 / fullHeight;
-        float x = -halfWidth + ((gid % width) + Random_nextFloat(random) + cropX) * invHeight;
-        float y = -0.5 + ((gid / width) + Random_nextFloat(random) + cropY) * invHeight;
+        float2 jitter = Sampler_next2D(random, SAMPLER_PIXEL);
+        float x = -halfWidth + ((gid % width) + jitter.x + cropX) * invHeight;
+        float y = -0.5 + ((gid / width) + jitter.y + cropY) * invHeight;
 
-        switch (*projectorType) {
+        switch (projector) {
             case 0:
                 ray = Camera_pinHole(x, y, random, cameraSettings + 12);
                 break;
@@ -64,250 +70,407 @@ Ray ray_to_camera(
     return ray;
 }
 
-__kernel void render(
-    __global const int* projectorType,
-    __global const float* cameraSettings,
-
-    __global const int* octreeDepth,
-    __global const int* octreeData,
-    __global const int* waterOctreeDepth,
-    __global const int* waterOctreeData,
-
-    __global const int* bPalette,
-    __global const int* quadModels,
-    __global const int* aabbModels,
-    __global const int* waterModels,
+typedef struct {
+    float transmissivityCap;
+    bool fancierTranslucency;
+    bool doSunSampling;
+    bool sunLuminosity;
+    bool strictDirectLight;
+    float rrThreshold;
+    int rayDepth;
+    int emittersEnabled;
+    float emitterIntensity;
+    int emitterSamplingStrategy;
+    int preventNormalEmitterWithSampling;
+} PathTracerSettings;
+
+PathTracerSettings PathTracerSettings_new(
+        __global const int* rayDepth,
+        __global const float* sceneSettings,
+        int emittersEnabled,
+        float emitterIntensity,
+        int emitterSamplingStrategy,
+        int preventNormalEmitterWithSampling
+) {
+    // Settings fixed for the program variant replace the runtime values, so the branches on them
+    // fold away. See features.h.
+#ifdef FEATURE_EMITTERS_ENABLED
+    emittersEnabled = FEATURE_EMITTERS_ENABLED;
+#endif
+#ifdef FEATURE_EMITTER_SAMPLING_STRATEGY
+    emitterSamplingStrategy = FEATURE_EMITTER_SAMPLING_STRATEGY;
+#endif
+
+    PathTracerSettings s;
+    s.transmissivityCap = sceneSettings[0];
+    s.fancierTranslucency = sceneSettings[1] > 0.5f;
+    s.doSunSampling = sceneSettings[2] > 0.5f;
+    s.sunLuminosity = sceneSettings[3] > 0.5f;
+    s.strictDirectLight = sceneSettings[4] > 0.5f;
+    s.rrThreshold = sceneSettings[5] / 100.0f; // 俄羅斯輪盤閾值 (0.0 ~ 1.0)
+    s.rayDepth = *rayDepth;
+    s.emittersEnabled = emittersEnabled;
+    s.emitterIntensity = emitterIntensity;
+    s.emitterSamplingStrategy = emittersEnabled != 0 && emitterSamplingStrategy == 0 ? 2 : emitterSamplingStrategy;
+    s.preventNormalEmitterWithSampling = preventNormalEmitterWithSampling;
+
+#ifdef FEATURE_FANCIER_TRANSLUCENCY
+    s.fancierTranslucency = FEATURE_FANCIER_TRANSLUCENCY;
+#endif
+#ifdef FEATURE_SUN_SAMPLING
+    s.doSunSampling = FEATURE_SUN_SAMPLING;
+#endif
+#ifdef FEATURE_STRICT_DIRECT_LIGHT
+    s.strictDirectLight = FEATURE_STRICT_DIRECT_LIGHT;
+#endif
+    return s;
+}
 
-    __global const int* worldBvhData,
-    __global const int* actorBvhData,
-    __global const int* bvhTrigs,
+#define LIGHT_SAMPLE_EMITTERS 0b01
+#define LIGHT_SAMPLE_SUN      0b10
+
+// Next event estimation requested by a diffuse bounce. The megakernel evaluates it immediately,
+// the wavefront pipeline defers it to the shadow connect stage.
+typedef struct {
+    int flags;
+    float3 hitPoint;
+    float3 normal;
+    float3 weight;
+    float sunMult;
+    Ray sunRay;
+} DirectLightRequest;
+
+// 實作俄羅斯輪盤 (Russian Roulette)
+// 在前 3 跳之後，如果路徑能量過低，則機率性終止，以提升 GPU 效率。
+// Returns false if the path should be terminated before tracing the given depth.
+bool PathTracer_russianRoulette(PathTracerSettings settings, int depth, float3* throughput, Random random) {
+    if (depth > 2) {
+        float p = fmax(throughput->x, fmax(throughput->y, throughput->z));
+        if (p < settings.rrThreshold) {
+            if (Sampler_next1D(random, SAMPLER_ROULETTE) > p) {
+                return false;
+            }
+            *throughput /= p; // 能量補償，保持渲染無偏
+        }
+    }
+    return true;
+}
 
-    image2d_array_t textureAtlas,
-    __global const int* matPalette,
-    __global const int* biomeMeta,
-    __global const int* biomeGrid,
-    __global const float* biomeGrass,
-    __global const float* biomeFoliage,
-    __global const float* biomeDryFoliage,
-    __global const float* biomeWater,
-    __global const int* emitterGridMeta,
-    __global const int* emitterGridCells,
-    __global const int* emitterGridIndexes,
-    __global const int* emitterGridEmitters,
+// Terminate a path that escaped the scene.
+void PathTracer_miss(image2d_t skyTexture, float skyIntensity, Sun sun, image2d_array_t atlas, Ray ray, float3* throughput, float3* color) {
+    MaterialSample sample;
+    intersectSky(skyTexture, skyIntensity, sun, atlas, ray, &sample);
+    *throughput *= sample.color.xyz;
+    *color += sample.emittance * *throughput;
+}
 
-    image2d_t skyTexture,
-    __global const float* skyIntensity,
-    __global const int* sunData,
+// Scatter the ray at a surface hit. Updates the ray to continue the path and fills in the direct
+// light request for diffuse bounces.
+void PathTracer_scatter(
+        Scene scene,
+        PathTracerSettings settings,
+        Sun sun,
+        Ray* ray,
+        IntersectionRecord record,
+        MaterialSample sample,
+        int depth,
+        float3* throughput,
+        float3* color,
+        DirectLightRequest* light,
+        Random random
+) {
+    light->flags = 0;
+
+    ray->prevMaterial = ray->currentMaterial;
+    ray->prevBlock = ray->currentBlock;
+    ray->currentMaterial = record.material;
+    ray->currentBlock = record.block;
+
+    Material currentMat = Material_get(scene.materialPalette, ray->currentMaterial);
+    Material prevMat = Material_get(scene.materialPalette, ray->prevMaterial);
+    float pSpecular = sample.specular;
+    float pDiffuse = computeDiffuseProbability(sample.color, settings.fancierTranslucency);
+    float pAbsorb = computeAbsorption(sample.color, pDiffuse, settings.fancierTranslucency);
+    float n1 = Material_ior(prevMat);
+    float n2 = Material_ior(currentMat);
+    float3 hitPoint = ray->origin + ray->direction * record.distance;
+    if (sample.color.w + pSpecular < EPS && fabs(n1 - n2) < EPS) {
+        ray->origin = hitPoint + ray->direction * OFFSET;
+        return;
+    }
 
-    __global const int* randomSeed,
-    __global const int* bufferSpp,
-    __global const int* canvasConfig,
-    __global const int* rayDepth,
-    __global const float* sceneSettings,
-    int emittersEnabled,
-    float emitterIntensity,
-    int emitterSamplingStrategy,
-    int preventNormalEmitterWithSampling,
-    __global float* res
+    bool didSpecularBounce = true;
+    bool doMetal = sample.metalness > EPS && sample.metalness > Sampler_next1D(random, SAMPLER_METAL);
+    if (doMetal) {
+        *throughput *= sample.color.xyz;
+        ray->origin = hitPoint;
+        ray->direction = _Material_specularReflection(record, sample, *ray, random);
+        ray->origin += ray->direction * OFFSET;
+        ray->currentMaterial = ray->prevMaterial;
+        ray->currentBlock = ray->prevBlock;
+    } else if (pSpecular > EPS && pSpecular > Sampler_next1D(random, SAMPLER_SPECULAR)) {
+        ray->origin = hitPoint;
+        ray->direction = _Material_specularReflection(record, sample, *ray, random);
+        ray->origin += ray->direction * OFFSET;
+        ray->currentMaterial = ray->prevMaterial;
+        ray->currentBlock = ray->prevBlock;
+    } else if (Sampler_next1D(random, SAMPLER_DIFFUSE) < pDiffuse) {
+        float3 weight = *throughput * sample.color.xyz;
+        bool allowNormalEmitter = settings.emittersEnabled != 0 &&
+                (!settings.preventNormalEmitterWithSampling || settings.emitterSamplingStrategy == 0 || depth == 0);
+        if (allowNormalEmitter && sample.emittance > EPS) {
+            *color += weight * sample.color.xyz * sample.emittance * settings.emitterIntensity;
+        } else if (settings.emittersEnabled != 0 &&
+                settings.emitterSamplingStrategy != 0 &&
+                sample.emittance <= EPS &&
+                Material_isOpaque(currentMat) &&
+                !Material_isRefractive(currentMat)) {
+            light->flags |= LIGHT_SAMPLE_EMITTERS;
+        }
 
-) {
-    int gid = get_global_id(0);
+        if (settings.doSunSampling) {
+            Ray sunRay = *ray;
+            sunRay.origin = hitPoint;
+            sunRay.currentMaterial = ray->prevMaterial;
+            sunRay.currentBlock = ray->prevBlock;
+            sunRay.prevMaterial = ray->prevMaterial;
+            sunRay.prevBlock = ray->prevBlock;
+
+            if (Sun_sampleDirection(sun, &sunRay, random)) {
+                float frontLight = dot(sunRay.direction, record.normal);
+                if (frontLight > 0.0f) {
+                    light->flags |= LIGHT_SAMPLE_SUN;
+                    light->sunRay = sunRay;
+                    light->sunMult = fabs(frontLight) * (settings.sunLuminosity ? sun.luminosity : 1.0f);
+                }
+            }
+        }
 
-    float virtualDepth = sceneSettings[6];
+        light->hitPoint = hitPoint;
+        light->normal = record.normal;
+        light->weight = weight;
+
+        *throughput *= sample.color.xyz;
+        ray->origin = hitPoint;
+        ray->direction = _Material_diffuseReflection(record, random);
+        ray->origin += ray->direction * OFFSET;
+        ray->currentMaterial = ray->prevMaterial;
+        ray->currentBlock = ray->prevBlock;
+        didSpecularBounce = false;
+    } else if (fabs(n1 - n2) >= EPS) {
+        bool doRefraction = Material_isRefractive(currentMat) || Material_isRefractive(prevMat);
+        float n1n2 = n1 / n2;
+        float cosTheta = -dot(record.normal, ray->direction);
+        float radicand = 1 - n1n2 * n1n2 * (1 - cosTheta * cosTheta);
+
+        if (doRefraction && radicand < EPS) {
+            ray->origin = hitPoint;
+            ray->direction = _Material_specularReflection(record, sample, *ray, random);
+            ray->origin += ray->direction * OFFSET;
+            ray->currentMaterial = ray->prevMaterial;
+            ray->currentBlock = ray->prevBlock;
+        } else {
+            float a = n1n2 - 1;
+            float b = n1n2 + 1;
+            float R0 = (a * a) / (b * b);
+            float c = 1 - cosTheta;
+            float Rtheta = R0 + (1 - R0) * (c * c * c * c * c);
+
+            if (Sampler_next1D(random, SAMPLER_FRESNEL) < Rtheta) {
+                ray->origin = hitPoint;
+                ray->direction = _Material_specularReflection(record, sample, *ray, random);
+                ray->origin += ray->direction * OFFSET;
+                ray->currentMaterial = ray->prevMaterial;
+                ray->currentBlock = ray->prevBlock;
+            } else {
+                *throughput *= Material_translucentTransmission(sample, pAbsorb, settings.transmissivityCap, settings.fancierTranslucency);
+                ray->origin = hitPoint;
+                if (doRefraction) {
+                    ray->direction = Material_refractDirection(record, *ray, n1, n2);
+                }
+                ray->origin += ray->direction * OFFSET;
+            }
+        }
+    } else {
+        *throughput *= Material_translucentTransmission(sample, pAbsorb, settings.transmissivityCap, settings.fancierTranslucency);
+        ray->origin = hitPoint + ray->direction * OFFSET;
+    }
 
-    Scene scene;
-    scene.materialPalette = MaterialPalette_new(matPalette);
-    scene.octree = Octree_create(octreeData, *octreeDepth, (int)virtualDepth);
-    scene.waterOctree = Octree_create(waterOctreeData, *waterOctreeDepth, (int)virtualDepth);
-    scene.worldBvh = Bvh_new(worldBvhData, bvhTrigs, &scene.materialPalette);
-    scene.actorBvh = Bvh_new(actorBvhData, bvhTrigs, &scene.materialPalette);
-    scene.blockPalette = BlockPalette_new(bPalette, quadModels, aabbModels, waterModels, &scene.materialPalette);
-    scene.biome = BiomeColors_new(biomeMeta, biomeGrid, biomeGrass, biomeFoliage, biomeDryFoliage, biomeWater);
-    scene.emitterGrid = EmitterGrid_new(emitterGridMeta, emitterGridCells, emitterGridIndexes, emitterGridEmitters);
-    scene.drawDepth = 256;
+    if (!didSpecularBounce) {
+        ray->flags |= RAY_INDIRECT;
+    }
+}
 
-    Sun sun = Sun_new(sunData);
+// Evaluate a direct light request by tracing the emitter and sun shadow rays.
+float3 PathTracer_directLight(Scene scene, image2d_array_t atlas, Sun sun, PathTracerSettings settings, DirectLightRequest light, Random random) {
+    float3 result = (float3) (0.0f);
+    if (light.flags & LIGHT_SAMPLE_EMITTERS) {
+        float3 emitterLight = sampleEmitters(
+                scene,
+                atlas,
+                light.hitPoint,
+                light.normal,
+                settings.emitterSamplingStrategy,
+                settings.emitterIntensity,
+                settings.fancierTranslucency,
+                settings.transmissivityCap,
+                random
+        );
+        result += light.weight * emitterLight;
+    }
+    if (light.flags & LIGHT_SAMPLE_SUN) {
+        float4 attenuation = getDirectLightAttenuation(
+                scene,
+                atlas,
+                light.sunRay,
+                settings.strictDirectLight,
+                random
+        );
+        if (attenuation.w > 0.0f) {
+            float3 directLight = attenuation.xyz * attenuation.w * light.sunMult;
+            result += light.weight * directLight * Sun_emittance(sun);
+        }
+    }
+    return result;
+}
 
-    unsigned int randomState = *randomSeed + gid;
-    Random random = &randomState;
-    Random_nextState(random);
-    Ray ray = ray_to_camera(projectorType, cameraSettings, canvasConfig, gid, random);
+// First hit of a camera path, written to the denoiser guide buffer.
+typedef struct {
+    float3 albedo;
+    float3 normal;
+    float distance;
+} PathGuide;
+
+// Guide of a path that misses. Paths that miss keep a zero normal, so the denoiser leaves the sky
+// alone.
+PathGuide PathGuide_new() {
+    PathGuide guide = { (float3) (1.0f), (float3) (0.0f), 0.0f };
+    return guide;
+}
 
-    initialize_ray_medium(scene, &ray);
-    ray.flags = 0;
+// Merge the guides of the samples just traced into the guide buffer of the pass. Averaged like the
+// color, so edges in the guides are anti-aliased the same way.
+void PathGuide_store(__global float* guides, int pixel, PathGuide guideSum, int spp, int samples) {
+    __global float* pixelGuide = guides + pixel * 7;
+    float3 albedo = vload3(0, pixelGuide);
+    float3 normal = vload3(1, pixelGuide);
+    vstore3((albedo * spp + guideSum.albedo) / (spp + samples), 0, pixelGuide);
+    vstore3((normal * spp + guideSum.normal) / (spp + samples), 1, pixelGuide);
+    pixelGuide[6] = (pixelGuide[6] * spp + guideSum.distance) / (spp + samples);
+}
 
+// Trace a full path starting with the given camera ray and return the radiance. The first hit is
+// written to the guide if it is not NULL.
+float3 PathTracer_trace(
+        Scene scene,
+        image2d_array_t atlas,
+        image2d_t skyTexture,
+        float skyIntensity,
+        Sun sun,
+        PathTracerSettings settings,
+        Ray ray,
+        Random random,
+        PathGuide* guide
+) {
     float3 color = (float3) (0.0);
     float3 throughput = (float3) (1.0);
-    float transmissivityCap = sceneSettings[0];
-    bool fancierTranslucency = sceneSettings[1] > 0.5f;
-    bool doSunSampling = sceneSettings[2] > 0.5f;
-    bool sunLuminosity = sceneSettings[3] > 0.5f;
-    bool strictDirectLight = sceneSettings[4] > 0.5f;
-    float rrThreshold = sceneSettings[5] / 100.0f; // 俄羅斯輪盤閾值 (0.0 ~ 1.0)
-    int effectiveEmitterSamplingStrategy = emittersEnabled != 0 && emitterSamplingStrategy == 0 ? 2 : emitterSamplingStrategy;
-
-    for (int depth = 0; depth < *rayDepth; depth++) {
-        // 實作俄羅斯輪盤 (Russian Roulette)
-        // 在前 3 跳之後，如果路徑能量過低，則機率性終止，以提升 GPU 效率。
-        if (depth > 2) {
-            float p = fmax(throughput.x, fmax(throughput.y, throughput.z));
-            if (p < rrThreshold) {
-                if (Random_nextFloat(random) > p) {
-                    break;
-                }
-                throughput /= p; // 能量補償，保持渲染無偏
-            }
+
+    if (guide != NULL) {
+        *guide = PathGuide_new();
+    }
+
+    for (int depth = 0; depth < settings.rayDepth; depth++) {
+        Sampler_startBounce(random, depth);
+        if (!PathTracer_russianRoulette(settings, depth, &throughput, random)) {
+            break;
         }
 
         IntersectionRecord record = IntersectionRecord_new();
         MaterialSample sample;
         Material material;
 
-        if (closestIntersect(scene, textureAtlas, ray, &record, &sample, &material)) {
-            ray.prevMaterial = ray.currentMaterial;
-            ray.prevBlock = ray.currentBlock;
-            ray.currentMaterial = record.material;
-            ray.currentBlock = record.block;
-
-            Material currentMat = Material_get(scene.materialPalette, ray.currentMaterial);
-            Material prevMat = Material_get(scene.materialPalette, ray.prevMaterial);
-            float pSpecular = sample.specular;
-            float pDiffuse = computeDiffuseProbability(sample.color, fancierTranslucency);
-            float pAbsorb = computeAbsorption(sample.color, pDiffuse, fancierTranslucency);
-            float n1 = Material_ior(prevMat);
-            float n2 = Material_ior(currentMat);
-            float3 hitPoint = ray.origin + ray.direction * record.distance;
-            if (sample.color.w + pSpecular < EPS && fabs(n1 - n2) < EPS) {
-                ray.origin = hitPoint + ray.direction * OFFSET;
-                continue;
+        if (closestIntersect(scene, atlas, ray, &record, &sample, &material, random)) {
+            if (depth == 0 && guide != NULL) {
+                guide->albedo = sample.color.xyz;
+                guide->normal = record.normal;
+                guide->distance = record.distance;
             }
 
-            bool didSpecularBounce = true;
-            bool doMetal = sample.metalness > EPS && sample.metalness > Random_nextFloat(random);
-            if (doMetal) {
-                throughput *= sample.color.xyz;
-                ray.origin = hitPoint;
-                ray.direction = _Material_specularReflection(record, sample, ray, random);
-                ray.origin += ray.direction * OFFSET;
-                ray.currentMaterial = ray.prevMaterial;
-                ray.currentBlock = ray.prevBlock;
-            } else if (pSpecular > EPS && pSpecular > Random_nextFloat(random)) {
-                ray.origin = hitPoint;
-                ray.direction = _Material_specularReflection(record, sample, ray, random);
-                ray.origin += ray.direction * OFFSET;
-                ray.currentMaterial = ray.prevMaterial;
-                ray.currentBlock = ray.prevBlock;
-            } else if (Random_nextFloat(random) < pDiffuse) {
-                bool allowNormalEmitter = emittersEnabled != 0 &&
-                        (!preventNormalEmitterWithSampling || effectiveEmitterSamplingStrategy == 0 || depth == 0);
-                if (allowNormalEmitter && sample.emittance > EPS) {
-                    color += throughput * sample.color.xyz * sample.color.xyz * sample.emittance * emitterIntensity;
-                } else if (emittersEnabled != 0 &&
-                        effectiveEmitterSamplingStrategy != 0 &&
-                        sample.emittance <= EPS &&
-                        Material_isOpaque(currentMat) &&
-                        !Material_isRefractive(currentMat)) {
-                    float3 emitterLight = sampleEmitters(
-                            scene,
-                            textureAtlas,
-                            hitPoint,
-                            record.normal,
-                            effectiveEmitterSamplingStrategy,
-                            emitterIntensity,
-                            fancierTranslucency,
-                            transmissivityCap,
-                            random
-                    );
-                    color += throughput * sample.color.xyz * emitterLight;
-                }
-
-                if (doSunSampling) {
-                    Ray sunRay = ray;
-                    sunRay.origin = hitPoint;
-                    sunRay.currentMaterial = ray.prevMaterial;
-                    sunRay.currentBlock = ray.prevBlock;
-                    sunRay.prevMaterial = ray.prevMaterial;
-                    sunRay.prevBlock = ray.prevBlock;
-
-                    if (Sun_sampleDirection(sun, &sunRay, random)) {
-                        float frontLight = dot(sunRay.direction, record.normal);
-                        if (frontLight > 0.0f) {
-                            float4 attenuation = getDirectLightAttenuation(
-                                    scene,
-                                    textureAtlas,
-                                    sunRay,
-                                    strictDirectLight
-                            );
-                            if (attenuation.w > 0.0f) {
-                                float mult = fabs(frontLight) * (sunLuminosity ? sun.luminosity : 1.0f);
-                                float3 directLight = attenuation.xyz * attenuation.w * mult;
-                                color += throughput * sample.color.xyz * directLight * Sun_emittance(sun);
-                            }
-                        }
-                    }
-                }
-
-                throughput *= sample.color.xyz;
-                ray.origin = hitPoint;
-                ray.direction = _Material_diffuseReflection(record, random);
-                ray.origin += ray.direction * OFFSET;
-                ray.currentMaterial = ray.prevMaterial;
-                ray.currentBlock = ray.prevBlock;
-                didSpecularBounce = false;
-            } else if (fabs(n1 - n2) >= EPS) {
-                bool doRefraction = Material_isRefractive(currentMat) || Material_isRefractive(prevMat);
-                float n1n2 = n1 / n2;
-                float cosTheta = -dot(record.normal, ray.direction);
-                float radicand = 1 - n1n2 * n1n2 * (1 - cosTheta * cosTheta);
-
-                if (doRefraction && radicand < EPS) {
-                    ray.origin = hitPoint;
-                    ray.direction = _Material_specularReflection(record, sample, ray, random);
-                    ray.origin += ray.direction * OFFSET;
-                    ray.currentMaterial = ray.prevMaterial;
-                    ray.currentBlock = ray.prevBlock;
-                } else {
-                    float a = n1n2 - 1;
-                    float b = n1n2 + 1;
-                    float R0 = (a * a) / (b * b);
-                    float c = 1 - cosTheta;
-                    float Rtheta = R0 + (1 - R0) * (c * c * c * c * c);
-
-                    if (Random_nextFloat(random) < Rtheta) {
-                        ray.origin = hitPoint;
-                        ray.direction = _Material_specularReflection(record, sample, ray, random);
-                        ray.origin += ray.direction * OFFSET;
-                        ray.currentMaterial = ray.prevMaterial;
-                        ray.currentBlock = ray.prevBlock;
-                    } else {
-                        throughput *= Material_translucentTransmission(sample, pAbsorb, transmissivityCap, fancierTranslucency);
-                        ray.origin = hitPoint;
-                        if (doRefraction) {
-                            ray.direction = Material_refractDirection(record, ray, n1, n2);
-                        }
-                        ray.origin += ray.direction * OFFSET;
-                    }
-                }
-            } else {
-                throughput *= Material_translucentTransmission(sample, pAbsorb, transmissivityCap, fancierTranslucency);
-                ray.origin = hitPoint + ray.direction * OFFSET;
-            }
-
-            if (!didSpecularBounce) {
-                ray.flags |= RAY_INDIRECT;
+            DirectLightRequest light;
+            PathTracer_scatter(scene, settings, sun, &ray, record, sample, depth, &throughput, &color, &light, random);
+            if (light.flags != 0) {
+                color += PathTracer_directLight(scene, atlas, sun, settings, light, random);
             }
         } else {
-            intersectSky(skyTexture, *skyIntensity, sun, textureAtlas, ray, &sample);
-            throughput *= sample.color.xyz;
-            color += sample.emittance * throughput;
+            PathTracer_miss(skyTexture, skyIntensity, sun, atlas, ray, &throughput, &color);
             break;
         }
     }
 
-    int spp = *bufferSpp;
+    return color;
+}
+
+__kernel void render(
+    __global const int* projectorType,
+    __global const float* cameraSettings,
+
+    SCENE_KERNEL_ARGS,
+
+    int randomSeed,
+    int bufferSpp,
+    int sampleOffset,
+    __global const int* canvasConfig,
+    __global const int* rayDepth,
+    __global const float* sceneSettings,
+    int emittersEnabled,
+    float emitterIntensity,
+    int emitterSamplingStrategy,
+    int preventNormalEmitterWithSampling,
+    int samplesPerDispatch,
+    __global float* res,
+    int writeGuides,
+    __global float* guides
+) {
+    int gid = get_global_id(0);
+
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    Sun sun = Sun_new(sunData);
+    PathTracerSettings settings = PathTracerSettings_new(rayDepth, sceneSettings,
+            emittersEnabled, emitterIntensity, emitterSamplingStrategy, preventNormalEmitterWithSampling);
+
+    // Trace several samples per launch to amortize the host round trip of each dispatch
+    float3 color = (float3) (0.0f);
+    PathGuide guideSum = { (float3) (0.0f), (float3) (0.0f), 0.0f };
+    for (int i = 0; i < samplesPerDispatch; i++) {
+        RandomState randomState;
+        Random random = &randomState;
+        Random_seed(random, randomSeed, gid, i);
+        Sampler_init(random, (int) sceneSettings[7], gid, sampleOffset + i, 0);
+        Ray ray = ray_to_camera(projectorType, cameraSettings, canvasConfig, gid, random);
+
+        initialize_ray_medium(scene, &ray);
+        ray.flags = 0;
+
+        PathGuide guide;
+        color += PathTracer_trace(scene, textureAtlas, skyTexture, *skyIntensity, sun, settings, ray, random,
+                writeGuides ? &guide : NULL);
+        if (writeGuides) {
+            guideSum.albedo += guide.albedo;
+            guideSum.normal += guide.normal;
+            guideSum.distance += guide.distance;
+        }
+    }
+
+    int spp = bufferSpp;
     float3 bufferColor = vload3(gid, res);
-    bufferColor = (bufferColor * spp + color) / (spp + 1);
+    bufferColor = (bufferColor * spp + color) / (spp + samplesPerDispatch);
     vstore3(bufferColor, gid, res);
+
+    if (writeGuides) {
+        PathGuide_store(guides, gid, guideSum, spp, samplesPerDispatch);
+    }
 }
 
 __kernel void preview(
@@ -315,9 +478,11 @@ __kernel void preview(
     __global const float* cameraSettings,
 
     __global const int* octreeDepth,
-    __global const int* octreeData,
+    SHARDED_KERNEL_ARG(octreeData),
     __global const int* waterOctreeDepth,
-    __global const int* waterOctreeData,
+    SHARDED_KERNEL_ARG(waterOctreeData),
+    __global const int* columnHeights,
+    __global int* octreePageRequests,
 
     __global const int* bPalette,
     __global const int* quadModels,
@@ -326,7 +491,7 @@ __kernel void preview(
 
     __global const int* worldBvhData,
     __global const int* actorBvhData,
-    __global const int* bvhTrigs,
+    SHARDED_KERNEL_ARG(bvhTrigs),
 
     image2d_array_t textureAtlas,
     __global const int* matPalette,
@@ -357,21 +522,24 @@ __kernel void preview(
     }
 
     Scene scene;
+    OctreeStack octreeStack;
+    OctreeStack waterStack;
     scene.materialPalette = MaterialPalette_new(matPalette);
-    scene.octree = Octree_create(octreeData, *octreeDepth, 10);
-    scene.waterOctree = Octree_create(waterOctreeData, *waterOctreeDepth, 10);
-    scene.worldBvh = Bvh_new(worldBvhData, bvhTrigs, &scene.materialPalette);
-    scene.actorBvh = Bvh_new(actorBvhData, bvhTrigs, &scene.materialPalette);
+    int shardShift = octreeDepth[4];
+    scene.octree = Octree_create(ShardedBuffer_new(SHARDED_ARGS(octreeData), shardShift), octreeDepth, columnHeights, octreePageRequests, 10, 0, &octreeStack);
+    scene.waterOctree = Octree_create(ShardedBuffer_new(SHARDED_ARGS(waterOctreeData), shardShift), waterOctreeDepth, columnHeights, octreePageRequests, 10, 0, &waterStack);
+    scene.worldBvh = Bvh_new(worldBvhData, ShardedBuffer_new(SHARDED_ARGS(bvhTrigs), shardShift), &scene.materialPalette);
+    scene.actorBvh = Bvh_new(actorBvhData, ShardedBuffer_single(actorBvhData), &scene.materialPalette);
     scene.blockPalette = BlockPalette_new(bPalette, quadModels, aabbModels, waterModels, &scene.materialPalette);
     scene.biome = BiomeColors_new(biomeMeta, biomeGrid, biomeGrass, biomeFoliage, biomeDryFoliage, biomeWater);
-    scene.emitterGrid = EmitterGrid_new(bPalette, bPalette, bPalette, bPalette);
+    scene.emitterGrid = EmitterGrid_new(bPalette, bPalette, bPalette, bPalette, bPalette);
     scene.drawDepth = 256;
 
     Sun sun = Sun_new(sunData);
 
-    unsigned int randomState = 0;
+    RandomState randomState;
     Random random = &randomState;
-    Random_nextState(random);
+    Random_seed(random, 0, 0, 0);
 
     Ray ray = ray_to_camera(projectorType, cameraSettings, canvasConfig, gid, random);
 
@@ -383,7 +551,7 @@ __kernel void preview(
     ray.flags = RAY_PREVIEW;
 
     float3 color;
-    if (closestIntersect(scene, textureAtlas, ray, &record, &sample, &material)) {
+    if (closestIntersect(scene, textureAtlas, ray, &record, &sample, &material, random)) {
         float shading = dot(record.normal, (float3) (0.25, 0.866, 0.433));
         shading = fmax(0.3f, shading);
         color = sample.color.xyz * shading;
@@ -0,0 +1,125 @@
+// Persistent threads path tracer. Only enough work items to fill the device are launched. Each one
+// pulls pixels from a global job counter and traces one bounce per loop iteration, starting a new
+// camera path as soon as the current one terminates. This keeps lanes busy when the paths in a
+// work group have very different lengths.
+
+#include "kernel.h"
+#include "camera.h"
+#include "sky.h"
+
+__kernel void render_persistent(
+    __global const int* projectorType,
+    __global const float* cameraSettings,
+
+    SCENE_KERNEL_ARGS,
+
+    int randomSeed,
+    int bufferSpp,
+    int sampleOffset,
+    __global const int* canvasConfig,
+    __global const int* rayDepth,
+    __global const float* sceneSettings,
+    int emittersEnabled,
+    float emitterIntensity,
+    int emitterSamplingStrategy,
+    int preventNormalEmitterWithSampling,
+    int samplesPerDispatch,
+    int pixelCount,
+    __global int* jobCounter,
+    __global float* res,
+    int writeGuides,
+    __global float* guides
+) {
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    Sun sun = Sun_new(sunData);
+    PathTracerSettings settings = PathTracerSettings_new(rayDepth, sceneSettings,
+            emittersEnabled, emitterIntensity, emitterSamplingStrategy, preventNormalEmitterWithSampling);
+
+    RandomState randomState;
+    Random random = &randomState;
+
+    // Every sample of a pixel is traced by the same work item, so the pixel can be written without
+    // atomics once all of its samples are done.
+    int pixel = atomic_inc(jobCounter);
+    int sample = 0;
+    float3 pixelColor = (float3) (0.0f);
+    PathGuide guideSum = { (float3) (0.0f), (float3) (0.0f), 0.0f };
+
+    Ray ray;
+    float3 throughput = (float3) (0.0f);
+    float3 color = (float3) (0.0f);
+    PathGuide guide;
+    int depth = 0;
+    bool active = false;
+
+    while (pixel < pixelCount) {
+        if (!active) {
+            // Regenerate a camera path
+            Random_seed(random, randomSeed, pixel, sample);
+            Sampler_init(random, (int) sceneSettings[7], pixel, sampleOffset + sample, 0);
+            ray = ray_to_camera(projectorType, cameraSettings, canvasConfig, pixel, random);
+            initialize_ray_medium(scene, &ray);
+            ray.flags = 0;
+            throughput = (float3) (1.0f);
+            color = (float3) (0.0f);
+            guide = PathGuide_new();
+            depth = 0;
+            active = true;
+        }
+
+        // Trace a single bounce
+        Sampler_startBounce(random, depth);
+        if (depth < settings.rayDepth && PathTracer_russianRoulette(settings, depth, &throughput, random)) {
+            IntersectionRecord record = IntersectionRecord_new();
+            MaterialSample materialSample;
+            Material material;
+
+            if (closestIntersect(scene, textureAtlas, ray, &record, &materialSample, &material, random)) {
+                if (depth == 0) {
+                    guide.albedo = materialSample.color.xyz;
+                    guide.normal = record.normal;
+                    guide.distance = record.distance;
+                }
+
+                DirectLightRequest light;
+                PathTracer_scatter(scene, settings, sun, &ray, record, materialSample, depth, &throughput, &color, &light, random);
+                if (light.flags != 0) {
+                    color += PathTracer_directLight(scene, textureAtlas, sun, settings, light, random);
+                }
+                depth++;
+            } else {
+                PathTracer_miss(skyTexture, *skyIntensity, sun, textureAtlas, ray, &throughput, &color);
+                active = false;
+            }
+        } else {
+            active = false;
+        }
+
+        if (!active) {
+            pixelColor += color;
+            guideSum.albedo += guide.albedo;
+            guideSum.normal += guide.normal;
+            guideSum.distance += guide.distance;
+            sample++;
+
+            if (sample == samplesPerDispatch) {
+                int spp = bufferSpp;
+                float3 bufferColor = vload3(pixel, res);
+                bufferColor = (bufferColor * spp + pixelColor) / (spp + samplesPerDispatch);
+                vstore3(bufferColor, pixel, res);
+                if (writeGuides) {
+                    PathGuide_store(guides, pixel, guideSum, spp, samplesPerDispatch);
+                }
+
+                pixel = atomic_inc(jobCounter);
+                sample = 0;
+                pixelColor = (float3) (0.0f);
+                guideSum.albedo = (float3) (0.0f);
+                guideSum.normal = (float3) (0.0f);
+                guideSum.distance = 0.0f;
+            }
+        }
+    }
+}
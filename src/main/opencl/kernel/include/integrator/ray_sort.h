@@ -0,0 +1,167 @@
+// Coherence sorting for the wavefront ray queue. Secondary rays are reordered by a key built from
+// their direction octant, origin cell and the material they left, so neighbouring work items in the
+// extend kernel walk the same parts of the octree.
+//
+// The sort is a stable LSD radix sort over RAY_SORT_KEY_BITS bits, RAY_SORT_RADIX_BITS per pass.
+// Each pass runs three kernels:
+//   ray_sort_histogram -> digit counts per block, one work group of RAY_SORT_BLOCK items per block
+//   ray_sort_scan      -> exclusive prefix of the digit major histogram in a single work group, which
+//                         gives the output offset of every digit of every block
+//   ray_sort_scatter   -> stable scatter of each block to its digit offsets, ranked in local memory
+// The pass kernels sort any int keys with int values (see RadixSorter.java), the actor BVH build
+// sorts its Morton codes with them.
+
+#define RAY_SORT_BLOCK 256
+#define RAY_SORT_SCAN_SIZE 256
+#define RAY_SORT_RADIX_BITS 4
+#define RAY_SORT_RADIX (1 << RAY_SORT_RADIX_BITS)
+#define RAY_SORT_KEY_BITS 24
+
+// Origin cell size in blocks
+#define RAY_SORT_CELL_SIZE 16.0f
+
+/**
+ * Sort key layout:
+ * 21-23: direction octant
+ * 9-20: hashed origin cell
+ * 0-8: material the ray left
+ */
+int RaySort_key(Ray ray, int material) {
+    int octant = (ray.direction.x < 0 ? 1 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 4 : 0);
+
+    int3 cell = convert_int3(floor(ray.origin / RAY_SORT_CELL_SIZE));
+    unsigned int cellHash = (cell.x * 73856093u) ^ (cell.y * 19349663u) ^ (cell.z * 83492791u);
+
+    return (octant << 21) | ((cellHash & 0xFFF) << 9) | (material & 0x1FF);
+}
+
+__kernel void ray_sort_keys(
+    __global const int* paths,
+    __global const int* hits,
+    __global const int* queue,
+    int count,
+    __global int* keys
+) {
+    int index = get_global_id(0);
+    if (index >= count) return;
+    int pathIndex = queue[index];
+
+    Ray ray = Wavefront_loadRay(paths, pathIndex * WAVEFRONT_PATH_SIZE);
+    int material = hits[pathIndex * WAVEFRONT_HIT_SIZE + 1];
+    keys[index] = RaySort_key(ray, material);
+}
+
+int RaySort_digit(int key, int shift) {
+    return (key >> shift) & (RAY_SORT_RADIX - 1);
+}
+
+// One work item per element, RAY_SORT_BLOCK items per work group.
+__kernel void ray_sort_histogram(
+    __global const int* keys,
+    int count,
+    int shift,
+    __global int* histogram
+) {
+    __local int counts[RAY_SORT_RADIX];
+    int index = get_global_id(0);
+    int lid = get_local_id(0);
+    int block = get_group_id(0);
+    int blocks = (count + RAY_SORT_BLOCK - 1) / RAY_SORT_BLOCK;
+
+    if (lid < RAY_SORT_RADIX) counts[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (index < count) {
+        atomic_inc(&counts[RaySort_digit(keys[index], shift)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid < RAY_SORT_RADIX) {
+        histogram[lid * blocks + block] = counts[lid];
+    }
+}
+
+// A single work group of RAY_SORT_SCAN_SIZE items. Every item sums a contiguous chunk of the
+// histogram, the chunk sums are scanned in local memory, then every item writes the exclusive
+// prefix of its chunk.
+__kernel void ray_sort_scan(
+    int count,
+    __global int* histogram
+) {
+    __local int sums[RAY_SORT_SCAN_SIZE];
+    int lid = get_local_id(0);
+    int size = RAY_SORT_RADIX * ((count + RAY_SORT_BLOCK - 1) / RAY_SORT_BLOCK);
+    int chunk = (size + RAY_SORT_SCAN_SIZE - 1) / RAY_SORT_SCAN_SIZE;
+    int start = min(size, lid * chunk);
+    int end = min(size, start + chunk);
+
+    int sum = 0;
+    for (int i = start; i < end; i++) {
+        sum += histogram[i];
+    }
+    sums[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Inclusive Hillis-Steele scan of the chunk sums
+    for (int offset = 1; offset < RAY_SORT_SCAN_SIZE; offset <<= 1) {
+        int value = lid >= offset ? sums[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        sums[lid] += value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    int prefix = sums[lid] - sum;
+    for (int i = start; i < end; i++) {
+        int value = histogram[i];
+        histogram[i] = prefix;
+        prefix += value;
+    }
+}
+
+// One work item per element, RAY_SORT_BLOCK items per work group. The rank of an element among the
+// elements of its block with the same digit comes from a scan of one-hot digit counters, packed as
+// 16 8-bit counters in a uint4. Exclusive counts stay below RAY_SORT_BLOCK, so they never carry.
+__kernel void ray_sort_scatter(
+    __global const int* keys,
+    __global const int* values,
+    int count,
+    int shift,
+    __global const int* histogram,
+    __global int* keysOut,
+    __global int* valuesOut
+) {
+    __local uint4 ranks[RAY_SORT_BLOCK];
+    int index = get_global_id(0);
+    int lid = get_local_id(0);
+    int block = get_group_id(0);
+    int blocks = (count + RAY_SORT_BLOCK - 1) / RAY_SORT_BLOCK;
+
+    int key = index < count ? keys[index] : 0;
+    int digit = RaySort_digit(key, shift);
+    uint4 own = (uint4) (0);
+    if (index < count) {
+        uint bit = 1u << ((digit & 3) * 8);
+        own = (uint4) (digit >> 2 == 0 ? bit : 0, digit >> 2 == 1 ? bit : 0,
+                       digit >> 2 == 2 ? bit : 0, digit >> 2 == 3 ? bit : 0);
+    }
+    ranks[lid] = own;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int offset = 1; offset < RAY_SORT_BLOCK; offset <<= 1) {
+        uint4 value = lid >= offset ? ranks[lid - offset] : (uint4) (0);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        ranks[lid] += value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (index >= count) return;
+    // The inclusive sum of the last item may carry out of its counter, subtracting first is exact
+    uint4 exclusive = ranks[lid] - own;
+    uint packed = digit >> 2 == 0 ? exclusive.x : digit >> 2 == 1 ? exclusive.y :
+                  digit >> 2 == 2 ? exclusive.z : exclusive.w;
+    int rank = (packed >> ((digit & 3) * 8)) & 0xFF;
+
+    int offset = histogram[digit * blocks + block] + rank;
+    keysOut[offset] = key;
+    valuesOut[offset] = values[index];
+}
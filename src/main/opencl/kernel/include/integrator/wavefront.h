@@ -0,0 +1,400 @@
+// Wavefront path tracing pipeline. Instead of tracing a whole path per work item, every bounce is
+// split into separate kernels that communicate through path state buffers and compacted queues:
+//
+//   wavefront_generate   -> camera rays for every pixel, fills the ray queue
+//   wavefront_extend     -> closest hit for each queued ray, misses are terminated here
+//   wavefront_shade      -> scatter at each hit, queues the continuation and shadow rays
+//   wavefront_connect    -> trace the queued shadow rays
+//   wavefront_accumulate -> merge the finished paths into the pass buffer
+//
+// Queues are arrays of path indices with an atomic size counter. The host resets the counters and
+// swaps the ray queues between bounces.
+
+#include "kernel.h"
+#include "camera.h"
+#include "material.h"
+#include "sky.h"
+
+#define WAVEFRONT_RAY_SIZE 11
+#define WAVEFRONT_PATH_SIZE 23
+#define WAVEFRONT_HIT_SIZE 16
+#define WAVEFRONT_LIGHT_SIZE 24
+
+typedef struct {
+    Ray ray;
+    float3 throughput;
+    float3 color;
+    RandomState randomState;
+    int depth;
+    int pixel;
+} PathState;
+
+float3 Wavefront_loadFloat3(__global const int* data, int offset) {
+    return (float3) (as_float(data[offset]), as_float(data[offset + 1]), as_float(data[offset + 2]));
+}
+
+void Wavefront_storeFloat3(__global int* data, int offset, float3 value) {
+    data[offset + 0] = as_int(value.x);
+    data[offset + 1] = as_int(value.y);
+    data[offset + 2] = as_int(value.z);
+}
+
+/**
+ * Rays are stored in 11 ints:
+ * 0-2: origin
+ * 3-5: direction
+ * 6: previous material
+ * 7: current material
+ * 8: previous block
+ * 9: current block
+ * 10: flags
+ */
+Ray Wavefront_loadRay(__global const int* data, int offset) {
+    Ray ray;
+    ray.origin = Wavefront_loadFloat3(data, offset + 0);
+    ray.direction = Wavefront_loadFloat3(data, offset + 3);
+    ray.prevMaterial = data[offset + 6];
+    ray.currentMaterial = data[offset + 7];
+    ray.prevBlock = data[offset + 8];
+    ray.currentBlock = data[offset + 9];
+    ray.flags = data[offset + 10];
+    return ray;
+}
+
+void Wavefront_storeRay(__global int* data, int offset, Ray ray) {
+    Wavefront_storeFloat3(data, offset + 0, ray.origin);
+    Wavefront_storeFloat3(data, offset + 3, ray.direction);
+    data[offset + 6] = ray.prevMaterial;
+    data[offset + 7] = ray.currentMaterial;
+    data[offset + 8] = ray.prevBlock;
+    data[offset + 9] = ray.currentBlock;
+    data[offset + 10] = ray.flags;
+}
+
+/**
+ * Paths are stored in 23 ints:
+ * 0-10: ray
+ * 11-13: throughput
+ * 14-16: accumulated color
+ * 17: random state
+ * 18: sample index
+ * 19: sampler scramble
+ * 20: sampler dimension
+ * 21: depth
+ * 22: pixel index
+ */
+PathState PathState_load(__global const int* paths, int index) {
+    int offset = index * WAVEFRONT_PATH_SIZE;
+    PathState path;
+    path.ray = Wavefront_loadRay(paths, offset);
+    path.throughput = Wavefront_loadFloat3(paths, offset + 11);
+    path.color = Wavefront_loadFloat3(paths, offset + 14);
+    path.randomState.state = paths[offset + 17];
+    path.randomState.index = paths[offset + 18];
+    path.randomState.scramble = paths[offset + 19];
+    path.randomState.dimension = paths[offset + 20];
+    path.depth = paths[offset + 21];
+    path.pixel = paths[offset + 22];
+    return path;
+}
+
+void PathState_store(__global int* paths, int index, PathState path) {
+    int offset = index * WAVEFRONT_PATH_SIZE;
+    Wavefront_storeRay(paths, offset, path.ray);
+    Wavefront_storeFloat3(paths, offset + 11, path.throughput);
+    Wavefront_storeFloat3(paths, offset + 14, path.color);
+    paths[offset + 17] = path.randomState.state;
+    paths[offset + 18] = path.randomState.index;
+    paths[offset + 19] = path.randomState.scramble;
+    paths[offset + 20] = path.randomState.dimension;
+    paths[offset + 21] = path.depth;
+    paths[offset + 22] = path.pixel;
+}
+
+float3 PathState_loadColor(__global const int* paths, int index) {
+    return Wavefront_loadFloat3(paths, index * WAVEFRONT_PATH_SIZE + 14);
+}
+
+void PathState_storeColor(__global int* paths, int index, float3 color) {
+    Wavefront_storeFloat3(paths, index * WAVEFRONT_PATH_SIZE + 14, color);
+}
+
+/**
+ * Hits are stored in 16 ints:
+ * 0: distance
+ * 1: material
+ * 2: block
+ * 3-5: normal
+ * 6-7: texture coordinate
+ * 8-11: sample color
+ * 12: sample emittance
+ * 13: sample specular
+ * 14: sample metalness
+ * 15: sample roughness
+ */
+void Hit_load(__global const int* hits, int index, IntersectionRecord* record, MaterialSample* sample) {
+    int offset = index * WAVEFRONT_HIT_SIZE;
+    record->distance = as_float(hits[offset + 0]);
+    record->material = hits[offset + 1];
+    record->block = hits[offset + 2];
+    record->normal = Wavefront_loadFloat3(hits, offset + 3);
+    record->texCoord = (float2) (as_float(hits[offset + 6]), as_float(hits[offset + 7]));
+    sample->color.xyz = Wavefront_loadFloat3(hits, offset + 8);
+    sample->color.w = as_float(hits[offset + 11]);
+    sample->emittance = as_float(hits[offset + 12]);
+    sample->specular = as_float(hits[offset + 13]);
+    sample->metalness = as_float(hits[offset + 14]);
+    sample->roughness = as_float(hits[offset + 15]);
+}
+
+void Hit_store(__global int* hits, int index, IntersectionRecord record, MaterialSample sample) {
+    int offset = index * WAVEFRONT_HIT_SIZE;
+    hits[offset + 0] = as_int(record.distance);
+    hits[offset + 1] = record.material;
+    hits[offset + 2] = record.block;
+    Wavefront_storeFloat3(hits, offset + 3, record.normal);
+    hits[offset + 6] = as_int(record.texCoord.x);
+    hits[offset + 7] = as_int(record.texCoord.y);
+    Wavefront_storeFloat3(hits, offset + 8, sample.color.xyz);
+    hits[offset + 11] = as_int(sample.color.w);
+    hits[offset + 12] = as_int(sample.emittance);
+    hits[offset + 13] = as_int(sample.specular);
+    hits[offset + 14] = as_int(sample.metalness);
+    hits[offset + 15] = as_int(sample.roughness);
+}
+
+/**
+ * Direct light requests are stored in 24 ints:
+ * 0: flags
+ * 1-3: hit point
+ * 4-6: shading normal
+ * 7-9: weight
+ * 10: sun multiplier
+ * 11-21: sun ray
+ */
+DirectLightRequest DirectLightRequest_load(__global const int* lights, int index) {
+    int offset = index * WAVEFRONT_LIGHT_SIZE;
+    DirectLightRequest light;
+    light.flags = lights[offset + 0];
+    light.hitPoint = Wavefront_loadFloat3(lights, offset + 1);
+    light.normal = Wavefront_loadFloat3(lights, offset + 4);
+    light.weight = Wavefront_loadFloat3(lights, offset + 7);
+    light.sunMult = as_float(lights[offset + 10]);
+    light.sunRay = Wavefront_loadRay(lights, offset + 11);
+    return light;
+}
+
+void DirectLightRequest_store(__global int* lights, int index, DirectLightRequest light) {
+    int offset = index * WAVEFRONT_LIGHT_SIZE;
+    lights[offset + 0] = light.flags;
+    Wavefront_storeFloat3(lights, offset + 1, light.hitPoint);
+    Wavefront_storeFloat3(lights, offset + 4, light.normal);
+    Wavefront_storeFloat3(lights, offset + 7, light.weight);
+    lights[offset + 10] = as_int(light.sunMult);
+    if (light.flags & LIGHT_SAMPLE_SUN) {
+        Wavefront_storeRay(lights, offset + 11, light.sunRay);
+    }
+}
+
+void Queue_push(__global int* queue, __global int* queueSize, int value) {
+    queue[atomic_inc(queueSize)] = value;
+}
+
+__kernel void wavefront_generate(
+    __global const int* projectorType,
+    __global const float* cameraSettings,
+
+    SCENE_KERNEL_ARGS,
+
+    __global const int* canvasConfig,
+    __global const float* sceneSettings,
+    int randomSeed,
+    int sampleOffset,
+    int sampleIndex,
+    int pathCount,
+    __global int* paths,
+    __global int* rayQueue
+) {
+    int gid = get_global_id(0);
+    if (gid >= pathCount) return;
+
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    PathState path;
+    Random random = &path.randomState;
+    Random_seed(random, randomSeed, gid, sampleIndex);
+    Sampler_init(random, (int) sceneSettings[7], gid, sampleOffset + sampleIndex, 0);
+
+    path.ray = ray_to_camera(projectorType, cameraSettings, canvasConfig, gid, random);
+    initialize_ray_medium(scene, &path.ray);
+    path.ray.flags = 0;
+    path.throughput = (float3) (1.0f);
+    path.color = (float3) (0.0f);
+    path.depth = 0;
+    path.pixel = gid;
+
+    PathState_store(paths, gid, path);
+
+    // Every path starts active, so the queue is already compact. The host sets the queue size.
+    rayQueue[gid] = gid;
+}
+
+__kernel void wavefront_extend(
+    SCENE_KERNEL_ARGS,
+
+    __global const float* sceneSettings,
+    int bufferSpp,
+    int sampleIndex,
+    int writeGuides,
+    __global float* guides,
+    __global int* paths,
+    __global int* hits,
+    __global const int* rayQueue,
+    __global const int* rayQueueSize,
+    __global int* hitQueue,
+    __global int* hitQueueSize
+) {
+    int index = get_global_id(0);
+    if (index >= *rayQueueSize) return;
+    int pathIndex = rayQueue[index];
+
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    PathState path = PathState_load(paths, pathIndex);
+
+    IntersectionRecord record = IntersectionRecord_new();
+    MaterialSample sample;
+    Material material;
+
+    bool hit = closestIntersect(scene, textureAtlas, path.ray, &record, &sample, &material, &path.randomState);
+    if (writeGuides && path.depth == 0) {
+        // The first extend of a path traces its camera ray
+        PathGuide guide = PathGuide_new();
+        if (hit) {
+            guide.albedo = sample.color.xyz;
+            guide.normal = record.normal;
+            guide.distance = record.distance;
+        }
+        PathGuide_store(guides, path.pixel, guide, bufferSpp + sampleIndex, 1);
+    }
+
+    if (hit) {
+        Hit_store(hits, pathIndex, record, sample);
+        Queue_push(hitQueue, hitQueueSize, pathIndex);
+    } else {
+        Sun sun = Sun_new(sunData);
+        PathTracer_miss(skyTexture, *skyIntensity, sun, textureAtlas, path.ray, &path.throughput, &path.color);
+        PathState_storeColor(paths, pathIndex, path.color);
+    }
+}
+
+__kernel void wavefront_shade(
+    SCENE_KERNEL_ARGS,
+
+    __global const int* rayDepth,
+    __global const float* sceneSettings,
+    int emittersEnabled,
+    float emitterIntensity,
+    int emitterSamplingStrategy,
+    int preventNormalEmitterWithSampling,
+    __global int* paths,
+    __global const int* hits,
+    __global int* lights,
+    __global const int* hitQueue,
+    __global const int* hitQueueSize,
+    __global int* shadowQueue,
+    __global int* shadowQueueSize,
+    __global int* nextRayQueue,
+    __global int* nextRayQueueSize
+) {
+    int index = get_global_id(0);
+    if (index >= *hitQueueSize) return;
+    int pathIndex = hitQueue[index];
+
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    Sun sun = Sun_new(sunData);
+    PathTracerSettings settings = PathTracerSettings_new(rayDepth, sceneSettings,
+            emittersEnabled, emitterIntensity, emitterSamplingStrategy, preventNormalEmitterWithSampling);
+
+    PathState path = PathState_load(paths, pathIndex);
+    Random random = &path.randomState;
+
+    IntersectionRecord record;
+    MaterialSample sample;
+    Hit_load(hits, pathIndex, &record, &sample);
+
+    DirectLightRequest light;
+    Sampler_startBounce(random, path.depth);
+    PathTracer_scatter(scene, settings, sun, &path.ray, record, sample, path.depth, &path.throughput, &path.color, &light, random);
+    if (light.flags != 0) {
+        DirectLightRequest_store(lights, pathIndex, light);
+        Queue_push(shadowQueue, shadowQueueSize, pathIndex);
+    }
+
+    // Russian roulette for the next bounce is decided here so dead paths never enter the ray queue.
+    path.depth += 1;
+    Sampler_startBounce(random, path.depth);
+    if (path.depth < settings.rayDepth && PathTracer_russianRoulette(settings, path.depth, &path.throughput, random)) {
+        Queue_push(nextRayQueue, nextRayQueueSize, pathIndex);
+    }
+
+    PathState_store(paths, pathIndex, path);
+}
+
+__kernel void wavefront_connect(
+    SCENE_KERNEL_ARGS,
+
+    __global const int* rayDepth,
+    __global const float* sceneSettings,
+    int emittersEnabled,
+    float emitterIntensity,
+    int emitterSamplingStrategy,
+    int preventNormalEmitterWithSampling,
+    __global int* paths,
+    __global const int* lights,
+    __global const int* shadowQueue,
+    __global const int* shadowQueueSize
+) {
+    int index = get_global_id(0);
+    if (index >= *shadowQueueSize) return;
+    int pathIndex = shadowQueue[index];
+
+    Scene scene;
+    SCENE_KERNEL_INIT(scene, (int) sceneSettings[6], sceneSettings[8]);
+
+    Sun sun = Sun_new(sunData);
+    PathTracerSettings settings = PathTracerSettings_new(rayDepth, sceneSettings,
+            emittersEnabled, emitterIntensity, emitterSamplingStrategy, preventNormalEmitterWithSampling);
+
+    PathState path = PathState_load(paths, pathIndex);
+    Random random = &path.randomState;
+
+    // The light was requested by the bounce before the one queued by the shade stage
+    Sampler_startBounce(random, path.depth - 1);
+    DirectLightRequest light = DirectLightRequest_load(lights, pathIndex);
+    path.color += PathTracer_directLight(scene, textureAtlas, sun, settings, light, random);
+
+    PathState_store(paths, pathIndex, path);
+}
+
+__kernel void wavefront_accumulate(
+    int bufferSpp,
+    int sampleIndex,
+    int pathCount,
+    __global const int* paths,
+    __global float* res
+) {
+    int gid = get_global_id(0);
+    if (gid >= pathCount) return;
+
+    PathState path = PathState_load(paths, gid);
+
+    int spp = bufferSpp + sampleIndex;
+    float3 bufferColor = vload3(path.pixel, res);
+    bufferColor = (bufferColor * spp + path.color) / (spp + 1);
+    vstore3(bufferColor, path.pixel, res);
+}
@@ -1,69 +1,67 @@
 #include "bvh.h"
 
-bool Bvh_intersect(Bvh self, image2d_array_t atlas, MaterialPalette palette, BiomeColors biome, Ray ray, IntersectionRecord* record, MaterialSample* sample) {
+// Closest hit below a node with triangle leaves.
+bool Bvh_intersectNode(Bvh self, int root, image2d_array_t atlas, MaterialPalette palette, BiomeColors biome, Ray ray, IntersectionRecord* record, MaterialSample* sample) {
     bool hit = false;
-    
+
+    int stack[BVH_STACK_SIZE];
+    float stackDist[BVH_STACK_SIZE];
     int toVisit = 0;
-    int currentNode = 0;
-    int nodesToVisit[64];
-    int node[7];
-    AABB box;
     float3 invDir = 1 / ray.direction;
+    Bvh_pushChildren(&self, root, ray.origin, invDir, record->distance, stack, stackDist, &toVisit);
+
+    while (toVisit > 0) {
+        toVisit--;
+        int ref = stack[toVisit];
+        if (stackDist[toVisit] > record->distance) {
+            // There's already been a closer intersection
+            continue;
+        }
+
+        if (ref > 0) {
+            Bvh_pushChildren(&self, ref, ray.origin, invDir, record->distance, stack, stackDist, &toVisit);
+            continue;
+        }
+
+        __global const int* leaf = ShardedBuffer_ptr(&self.trigs, -ref);
+        int numPrim = leaf[0];
+        for (int i = 0; i < numPrim; i++) {
+            hit |= Triangle_intersect(leaf, i, atlas, palette, ray, biome, record, sample);
+        }
+    }
 
-    while (true) {
-        node[0] = self.bvh[currentNode];
+    return hit;
+}
 
-        if (node[0] <= 0) {
-            // Is leaf
-            int primIndex = -node[0];
-            int numPrim = self.trigs[primIndex];
+bool Bvh_intersect(Bvh self, image2d_array_t atlas, MaterialPalette palette, BiomeColors biome, Ray ray, IntersectionRecord* record, MaterialSample* sample) {
+    if (!self.instanced) {
+        return Bvh_intersectNode(self, self.root, atlas, palette, biome, ray, record, sample);
+    }
 
-            for (int i = 0; i < numPrim; i++) {
-                Triangle trig = Triangle_new(self.trigs, primIndex + 1 + TRIANGLE_SIZE * i);
-                hit |= Triangle_intersect(trig, atlas, palette, ray, biome, record, sample);
-            }
+    bool hit = false;
 
-            if (toVisit == 0) break;
-            currentNode = nodesToVisit[--toVisit];
-        } else {
-            int offset = node[0];
-            for (int i = 0; i < 7; i++) {
-                node[i] = self.bvh[currentNode + 7 + i];
-            }
-            box = AABB_new(
-                as_float(node[1]), as_float(node[2]),
-                as_float(node[3]), as_float(node[4]),
-                as_float(node[5]), as_float(node[6])
-            );
-            float t1 = AABB_quick_intersect(box, ray.origin, invDir);
+    int stack[BVH_STACK_SIZE];
+    float stackDist[BVH_STACK_SIZE];
+    int toVisit = 0;
+    float3 invDir = 1 / ray.direction;
+    Bvh_pushChildren(&self, self.root, ray.origin, invDir, record->distance, stack, stackDist, &toVisit);
 
-            for (int i = 0; i < 7; i++) {
-                node[i] = self.bvh[offset + i];
-            }
-            box = AABB_new(
-                as_float(node[1]), as_float(node[2]),
-                as_float(node[3]), as_float(node[4]),
-                as_float(node[5]), as_float(node[6])
-            );
-            float t2 = AABB_quick_intersect(box, ray.origin, invDir);
+    while (toVisit > 0) {
+        toVisit--;
+        int ref = stack[toVisit];
+        if (stackDist[toVisit] > record->distance) {
+            continue;
+        }
 
-            if (isnan(t1) || t1 > record->distance) {
-                if (isnan(t2) || t2 > record->distance) {
-                    if (toVisit == 0) break;
-                    currentNode = nodesToVisit[--toVisit];
-                } else {
-                    currentNode = offset;
-                }
-            } else if (isnan(t2) || t2 > record->distance) {
-                currentNode += 7;
-            } else if (t1 < t2) {
-                nodesToVisit[toVisit++] = offset;
-                currentNode += 7;
-            } else {
-                nodesToVisit[toVisit++] = currentNode + 7;
-                currentNode = offset;
-            }
+        if (ref > 0) {
+            Bvh_pushChildren(&self, ref, ray.origin, invDir, record->distance, stack, stackDist, &toVisit);
+            continue;
         }
+
+        // The hit position is in model space, entity materials are never biome tinted
+        int root;
+        Ray instanceRay = Bvh_instanceRay(&self, -ref, ray, &root);
+        hit |= Bvh_intersectNode(self, root, atlas, palette, biome, instanceRay, record, sample);
     }
 
     return hit;
@@ -1,27 +1,36 @@
 #include "kernel.h"
 
-bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRecord* record, MaterialSample* sample, Material* mat) {
+bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRecord* record, MaterialSample* sample, Material* mat, Random random) {
     bool hit = false;
-    
-    // 1. 優先測試 Octree (通常是場景中最密集的物體)
-    if (Octree_octreeIntersect(self.octree, atlas, self.blockPalette, self.materialPalette, self.biome, self.drawDepth, ray, record, sample)) {
-        hit = true;
-    }
-    
-    // 2. 測試水面 Octree (只有在距離比目前撞到的更短時才有意義)
-    if (Octree_octreeIntersect(self.waterOctree, atlas, self.blockPalette, self.materialPalette, self.biome, self.drawDepth, ray, record, sample)) {
-        hit = true;
+
+    // Both octrees share the column heightmap, so one test skips both walks
+    if (!Octree_aboveGeometry(&self.octree, ray)) {
+        // 1. 優先測試 Octree (通常是場景中最密集的物體)
+        if (Octree_octreeIntersect(self.octree, atlas, self.blockPalette, self.materialPalette, self.biome, self.drawDepth, ray, record, sample, random)) {
+            hit = true;
+        }
+
+        // 2. 測試水面 Octree (只有在距離比目前撞到的更短時才有意義)
+#if FEATURE_WATER
+        if (Octree_octreeIntersect(self.waterOctree, atlas, self.blockPalette, self.materialPalette, self.biome, self.drawDepth, ray, record, sample, random)) {
+            hit = true;
+        }
+#endif
     }
 
     // 3. 測試 BVH (同樣只在更短的情況下更新 hit)
     // 注意：如果場景沒有實體，這部分會很快返回
+#if FEATURE_WORLD_BVH
     if (Bvh_intersect(self.worldBvh, atlas, self.materialPalette, self.biome, ray, record, sample)) {
         hit = true;
     }
-    
+#endif
+
+#if FEATURE_ACTOR_BVH
     if (Bvh_intersect(self.actorBvh, atlas, self.materialPalette, self.biome, ray, record, sample)) {
         hit = true;
     }
+#endif
 
     if (hit) {
         *mat = Material_get(self.materialPalette, record->material);
@@ -33,9 +42,11 @@ bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRe
 
 void initialize_ray_medium(Scene scene, Ray* ray) {
     int3 blockPos = intFloorFloat3(ray->origin);
-    int block = Octree_get(&scene.octree, blockPos.x, blockPos.y, blockPos.z);
+    int2 blocks = Octree_leafBlocks(&scene.octree, Octree_get(&scene.octree, blockPos.x, blockPos.y, blockPos.z));
+    int block = blocks.x;
     if (block == 0) {
-        int waterBlock = Octree_get(&scene.waterOctree, blockPos.x, blockPos.y, blockPos.z);
+        // Water is either merged into the world octree or in its own octree
+        int waterBlock = blocks.y != 0 ? blocks.y : Octree_get(&scene.waterOctree, blockPos.x, blockPos.y, blockPos.z);
         if (waterBlock != 0) {
             int waterMaterial = BlockPalette_primaryMaterial(scene.blockPalette, waterBlock);
             Material waterMat = Material_get(scene.materialPalette, waterMaterial);
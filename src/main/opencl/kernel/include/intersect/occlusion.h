@@ -0,0 +1,336 @@
+// Any-hit occlusion queries for shadow and emitter rays. Unlike closestIntersect these only need
+// the transmittance along the ray, so:
+//  * sun queries stop at the first opaque surface, and skip the color work of opaque texels
+//    (RAY_OCCLUSION_OPAQUE),
+//  * surfaces are sampled with RAY_OCCLUSION, which skips the emittance/specular lookups,
+//  * the octree walk continues after a translucent surface instead of restarting the whole scene
+//    query.
+// Surfaces multiply the transmittance, so each structure can be walked on its own. Medium changes
+// are only tracked within a structure, so strict direct light does not use these queries (see
+// getDirectLightAttenuation).
+
+#include "kernel.h"
+
+#define OCCLUSION_SUN 0
+#define OCCLUSION_EMITTER 1
+
+typedef struct {
+    int mode;
+    // Surfaces at or beyond this distance from the ray origin do not occlude
+    float maxDistance;
+    float transmissivityCap;
+    bool fancierTranslucency;
+} OcclusionQuery;
+
+OcclusionQuery OcclusionQuery_sun() {
+    OcclusionQuery query;
+    query.mode = OCCLUSION_SUN;
+    query.maxDistance = HUGE_VALF;
+    query.transmissivityCap = 1.0f;
+    query.fancierTranslucency = false;
+    return query;
+}
+
+OcclusionQuery OcclusionQuery_emitter(float maxDistance, float transmissivityCap, bool fancierTranslucency) {
+    OcclusionQuery query;
+    query.mode = OCCLUSION_EMITTER;
+    query.maxDistance = maxDistance;
+    query.transmissivityCap = transmissivityCap;
+    query.fancierTranslucency = fancierTranslucency;
+    return query;
+}
+
+// Attenuate by a surface the ray passes through, the same way as the closestIntersect loops did.
+// The ray medium must already be updated to the surface material. Returns false once the ray is
+// fully blocked.
+bool Occlusion_attenuate(OcclusionQuery query, MaterialPalette palette, Ray ray, MaterialSample sample, float4* attenuation) {
+    if (query.mode == OCCLUSION_SUN) {
+        if (sample.color.w >= 1.0f) {
+            return false;
+        }
+        float mult = 1.0f - sample.color.w;
+        attenuation->xyz *= sample.color.xyz * sample.color.w + mult;
+        attenuation->w *= mult;
+        return attenuation->w > 0.0f;
+    } else {
+        // Opaque surfaces do not stop emitter light, it is only attenuated by their transmission
+        Material material = Material_get(palette, ray.currentMaterial);
+        float3 transmittance = Material_translucentTransmission(
+                sample,
+                sample.color.w,
+                query.transmissivityCap,
+                query.fancierTranslucency
+        );
+        if (Material_isRefractive(material) && !Material_isOpaque(material) && sample.color.w > EPS) {
+            float colorAvg = (sample.color.x + sample.color.y + sample.color.z) / 3.0f;
+            if (colorAvg > EPS) {
+                float3 tintBoost = clamp(sample.color.xyz / colorAvg, (float3)(0.0f), (float3)(4.0f));
+                float tintMix = clamp(sample.color.w * 2.25f, 0.0f, 1.0f);
+                transmittance *= mix((float3)(1.0f), tintBoost, tintMix);
+            }
+        }
+        attenuation->xyz *= transmittance;
+        return fmax(attenuation->x, fmax(attenuation->y, attenuation->z)) > 1.0e-3f;
+    }
+}
+
+void Occlusion_enterMedium(Ray* ray, IntersectionRecord record) {
+    ray->prevMaterial = ray->currentMaterial;
+    ray->prevBlock = ray->currentBlock;
+    ray->currentMaterial = record.material;
+    ray->currentBlock = record.block;
+}
+
+#if FEATURE_OCTREE_DDA
+// Occlusion with the integer cell walk, see Octree_ddaCell.
+bool Occlusion_octreeDda(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, OcclusionQuery query, Ray ray, float4* attenuation) {
+    float3 invD = 1 / ray.direction;
+    float selfHit = Octree_ddaSelfHitDistance(ray);
+
+    if (Octree_aboveGeometry(&self, ray)) {
+        return true;
+    }
+
+    // Distance of the ray origin from the query origin. The origin moves to each surface the ray
+    // passes through so the block intersection finds the next surface.
+    float traveled = 0;
+    float t = 0;
+    int3 bp;
+    if (AABB_inside(self.bounds, ray.origin)) {
+        bp = Octree_ddaCell(ray, 0);
+    } else {
+        t = AABB_quick_intersect(self.bounds, ray.origin, invD);
+        if (isnan(t) || t < 0) {
+            return true;
+        }
+        bp = clamp(Octree_ddaCell(ray, t), 0, (1 << self.depth) - 1);
+    }
+
+    for (int i = 0; i < drawDepth; i++) {
+        if (traveled + t >= query.maxDistance) {
+            return true;
+        }
+
+        int3 lv = bp >> self.depth;
+        if (lv.x != 0 || lv.y != 0 || lv.z != 0) {
+            return true;
+        }
+
+        int level;
+        int data = Octree_lookup(&self, bp, &level);
+
+        if (data != 0) {
+            IntersectionRecord record = IntersectionRecord_new();
+            MaterialSample sample;
+            int block = Octree_intersectLeaf(&self, atlas, palette, materialPalette, biome, data, bp, ray, &record, &sample);
+            if (block != 0) {
+                if (traveled + record.distance >= query.maxDistance) {
+                    return true;
+                }
+                bool sameMedium = ray.currentMaterial != 0 && record.material == ray.currentMaterial;
+                if (!sameMedium && (block != ray.currentBlock || record.distance > selfHit)) {
+                    Occlusion_enterMedium(&ray, record);
+                    if (!Occlusion_attenuate(query, materialPalette, ray, sample, attenuation)) {
+                        return false;
+                    }
+
+                    // Continue from the surface
+                    float advance = record.distance + OFFSET;
+                    ray.origin += ray.direction * advance;
+                    traveled += advance;
+                    t = 0;
+                    bp = Octree_ddaCell(ray, 0);
+                    selfHit = Octree_ddaSelfHitDistance(ray);
+                    continue;
+                }
+                // Skip the rest of this block
+                t = fmax(t, Octree_ddaStep(&self, ray, invD, &bp, 0, false));
+                continue;
+            }
+        }
+
+        t = fmax(t, Octree_ddaStep(&self, ray, invD, &bp, level, data == 0));
+    }
+    return true;
+}
+#endif
+
+// Walk an octree up to the query distance. Returns false if the ray is blocked.
+bool Occlusion_octree(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, OcclusionQuery query, Ray ray, float4* attenuation) {
+#if FEATURE_OCTREE_DDA
+    return Occlusion_octreeDda(self, atlas, palette, materialPalette, biome, drawDepth, query, ray, attenuation);
+#endif
+    float3 invD = 1 / ray.direction;
+    float rayOffset = Ray_dynamicOffset((float)(1 << self.virtualDepth));
+    float3 offsetD = ray.direction * rayOffset;
+    int depth = self.depth;
+
+    if (Octree_aboveGeometry(&self, ray)) {
+        return true;
+    }
+
+    // Distance of the ray origin from the query origin. The origin moves to each surface the ray
+    // passes through so the block intersection finds the next surface.
+    float traveled = 0;
+    float distMarch = 0;
+
+    if (!AABB_inside(self.bounds, ray.origin)) {
+        float dist = AABB_quick_intersect(self.bounds, ray.origin, invD);
+        if (isnan(dist) || dist < 0) {
+            return true;
+        }
+        distMarch += dist + rayOffset;
+    }
+
+    for (int i = 0; i < drawDepth; i++) {
+        if (traveled + distMarch >= query.maxDistance) {
+            return true;
+        }
+
+        float3 pos = ray.origin + ray.direction * distMarch;
+        int3 bp = intFloorFloat3(pos + offsetD);
+
+        int3 lv = bp >> depth;
+        if (lv.x != 0 || lv.y != 0 || lv.z != 0) {
+            return true;
+        }
+
+        int level;
+        int data = Octree_lookup(&self, bp, &level);
+        lv = bp >> level;
+
+        if (data != 0) {
+            IntersectionRecord record = IntersectionRecord_new();
+            MaterialSample sample;
+            int block = Octree_intersectLeaf(&self, atlas, palette, materialPalette, biome, data, bp, ray, &record, &sample);
+            if (block != 0) {
+                if (traveled + record.distance >= query.maxDistance) {
+                    return true;
+                }
+                if (ray.currentMaterial != 0 && record.material == ray.currentMaterial) {
+                    distMarch = fmax(distMarch, record.distance) + OFFSET;
+                    continue;
+                }
+                if (block != ray.currentBlock || record.distance > rayOffset * 4.0f) {
+                    Occlusion_enterMedium(&ray, record);
+                    if (!Occlusion_attenuate(query, materialPalette, ray, sample, attenuation)) {
+                        return false;
+                    }
+
+                    // Continue from the surface
+                    float advance = record.distance + OFFSET;
+                    ray.origin += ray.direction * advance;
+                    traveled += advance;
+                    distMarch = 0;
+                    continue;
+                }
+                distMarch = fmax(distMarch, record.distance) + rayOffset;
+                continue;
+            }
+        }
+
+        // Exit the current leaf
+        AABB box = AABB_new(lv.x << level, (lv.x + 1) << level,
+                            lv.y << level, (lv.y + 1) << level,
+                            lv.z << level, (lv.z + 1) << level);
+        float exit = AABB_exit(box, pos + offsetD, invD);
+        if (data == 0) {
+            // The empty space of the column may reach further than the leaf
+            exit = fmax(exit, Octree_columnExit(&self, bp, pos + offsetD, invD));
+        }
+        distMarch += exit + rayOffset;
+    }
+    return true;
+}
+
+// Test every triangle below a node within the query distance. Returns false if the ray is blocked.
+bool Occlusion_bvhNode(Bvh self, int root, image2d_array_t atlas, MaterialPalette palette, BiomeColors biome, OcclusionQuery query, Ray ray, float4* attenuation) {
+    int stack[BVH_STACK_SIZE];
+    float stackDist[BVH_STACK_SIZE];
+    int toVisit = 0;
+    float3 invDir = 1 / ray.direction;
+    Bvh_pushChildren(&self, root, ray.origin, invDir, query.maxDistance, stack, stackDist, &toVisit);
+
+    while (toVisit > 0) {
+        int ref = stack[--toVisit];
+        if (ref > 0) {
+            // Visit order does not matter for any-hit, only culling by distance
+            Bvh_pushChildren(&self, ref, ray.origin, invDir, query.maxDistance, stack, stackDist, &toVisit);
+            continue;
+        }
+
+        __global const int* leaf = ShardedBuffer_ptr(&self.trigs, -ref);
+        int numPrim = leaf[0];
+        for (int i = 0; i < numPrim; i++) {
+            IntersectionRecord record = IntersectionRecord_new();
+            record.distance = query.maxDistance;
+            MaterialSample sample;
+            if (Triangle_intersect(leaf, i, atlas, palette, ray, biome, &record, &sample)) {
+                // Triangle hits are unordered, so the medium is always the one the ray started in
+                Ray hitRay = ray;
+                Occlusion_enterMedium(&hitRay, record);
+                if (!Occlusion_attenuate(query, palette, hitRay, sample, attenuation)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool Occlusion_bvh(Bvh self, image2d_array_t atlas, MaterialPalette palette, BiomeColors biome, OcclusionQuery query, Ray ray, float4* attenuation) {
+    if (!self.instanced) {
+        return Occlusion_bvhNode(self, self.root, atlas, palette, biome, query, ray, attenuation);
+    }
+
+    int stack[BVH_STACK_SIZE];
+    float stackDist[BVH_STACK_SIZE];
+    int toVisit = 0;
+    float3 invDir = 1 / ray.direction;
+    Bvh_pushChildren(&self, self.root, ray.origin, invDir, query.maxDistance, stack, stackDist, &toVisit);
+
+    while (toVisit > 0) {
+        int ref = stack[--toVisit];
+        if (ref > 0) {
+            Bvh_pushChildren(&self, ref, ray.origin, invDir, query.maxDistance, stack, stackDist, &toVisit);
+            continue;
+        }
+
+        int root;
+        Ray instanceRay = Bvh_instanceRay(&self, -ref, ray, &root);
+        if (!Occlusion_bvhNode(self, root, atlas, palette, biome, query, instanceRay, attenuation)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Compute the transmittance along a ray. The world octree is tested first since it is the most
+// likely to block the ray.
+bool Scene_occlusion(Scene self, image2d_array_t atlas, OcclusionQuery query, Ray ray, float4* attenuation) {
+    ray.flags |= RAY_OCCLUSION;
+    if (query.mode == OCCLUSION_SUN) {
+        ray.flags |= RAY_OCCLUSION_OPAQUE;
+    }
+    if (!Occlusion_octree(self.octree, atlas, self.blockPalette, self.materialPalette, self.biome, self.drawDepth, query, ray, attenuation)) {
+        return false;
+    }
+#if FEATURE_WORLD_BVH
+    if (!Occlusion_bvh(self.worldBvh, atlas, self.materialPalette, self.biome, query, ray, attenuation)) {
+        return false;
+    }
+#endif
+#if FEATURE_ACTOR_BVH
+    if (!Occlusion_bvh(self.actorBvh, atlas, self.materialPalette, self.biome, query, ray, attenuation)) {
+        return false;
+    }
+#endif
+#if FEATURE_WATER
+    if (!Occlusion_octree(self.waterOctree, atlas, self.blockPalette, self.materialPalette, self.biome, self.drawDepth, query, ray, attenuation)) {
+        return false;
+    }
+#endif
+    return true;
+}
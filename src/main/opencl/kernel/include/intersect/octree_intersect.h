@@ -1,6 +1,72 @@
 #include "octree.h"
 
-bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, Ray ray, IntersectionRecord* record, MaterialSample* sample) {
+#if FEATURE_OCTREE_DDA
+// Closest hit with the integer cell walk, see Octree_ddaCell.
+bool Octree_octreeIntersectDda(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, Ray ray, IntersectionRecord* record, MaterialSample* sample, Random random) {
+    float3 invD = 1 / ray.direction;
+    float selfHit = Octree_ddaSelfHitDistance(ray);
+
+    if (Octree_aboveGeometry(&self, ray)) {
+        return false;
+    }
+
+    float t = 0;
+    int3 bp;
+    if (AABB_inside(self.bounds, ray.origin)) {
+        bp = Octree_ddaCell(ray, 0);
+    } else {
+        t = AABB_quick_intersect(self.bounds, ray.origin, invD);
+        if (isnan(t) || t < 0) {
+            return false;
+        }
+        bp = clamp(Octree_ddaCell(ray, t), 0, (1 << self.depth) - 1);
+    }
+
+    for (int i = 0; i < drawDepth; i++) {
+        if (t > record->distance) {
+            return false;
+        }
+
+        int3 lv = bp >> self.depth;
+        if (lv.x != 0 || lv.y != 0 || lv.z != 0) {
+            return false;
+        }
+
+        int level;
+        int data = Octree_lookupLod(&self, bp, Octree_lodLevel(&self, t), &level);
+
+        if (data < 0) {
+            // Far enough to stop at a node of the LOD levels
+            if (Octree_intersectLod(&self, atlas, palette, materialPalette, biome, -data, bp, level, ray, record, sample, random)) {
+                return true;
+            }
+        } else if (data != 0) {
+            IntersectionRecord tempRecord = *record;
+            MaterialSample tempSample;
+            int block = Octree_intersectLeaf(&self, atlas, palette, materialPalette, biome, data, bp, ray, &tempRecord, &tempSample);
+            if (block != 0) {
+                bool sameMedium = ray.currentMaterial != 0 && tempRecord.material == ray.currentMaterial;
+                if (!sameMedium && (block != ray.currentBlock || tempRecord.distance > selfHit)) {
+                    *record = tempRecord;
+                    *sample = tempSample;
+                    return true;
+                }
+                // Skip the rest of this block
+                t = fmax(t, Octree_ddaStep(&self, ray, invD, &bp, 0, false));
+                continue;
+            }
+        }
+
+        t = fmax(t, Octree_ddaStep(&self, ray, invD, &bp, level, data == 0));
+    }
+    return false;
+}
+#endif
+
+bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, Ray ray, IntersectionRecord* record, MaterialSample* sample, Random random) {
+#if FEATURE_OCTREE_DDA
+    return Octree_octreeIntersectDda(self, atlas, palette, materialPalette, biome, drawDepth, ray, record, sample, random);
+#endif
     float distMarch = 0;
 
     float3 invD = 1 / ray.direction;
@@ -10,6 +76,10 @@ bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette pal
 
     int depth = self.depth;
 
+    if (Octree_aboveGeometry(&self, ray)) {
+        return false;
+    }
+
     // Check if we are in bounds
         if (!AABB_inside(self.bounds, ray.origin)) {
             // Attempt to intersect with the octree
@@ -36,27 +106,27 @@ bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette pal
             return false;
         }
 
-        // Read the octree with depth
-        int level = depth;
-        int data = self.treeData[0];
-        while (data > 0) {
-            level--;
-            lv = 1 & (bp >> level);
-            data = self.treeData[data + ((lv.x << 2) | (lv.y << 1) | lv.z)];
-        }
-        data = -data;
+        // Read the octree, starting from the common ancestor with the last leaf
+        int level;
+        int data = Octree_lookupLod(&self, bp, Octree_lodLevel(&self, distMarch), &level);
         lv = bp >> level;
 
         // Get block data if there is an intersection
-        if (data != 0) {
+        if (data < 0) {
+            // Far enough to stop at a node of the LOD levels
+            if (Octree_intersectLod(&self, atlas, palette, materialPalette, biome, -data, bp, level, ray, record, sample, random)) {
+                return true;
+            }
+        } else if (data != 0) {
             IntersectionRecord tempRecord = *record;
             MaterialSample tempSample;
-            if (BlockPalette_intersectNormalizedBlock(palette, atlas, materialPalette, biome, data, bp, ray, &tempRecord, &tempSample)) {
+            int block = Octree_intersectLeaf(&self, atlas, palette, materialPalette, biome, data, bp, ray, &tempRecord, &tempSample);
+            if (block != 0) {
                 if (ray.currentMaterial != 0 && tempRecord.material == ray.currentMaterial) {
                     distMarch += tempRecord.distance + OFFSET;
                     continue;
                 }
-                if (data != ray.currentBlock || tempRecord.distance > rayOffset * 4.0f) {
+                if (block != ray.currentBlock || tempRecord.distance > rayOffset * 4.0f) {
                     *record = tempRecord;
                     *sample = tempSample;
                     return true;
@@ -70,7 +140,12 @@ bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette pal
         AABB box = AABB_new(lv.x << level, (lv.x + 1) << level,
                             lv.y << level, (lv.y + 1) << level,
                             lv.z << level, (lv.z + 1) << level);
-        distMarch += AABB_exit(box, pos + offsetD, invD) + rayOffset;
+        float exit = AABB_exit(box, pos + offsetD, invD);
+        if (data == 0) {
+            // The empty space of the column may reach further than the leaf
+            exit = fmax(exit, Octree_columnExit(&self, bp, pos + offsetD, invD));
+        }
+        distMarch += exit + rayOffset;
     }
     return false;
 }
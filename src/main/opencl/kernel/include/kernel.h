@@ -2,6 +2,7 @@
 #define CHUNKYCL_KERNEL_H
 
 #include "../opencl.h"
+#include "features.h"
 #include "rt.h"
 #include "octree.h"
 #include "block.h"
@@ -15,19 +16,22 @@ typedef struct {
     __global const int* cells;
     __global const int* indexes;
     __global const int* emitters;
+    __global const int* alias;
 } EmitterGrid;
 
 EmitterGrid EmitterGrid_new(
         __global const int* meta,
         __global const int* cells,
         __global const int* indexes,
-        __global const int* emitters
+        __global const int* emitters,
+        __global const int* alias
 ) {
     EmitterGrid g;
     g.meta = meta;
     g.cells = cells;
     g.indexes = indexes;
     g.emitters = emitters;
+    g.alias = alias;
     return g;
 }
 
@@ -78,6 +82,23 @@ int4 EmitterGrid_getEmitter(EmitterGrid self, int emitterIndex) {
     );
 }
 
+/**
+ * Sample a slot of a cell from its alias table. Alias entries are 3 ints parallel to the indexes:
+ * 0: acceptance threshold
+ * 1: alias slot
+ * 2: probability of selecting the slot
+ */
+int EmitterGrid_sampleAlias(EmitterGrid self, int start, int count, float u, float* pdf) {
+    float scaled = u * count;
+    int slot = min((int) scaled, count - 1);
+    int entry = (start + slot) * 3;
+    if (scaled - slot >= as_float(self.alias[entry])) {
+        slot = self.alias[entry + 1];
+    }
+    *pdf = as_float(self.alias[(start + slot) * 3 + 2]);
+    return start + slot;
+}
+
 typedef struct {
     Octree octree;
     Octree waterOctree;
@@ -90,7 +111,99 @@ typedef struct {
     int drawDepth;
 } Scene;
 
-bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRecord* record, MaterialSample* sample, Material* mat);
+// Scene buffers shared by every path tracing kernel. The host binds these in this order with
+// KernelBindings.bindScene().
+#define SCENE_KERNEL_ARGS \
+    __global const int* octreeDepth, \
+    SHARDED_KERNEL_ARG(octreeData), \
+    __global const int* waterOctreeDepth, \
+    SHARDED_KERNEL_ARG(waterOctreeData), \
+    __global const int* columnHeights, \
+    __global int* octreePageRequests, \
+    __global const int* bPalette, \
+    __global const int* quadModels, \
+    __global const int* aabbModels, \
+    __global const int* waterModels, \
+    __global const int* worldBvhData, \
+    __global const int* actorBvhData, \
+    SHARDED_KERNEL_ARG(bvhTrigs), \
+    image2d_array_t textureAtlas, \
+    __global const int* matPalette, \
+    __global const int* biomeMeta, \
+    __global const int* biomeGrid, \
+    __global const float* biomeGrass, \
+    __global const float* biomeFoliage, \
+    __global const float* biomeDryFoliage, \
+    __global const float* biomeWater, \
+    __global const int* emitterGridMeta, \
+    __global const int* emitterGridCells, \
+    __global const int* emitterGridIndexes, \
+    __global const int* emitterGridEmitters, \
+    __global const int* emitterGridAlias, \
+    image2d_t skyTexture, \
+    __global const float* skyIntensity, \
+    __global const int* sunData
+
+// Build the scene from the SCENE_KERNEL_ARGS kernel arguments. The scene must be initialized in
+// place since the palettes keep a pointer to the scene's material palette. The octree traversal
+// stacks are declared next to the scene and live as long as the kernel.
+#define SCENE_KERNEL_INIT(scene, virtualDepth, lodScale) \
+    OctreeStack scene##OctreeStack; \
+    OctreeStack scene##WaterStack; \
+    Scene_init(&(scene), &scene##OctreeStack, &scene##WaterStack, virtualDepth, lodScale, \
+    octreeDepth, SHARDED_ARGS(octreeData), waterOctreeDepth, SHARDED_ARGS(waterOctreeData), columnHeights, octreePageRequests, \
+    bPalette, quadModels, aabbModels, waterModels, \
+    worldBvhData, actorBvhData, SHARDED_ARGS(bvhTrigs), matPalette, \
+    biomeMeta, biomeGrid, biomeGrass, biomeFoliage, biomeDryFoliage, biomeWater, \
+    emitterGridMeta, emitterGridCells, emitterGridIndexes, emitterGridEmitters, emitterGridAlias)
+
+void Scene_init(
+        Scene* scene,
+        OctreeStack* octreeStack,
+        OctreeStack* waterStack,
+        int virtualDepth,
+        float lodScale,
+        __global const int* octreeDepth,
+        SHARDED_KERNEL_ARG(octreeData),
+        __global const int* waterOctreeDepth,
+        SHARDED_KERNEL_ARG(waterOctreeData),
+        __global const int* columnHeights,
+        __global int* octreePageRequests,
+        __global const int* bPalette,
+        __global const int* quadModels,
+        __global const int* aabbModels,
+        __global const int* waterModels,
+        __global const int* worldBvhData,
+        __global const int* actorBvhData,
+        SHARDED_KERNEL_ARG(bvhTrigs),
+        __global const int* matPalette,
+        __global const int* biomeMeta,
+        __global const int* biomeGrid,
+        __global const float* biomeGrass,
+        __global const float* biomeFoliage,
+        __global const float* biomeDryFoliage,
+        __global const float* biomeWater,
+        __global const int* emitterGridMeta,
+        __global const int* emitterGridCells,
+        __global const int* emitterGridIndexes,
+        __global const int* emitterGridEmitters,
+        __global const int* emitterGridAlias
+) {
+    scene->materialPalette = MaterialPalette_new(matPalette);
+    // Every sharded buffer of the scene has the same shard size
+    int shardShift = octreeDepth[4];
+    scene->octree = Octree_create(ShardedBuffer_new(SHARDED_ARGS(octreeData), shardShift), octreeDepth, columnHeights, octreePageRequests, virtualDepth, lodScale, octreeStack);
+    scene->waterOctree = Octree_create(ShardedBuffer_new(SHARDED_ARGS(waterOctreeData), shardShift), waterOctreeDepth, columnHeights, octreePageRequests, virtualDepth, lodScale, waterStack);
+    scene->worldBvh = Bvh_new(worldBvhData, ShardedBuffer_new(SHARDED_ARGS(bvhTrigs), shardShift), &scene->materialPalette);
+    // The actor BVH holds its own triangles, see bvh_build.h
+    scene->actorBvh = Bvh_new(actorBvhData, ShardedBuffer_single(actorBvhData), &scene->materialPalette);
+    scene->blockPalette = BlockPalette_new(bPalette, quadModels, aabbModels, waterModels, &scene->materialPalette);
+    scene->biome = BiomeColors_new(biomeMeta, biomeGrid, biomeGrass, biomeFoliage, biomeDryFoliage, biomeWater);
+    scene->emitterGrid = EmitterGrid_new(emitterGridMeta, emitterGridCells, emitterGridIndexes, emitterGridEmitters, emitterGridAlias);
+    scene->drawDepth = 256;
+}
+
+bool closestIntersect(Scene self, image2d_array_t atlas, Ray ray, IntersectionRecord* record, MaterialSample* sample, Material* mat, Random random);
 void initialize_ray_medium(Scene scene, Ray* ray);
 void intersectSky(image2d_t skyTexture, float skyIntensity, Sun sun, image2d_array_t atlas, Ray ray, MaterialSample* sample);
 
@@ -8,7 +8,7 @@
 #include "textureAtlas.h"
 #include "utils.h"
 #include "constants.h"
-#include "random.h"
+#include "sampler.h"
 #include "biome.h"
 
 typedef struct {
@@ -51,13 +51,13 @@ typedef struct {
     float roughness;
 } MaterialSample;
 
-bool Material_sample_mode(Material self, image2d_array_t atlas, float2 uv, bool allowTransparentHit, int3 worldPos, BiomeColors biome, MaterialSample* sample);
+bool Material_sample_mode(Material self, image2d_array_t atlas, float2 uv, bool allowTransparentHit, int rayFlags, int3 worldPos, BiomeColors biome, MaterialSample* sample);
 
 bool Material_sample(Material self, image2d_array_t atlas, float2 uv, int3 worldPos, BiomeColors biome, MaterialSample* sample) {
-    return Material_sample_mode(self, atlas, uv, false, worldPos, biome, sample);
+    return Material_sample_mode(self, atlas, uv, false, 0, worldPos, biome, sample);
 }
 
-bool Material_sample_mode(Material self, image2d_array_t atlas, float2 uv, bool allowTransparentHit, int3 worldPos, BiomeColors biome, MaterialSample* sample) {
+bool Material_sample_mode(Material self, image2d_array_t atlas, float2 uv, bool allowTransparentHit, int rayFlags, int3 worldPos, BiomeColors biome, MaterialSample* sample) {
     // Color
     float4 color;
     if (self.flags & 0b00001)
@@ -77,6 +77,17 @@ bool Material_sample_mode(Material self, image2d_array_t atlas, float2 uv, bool
         return false;
     }
 
+    // Occlusion rays only need the transmittance. Sun shadow rays are blocked by fully opaque texels
+    // regardless of color, emitter shadow rays are tinted by them.
+    bool occlusion = (rayFlags & RAY_OCCLUSION) != 0;
+    if ((rayFlags & RAY_OCCLUSION_OPAQUE) != 0 && sample->color.w >= 1.0f) {
+        sample->emittance = 0;
+        sample->specular = 0;
+        sample->metalness = 0;
+        sample->roughness = 0;
+        return true;
+    }
+
     // Tint
     switch (self.tint >> 24) {
         case 0xFF:
@@ -103,6 +114,14 @@ bool Material_sample_mode(Material self, image2d_array_t atlas, float2 uv, bool
         sample->color.w = fmin(1.0f, sample->color.w + 0.15f);
     }
 
+    if (occlusion) {
+        sample->emittance = 0;
+        sample->specular = 0;
+        sample->metalness = 0;
+        sample->roughness = 0;
+        return true;
+    }
+
     // (Normal) emittance
     if (self.flags & 0b00010)
         sample->emittance = Atlas_read_uv(uv.x, uv.y, self.normal_emittance, self.textureSize, atlas).w;
@@ -137,8 +156,9 @@ float Material_ior(Material self) {
 }
 
 float3 _Material_diffuseReflection(IntersectionRecord record, Random random) {
-    float x1 = Random_nextFloat(random);
-    float x2 = Random_nextFloat(random);
+    float2 u = Sampler_next2D(random, SAMPLER_BSDF);
+    float x1 = u.x;
+    float x2 = u.y;
     float r = sqrt(x1);
     float theta = 2 * M_PI_F * x2;
 
@@ -249,13 +269,13 @@ typedef struct {
 MaterialPdfSample Material_samplePdf(Material self, IntersectionRecord record, MaterialSample sample, Ray ray, Random random) {
     MaterialPdfSample out;
 
-    if (sample.metalness > 0 && sample.metalness > Random_nextFloat(random)) {
+    if (sample.metalness > 0 && sample.metalness > Sampler_next1D(random, SAMPLER_METAL)) {
         // Metal reflection
         out.direction = _Material_specularReflection(record, sample, ray, random);
         out.spectrum = sample.color.xyz;
         out.specular = true;
         return out;
-    } else if (sample.specular > 0 && sample.specular > Random_nextFloat(random)) {
+    } else if (sample.specular > 0 && sample.specular > Sampler_next1D(random, SAMPLER_SPECULAR)) {
         // Specular reflection
         out.direction = _Material_specularReflection(record, sample, ray, random);
         out.spectrum = 1;
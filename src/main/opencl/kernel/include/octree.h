@@ -7,6 +7,8 @@
 #include "primitives.h"
 #include "block.h"
 #include "utils.h"
+#include "sharded.h"
+#include "random.h"
 
 float Ray_dynamicOffset(float maxCoord) {
     if (maxCoord <= 0.0f) {
@@ -18,16 +20,88 @@ float Ray_dynamicOffset(float maxCoord) {
     return dyn < OFFSET ? OFFSET : dyn;
 }
 
+// Deepest octree the traversal stack can hold
+#define OCTREE_MAX_DEPTH 30
+
+// The depth buffer of an octree holds the depth, the tree data format, the offset of the merged
+// water pair table in the tree data or -1, the offset of the page table or -1, the shard shift of
+// the scene's sharded buffers, and the offset of the LOD levels or -1. The LOD footprint scale
+// depends on the camera and is passed by the render kernels, see Octree_create.
+
+// Tree data formats
+#define OCTREE_FORMAT_PACKED 0
+// 64-ary tree of 4x4x4 bricks (see BrickTree.java). Nodes are two ints of occupancy mask followed
+// by one int per occupied child: a positive child is a node index, anything else a negated leaf.
+#define OCTREE_FORMAT_BRICK 1
+// Packed top tree with leaves that refer to pages streamed in by the host (see ClOctreePager.java).
+// A page table entry is the index of the page root if the page is resident, or the negated leaf
+// standing in for the page minus one if it is not.
+#define OCTREE_FORMAT_PAGED 2
+
+// The 2x2x2 cells of the first octant of a brick
+#define BRICK_GROUP_MASK 0x330033UL
+
+// Leaf data at or above this value is an index into the pair table of a world octree with merged
+// water (see MergedOctree.java). Each pair is the world block and the water block of the leaf.
+#define OCTREE_MERGED_LEAF 0x40000000
+// Chunky's placeholder type, it has the merged leaf bit set but is a plain leaf
+#define OCTREE_ANY_TYPE 0x7FFFFFFE
+// Top tree leaf data with this flag (and not the merged leaf flag) is a page index
+#define OCTREE_PAGE_REF 0x20000000
+
+// Ancestors of the last visited leaf. A lookup only descends from the lowest common ancestor of the
+// last leaf and the new position instead of from the root. The stack only depends on positions, so
+// it stays valid across rays: the next bounce from a hit point starts in the leaf of the hit.
 typedef struct {
-    __global const int* treeData;
+    // Child offset of the ancestor at each level, from the leaf level + 1 up to the root
+    int nodes[OCTREE_MAX_DEPTH + 1];
+    int3 position;
+    // Level and data of the last leaf. Level is -1 before the first lookup.
+    int level;
+    int data;
+} OctreeStack;
+
+typedef struct {
+    ShardedBuffer treeData;
     AABB bounds;
     int depth;
     int virtualDepth;
+    int format;
+    int pairs;
+    int pageTable;
+    // Representative block and average color of every child group (see OctreeLod.java), and the
+    // footprint width at a distance of 1 in blocks, 0 to always use the leaves. Only packed trees
+    // have levels.
+    int lod;
+    float lodScale;
+    // Per page flags for the host: 1 if the page was used, 2 if it was not resident
+    __global int* pageRequests;
+    // Column heightmap (see ColumnHeightmap.java): column size shift, columns per axis, top of all
+    // geometry, then the bottom and top of the geometry in every column.
+    __global const int* columns;
+    OctreeStack* stack;
 } Octree;
 
-Octree Octree_create(__global const int* treeData, int depth, int virtualDepth) {
+Octree Octree_create(ShardedBuffer treeData, __global const int* header, __global const int* columns, __global int* pageRequests, int virtualDepth, float lodScale, OctreeStack* stack) {
+    int depth = header[0];
+    int format = header[1];
     Octree octree;
     octree.treeData = treeData;
+    octree.format = format;
+    octree.pairs = header[2];
+    octree.pageTable = header[3];
+    octree.lod = header[5];
+    octree.lodScale = lodScale;
+    octree.pageRequests = pageRequests;
+    octree.columns = columns;
+    octree.stack = stack;
+    if (format == OCTREE_FORMAT_BRICK) {
+        // The brick stack is indexed by brick level, the root is the first node
+        stack->nodes[(depth + 1) >> 1] = 0;
+    } else {
+        stack->nodes[depth] = ShardedBuffer_get(&treeData, 0);
+    }
+    stack->level = -1;
     octree.depth = depth;
     // virtualDepth 僅用於計算動態 Offset 以保證大座標下的精度
     octree.virtualDepth = max(depth, virtualDepth);
@@ -37,6 +111,158 @@ Octree Octree_create(__global const int* treeData, int depth, int virtualDepth)
     return octree;
 }
 
+// Find the leaf of a brick tree, starting from the node at the given brick level. Empty cells are
+// grown to the largest aligned empty box of the brick, using the mask only.
+int BrickTree_lookup(Octree* self, int3 bp, int brickLevel, int* level) {
+    OctreeStack* stack = self->stack;
+    int node = stack->nodes[brickLevel];
+    while (true) {
+        int shift = 2 * brickLevel - 2;
+        int3 c = (bp >> shift) & 3;
+        int bit = (c.x << 4) | (c.y << 2) | c.z;
+        ulong mask = (ulong) (uint) ShardedBuffer_get(&self->treeData, node)
+                | ((ulong) (uint) ShardedBuffer_get(&self->treeData, node + 1) << 32);
+
+        if (((mask >> bit) & 1) == 0) {
+            // Mask out the 2x2x2 group of the cell
+            bool groupEmpty = ((mask >> (bit & 42)) & BRICK_GROUP_MASK) == 0;
+            *level = groupEmpty ? shift + 1 : shift;
+            return 0;
+        }
+
+        int child = ShardedBuffer_get(&self->treeData, node + 2 + popcount(mask & ((1UL << bit) - 1)));
+        if (child <= 0) {
+            *level = shift;
+            return -child;
+        }
+        node = child;
+        brickLevel--;
+        stack->nodes[brickLevel] = node;
+    }
+}
+
+// Find the leaf containing a block inside the octree bounds, or stop at an interior node at
+// minLevel. Returns the leaf data, or the negated node index of an interior node, and sets the
+// level of the leaf or node.
+int Octree_lookupLod(Octree* self, int3 bp, int minLevel, int* level) {
+    OctreeStack* stack = self->stack;
+    int start = self->depth;
+    if (stack->level >= 0) {
+        // Every level above the highest differing bit is shared with the last leaf
+        int3 diff = bp ^ stack->position;
+        start = 32 - clz(diff.x | diff.y | diff.z);
+        if (start <= stack->level) {
+            if (stack->data >= 0 || minLevel >= stack->level) {
+                *level = stack->level;
+                return stack->data;
+            }
+            // Refine the interior node the last lookup stopped at
+            start = stack->level;
+        }
+    }
+
+    if (self->format == OCTREE_FORMAT_BRICK) {
+        // A brick node covers two octree levels
+        int data = BrickTree_lookup(self, bp, (start + 1) >> 1, level);
+        stack->position = bp;
+        stack->level = *level;
+        stack->data = data;
+        return data;
+    }
+
+    int l = start;
+    int data = stack->nodes[l];
+    while (true) {
+        while (data > 0 && l > minLevel) {
+            stack->nodes[l] = data;
+            l--;
+            int3 lv = 1 & (bp >> l);
+            data = ShardedBuffer_get(&self->treeData, data + ((lv.x << 2) | (lv.y << 1) | lv.z));
+        }
+        if (data > 0 || self->format != OCTREE_FORMAT_PAGED || ((-data) & (OCTREE_MERGED_LEAF | OCTREE_PAGE_REF)) != OCTREE_PAGE_REF) {
+            break;
+        }
+
+        // Continue in the page, or stop at its stand-in leaf if it is not resident
+        int page = -data - OCTREE_PAGE_REF;
+        int entry = ShardedBuffer_get(&self->treeData, self->pageTable + page);
+        if (entry >= 0) {
+            self->pageRequests[page] = 1;
+            data = ShardedBuffer_get(&self->treeData, entry);
+        } else {
+            self->pageRequests[page] = 2;
+            data = entry + 1;
+        }
+    }
+    if (data > 0) {
+        // Stopped above the leaves, keep the node so a finer lookup can continue from it
+        stack->nodes[l] = data;
+    }
+    stack->position = bp;
+    stack->level = l;
+    stack->data = -data;
+    *level = l;
+    return -data;
+}
+
+// Find the leaf containing a block inside the octree bounds. Returns the leaf data and sets the
+// level of the leaf.
+int Octree_lookup(Octree* self, int3 bp, int* level) {
+    return Octree_lookupLod(self, bp, -1, level);
+}
+
+// Level of the coarsest node a ray may stop at at distance t, or -1 for the leaves. A node may be
+// used once it is narrower than the footprint.
+int Octree_lodLevel(Octree* self, float t) {
+    if (self->lod < 0 || self->lodScale <= 0) {
+        return -1;
+    }
+    float footprint = t * self->lodScale;
+    return footprint >= 2 ? ilogb(footprint) : -1;
+}
+
+// Intersect an interior node as a box of its average color. The node is hit with a probability of
+// its coverage, so partly covered nodes converge to the right opacity. The material of the
+// representative block supplies the tint and surface properties.
+// The coverage test hashes the node with the state of the path's random stream, so it is
+// independent between samples and pixels. The Sobol sampler does not advance that state along the
+// path, so the first dimension of the bounce is mixed in as well to keep the choices of different
+// bounces independent. It does not advance the stream, kernels that only trace do not have to
+// store the path state back.
+bool Octree_intersectLod(Octree* self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int node, int3 bp, int level, Ray ray, IntersectionRecord* record, MaterialSample* sample, Random random) {
+    int offset = self->lod + 2 * (node >> 3);
+    int block = ShardedBuffer_get(&self->treeData, offset);
+    unsigned int color = ShardedBuffer_get(&self->treeData, offset + 1);
+    int material = BlockPalette_primaryMaterial(palette, block);
+    if (material == 0) {
+        return false;
+    }
+
+    unsigned int coverage = Random_hash(random->state ^ Random_hash(node ^ Random_hash(random->dimension)));
+    if ((coverage & 0xFF) >= (color >> 24)) {
+        return false;
+    }
+
+    int3 lo = (bp >> level) << level;
+    int size = 1 << level;
+    AABB box = AABB_new(lo.x, lo.x + size, lo.y, lo.y + size, lo.z, lo.z + size);
+    IntersectionRecord tempRecord = *record;
+    if (!AABB_full_intersect(box, ray, &tempRecord)) {
+        return false;
+    }
+
+    Material m = Material_get(materialPalette, material);
+    m.flags &= ~1u;
+    m.color = color | 0xFF000000;
+    if (!Material_sample(m, atlas, (float2) (0.5f, 0.5f), bp, biome, sample)) {
+        return false;
+    }
+    tempRecord.block = block;
+    tempRecord.material = material;
+    *record = tempRecord;
+    return true;
+}
+
 int Octree_get(Octree* self, int x, int y, int z) {
     int3 bp = (int3) (x, y, z);
 
@@ -45,16 +271,153 @@ int Octree_get(Octree* self, int x, int y, int z) {
     if ((rlv.x != 0) | (rlv.y != 0) | (rlv.z != 0))
         return 0;
 
-    int level = self->depth;
-    int data = self->treeData[0];
-    while (data > 0) {
-        level--;
-        int3 lv = 1 & (bp >> level);
-        data = self->treeData[data + ((lv.x << 2) | (lv.y << 1) | lv.z)];
+    int level;
+    return Octree_lookup(self, bp, &level);
+}
+
+// True if the ray starts above all geometry and does not go down.
+bool Octree_aboveGeometry(Octree* self, Ray ray) {
+    return ray.direction.y >= 0 && ray.origin.y >= self->columns[2];
+}
+
+// Find the empty space above or below the geometry of the column of a block as the cells [lo, hi).
+// Returns false if the block is within the geometry of its column.
+bool Octree_columnBox(Octree* self, int3 bp, int3* lo, int3* hi) {
+    int shift = self->columns[0];
+    int3 column = bp >> shift;
+    int index = 3 + 2 * (column.x * self->columns[1] + column.z);
+    int bottom = self->columns[index];
+    int top = self->columns[index + 1];
+    if (bp.y >= bottom && bp.y < top) {
+        return false;
     }
-    return -data;
+
+    bool above = bp.y >= top;
+    *lo = (int3) (column.x << shift, above ? top : 0, column.z << shift);
+    *hi = (int3) ((column.x + 1) << shift, above ? 1 << self->depth : bottom, (column.z + 1) << shift);
+    return true;
+}
+
+// Distance to exit the empty space above or below the geometry of the column of a block, or 0 if
+// the block is within the geometry of its column.
+float Octree_columnExit(Octree* self, int3 bp, float3 pos, float3 invD) {
+    int3 lo, hi;
+    if (!Octree_columnBox(self, bp, &lo, &hi)) {
+        return 0;
+    }
+    AABB box = AABB_new(lo.x, hi.x, lo.y, hi.y, lo.z, hi.z);
+    return AABB_exit(box, pos, invD);
+}
+
+// Integer cell walk (FEATURE_OCTREE_DDA). The walk keeps the integer coordinates of the current
+// cell and steps to the neighbouring cell through the exit face of each leaf, as in Amanatides-Woo
+// but with leaf sized steps. Distances are only used to order hits, so there are no ray offsets and
+// no cells are skipped or revisited at large coordinates.
+
+// Cell containing the ray at distance t. On a cell boundary it is the cell the ray moves into.
+int3 Octree_ddaCell(Ray ray, float t) {
+    float3 pos = ray.origin + ray.direction * t;
+    float3 cell = floor(pos);
+    int3 bp = intFloorFloat3(pos);
+    bp.x -= pos.x == cell.x && ray.direction.x < 0 ? 1 : 0;
+    bp.y -= pos.y == cell.y && ray.direction.y < 0 ? 1 : 0;
+    bp.z -= pos.z == cell.z && ray.direction.z < 0 ? 1 : 0;
+    return bp;
+}
+
+// Distance at which the ray leaves the cells [lo, hi), and the axis of the exit face.
+float Octree_ddaExit(Ray ray, float3 invD, int3 lo, int3 hi, int* axis) {
+    float3 plane = (float3) (invD.x >= 0 ? hi.x : lo.x,
+                             invD.y >= 0 ? hi.y : lo.y,
+                             invD.z >= 0 ? hi.z : lo.z);
+    float3 t = (plane - ray.origin) * invD;
+    // 0 * inf on an axis the ray does not move along
+    t = select(t, (float3) (INFINITY), isnan(t));
+    *axis = t.x <= t.y && t.x <= t.z ? 0 : (t.y <= t.z ? 1 : 2);
+    return fmin(t.x, fmin(t.y, t.z));
+}
+
+// Cell after leaving the cells [lo, hi) from bp at distance t through the face on the given axis.
+// The cell moves one step on the exit axis and never moves back on the others.
+int3 Octree_ddaNext(Ray ray, float t, int3 bp, int3 lo, int3 hi, int axis) {
+    float3 pos = ray.origin + ray.direction * t;
+    int3 next = clamp(intFloorFloat3(pos), lo, hi - 1);
+    next.x = ray.direction.x >= 0 ? max(next.x, bp.x) : min(next.x, bp.x);
+    next.y = ray.direction.y >= 0 ? max(next.y, bp.y) : min(next.y, bp.y);
+    next.z = ray.direction.z >= 0 ? max(next.z, bp.z) : min(next.z, bp.z);
+    if (axis == 0) next.x = ray.direction.x >= 0 ? hi.x : lo.x - 1;
+    if (axis == 1) next.y = ray.direction.y >= 0 ? hi.y : lo.y - 1;
+    if (axis == 2) next.z = ray.direction.z >= 0 ? hi.z : lo.z - 1;
+    return next;
+}
+
+// Step out of the leaf of a block, or out of the empty space of its column if that reaches further.
+// Returns the exit distance and moves bp to the next cell.
+float Octree_ddaStep(Octree* self, Ray ray, float3 invD, int3* bp, int level, bool empty) {
+    int3 lo = (*bp >> level) << level;
+    int3 hi = lo + (1 << level);
+    int axis;
+    float exit = Octree_ddaExit(ray, invD, lo, hi, &axis);
+
+    int3 columnLo, columnHi;
+    if (empty && Octree_columnBox(self, *bp, &columnLo, &columnHi)) {
+        int columnAxis;
+        float columnExit = Octree_ddaExit(ray, invD, columnLo, columnHi, &columnAxis);
+        if (columnExit > exit) {
+            exit = columnExit;
+            axis = columnAxis;
+            lo = columnLo;
+            hi = columnHi;
+        }
+    }
+
+    *bp = Octree_ddaNext(ray, exit, *bp, lo, hi, axis);
+    return exit;
+}
+
+// Distance below which a hit on the block the ray starts in is the surface the ray starts on.
+float Octree_ddaSelfHitDistance(Ray ray) {
+    float3 a = fabs(ray.origin);
+    return 4.0f * Ray_dynamicOffset(fmax(a.x, fmax(a.y, a.z)));
+}
+
+// Split leaf data into the world block and the merged water block, 0 if there is none.
+int2 Octree_leafBlocks(Octree* self, int data) {
+    if (self->pairs >= 0 && data >= OCTREE_MERGED_LEAF && data != OCTREE_ANY_TYPE) {
+        int offset = self->pairs + 2 * (data - OCTREE_MERGED_LEAF);
+        return (int2) (-ShardedBuffer_get(&self->treeData, offset), -ShardedBuffer_get(&self->treeData, offset + 1));
+    }
+    return (int2) (data, 0);
+}
+
+// Intersect the blocks of a leaf. Returns the closest block that was hit, or 0. A hit on the
+// medium the ray is in is only returned if no other block of the leaf is hit, so the same medium
+// skip of the callers never hides the other block of a merged leaf.
+int Octree_intersectLeaf(Octree* self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int data, int3 bp, Ray ray, IntersectionRecord* record, MaterialSample* sample) {
+    int2 blocks = Octree_leafBlocks(self, data);
+    IntersectionRecord start = *record;
+    int hitBlock = 0;
+    bool hitSameMedium = false;
+    for (int i = 0; i < 2; i++) {
+        int block = i == 0 ? blocks.x : blocks.y;
+        if (block == 0) continue;
+        IntersectionRecord tempRecord = start;
+        MaterialSample tempSample;
+        if (!BlockPalette_intersectNormalizedBlock(palette, atlas, materialPalette, biome, block, bp, ray, &tempRecord, &tempSample)) {
+            continue;
+        }
+        bool sameMedium = ray.currentMaterial != 0 && tempRecord.material == ray.currentMaterial;
+        if (hitBlock == 0 || (hitSameMedium && !sameMedium) ||
+                (hitSameMedium == sameMedium && tempRecord.distance < record->distance)) {
+            *record = tempRecord;
+            *sample = tempSample;
+            hitBlock = block;
+            hitSameMedium = sameMedium;
+        }
+    }
+    return hitBlock;
 }
 
-bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, Ray ray, IntersectionRecord* record, MaterialSample* sample);
+bool Octree_octreeIntersect(Octree self, image2d_array_t atlas, BlockPalette palette, MaterialPalette materialPalette, BiomeColors biome, int drawDepth, Ray ray, IntersectionRecord* record, MaterialSample* sample, Random random);
 
 #endif
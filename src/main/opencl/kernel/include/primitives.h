@@ -287,7 +287,7 @@ bool TexturedAABB_intersect(TexturedAABB self, image2d_array_t atlas, MaterialPa
     }
 
     Material material = Material_get(materialPalette, tempRecord.material);
-    if (Material_sample_mode(material, atlas, tempRecord.texCoord, false, blockPos, biome, sample)) {
+    if (Material_sample_mode(material, atlas, tempRecord.texCoord, false, ray.flags, blockPos, biome, sample)) {
         *record = tempRecord;
         return true;
     } else {
@@ -347,7 +347,7 @@ bool Quad_intersect(Quad self, image2d_array_t atlas, MaterialPalette materialPa
             if (u >= 0 && u <= 1 && v >= 0 && v <= 1) {
                 float2 texCoord = (float2) (self.uv.x + (u * self.uv.y), self.uv.z + (v * self.uv.w));
                 Material material = Material_get(materialPalette, self.material);
-                if (Material_sample_mode(material, atlas, texCoord, hitTransparent, blockPos, biome, sample)) {
+                if (Material_sample_mode(material, atlas, texCoord, hitTransparent, ray.flags, blockPos, biome, sample)) {
                     record->texCoord = texCoord;
                     record->normal = n;
                     record->distance = t;
@@ -361,59 +361,46 @@ bool Quad_intersect(Quad self, image2d_array_t atlas, MaterialPalette materialPa
     return false;
 }
 
-#define TRIANGLE_SIZE 20
+// Triangle leaves (see PackedTriangleModel.java) are split in a hot part read by every ray that
+// reaches the leaf and a cold part only read for hits:
+//   0: triangle count
+//   1: number of one sided triangles, these come first
+//   then the hot part of every triangle: three float4s with the origin, e1 and e2, and the
+//   geometric normal e1 x e2 in the w components
+//   then the cold part of every triangle: the shading normal, the three texture coordinates and
+//   the material
+#define TRIANGLE_LEAF_HEADER 2
+#define TRIANGLE_HOT_SIZE 12
+#define TRIANGLE_COLD_SIZE 10
+#define TRIANGLE_SIZE (TRIANGLE_HOT_SIZE + TRIANGLE_COLD_SIZE)
 
 typedef struct {
-    int flags;
+    float3 o;
     float3 e1;
     float3 e2;
-    float3 o;
-    float3 n;
-    float2 t1;
-    float2 t2;
-    float2 t3;
-    int material;
+    float3 ng;
 } Triangle;
 
-Triangle Triangle_new(__global const int* trigModels, int index) {
-    Triangle t;
-    t.flags = trigModels[index + 0];
-
-    t.e1.x = as_float(trigModels[index + 1]);
-    t.e1.y = as_float(trigModels[index + 2]);
-    t.e1.z = as_float(trigModels[index + 3]);
-
-    t.e2.x = as_float(trigModels[index + 4]);
-    t.e2.y = as_float(trigModels[index + 5]);
-    t.e2.z = as_float(trigModels[index + 6]);
+// Read the hot part of the i-th triangle of a leaf.
+Triangle Triangle_new(__global const int* leaf, int i) {
+    __global const float* hot = (__global const float*) (leaf + TRIANGLE_LEAF_HEADER + TRIANGLE_HOT_SIZE * i);
+    float4 a = vload4(0, hot);
+    float4 b = vload4(1, hot);
+    float4 c = vload4(2, hot);
 
-    t.o.x = as_float(trigModels[index + 7]);
-    t.o.y = as_float(trigModels[index + 8]);
-    t.o.z = as_float(trigModels[index + 9]);
-
-    t.n.x = as_float(trigModels[index + 10]);
-    t.n.y = as_float(trigModels[index + 11]);
-    t.n.z = as_float(trigModels[index + 12]);
-
-    t.t1.x = as_float(trigModels[index + 13]);
-    t.t1.y = as_float(trigModels[index + 14]);
-
-    t.t2.x = as_float(trigModels[index + 15]);
-    t.t2.y = as_float(trigModels[index + 16]);
-
-    t.t3.x = as_float(trigModels[index + 17]);
-    t.t3.y = as_float(trigModels[index + 18]);
-
-    t.material = trigModels[index + 19];
+    Triangle t;
+    t.o = a.xyz;
+    t.e1 = b.xyz;
+    t.e2 = c.xyz;
+    t.ng = (float3) (a.w, b.w, c.w);
     return t;
 }
 
-bool Triangle_intersect(Triangle self, image2d_array_t atlas, MaterialPalette materialPalette, Ray ray, BiomeColors biome, IntersectionRecord* record, MaterialSample* sample) {
-    float3 pvec, qvec, tvec;
-
-    pvec = cross(ray.direction, self.e2);
-    float det = dot(self.e1, pvec);
-    if ((self.flags >> 8) & 1) {
+// Moller-Trumbore with the precomputed normal, one cross product per triangle. Outputs the distance
+// and the barycentric coordinates of e1 and e2 of a hit closer than maxDistance.
+bool Triangle_hit(Triangle self, bool doubleSided, float3 origin, float3 direction, float maxDistance, float* t, float2* uv) {
+    float det = -dot(direction, self.ng);
+    if (doubleSided) {
         if (det > -EPS && det < EPS)
             return false;
     } else if (det > -EPS) {
@@ -421,41 +408,58 @@ bool Triangle_intersect(Triangle self, image2d_array_t atlas, MaterialPalette ma
     }
     float recip = 1 / det;
 
-    tvec = ray.origin - self.o;
-
-    float u = dot(tvec, pvec) * recip;
+    float3 tvec = origin - self.o;
+    float3 qvec = cross(tvec, direction);
 
+    float u = dot(self.e2, qvec) * recip;
     if (u < 0 || u > 1)
         return false;
 
-    qvec = cross(tvec, self.e1);
-
-    float v = dot(ray.direction, qvec) * recip;
-
+    float v = -dot(self.e1, qvec) * recip;
     if (v < 0 || (u+v) > 1)
         return false;
 
-    float t = dot(self.e2, qvec) * recip;
-
-    if (t > EPS && t < record->distance) {
-        float w = 1 - u - v;
-        float2 texCoord = (float2) (
-            self.t1.x * u + self.t2.x * v + self.t3.x * w,
-            self.t1.y * u + self.t2.y * v + self.t3.y * w
-        );
-
-        Material material = Material_get(materialPalette, self.material);
-        int3 worldPos = intFloorFloat3(ray.origin + ray.direction * t);
-        if (Material_sample_mode(material, atlas, texCoord, false, worldPos, biome, sample)) {
-            record->texCoord = texCoord;
-            record->normal = self.n;
-            record->material = self.material;
-            record->distance = t;
-            return true;
-        }
+    float dist = dot(tvec, self.ng) * recip;
+    if (dist > EPS && dist < maxDistance) {
+        *t = dist;
+        *uv = (float2) (u, v);
+        return true;
     }
+    return false;
+}
 
+// Sample the material of the i-th triangle of a leaf at a hit found by Triangle_hit. This is the
+// only place the cold part is read. Returns false if the material is not hit there.
+bool Triangle_shade(__global const int* leaf, int i, image2d_array_t atlas, MaterialPalette materialPalette, Ray ray, BiomeColors biome, float t, float2 uv, IntersectionRecord* record, MaterialSample* sample) {
+    __global const float* cold = (__global const float*) (leaf + TRIANGLE_LEAF_HEADER + TRIANGLE_HOT_SIZE * leaf[0] + TRIANGLE_COLD_SIZE * i);
+    float3 n = vload3(0, cold);
+    float2 t1 = vload2(0, cold + 3);
+    float2 t2 = vload2(0, cold + 5);
+    float2 t3 = vload2(0, cold + 7);
+    int materialIndex = as_int(cold[9]);
+
+    float w = 1 - uv.x - uv.y;
+    float2 texCoord = t1 * uv.x + t2 * uv.y + t3 * w;
+
+    Material material = Material_get(materialPalette, materialIndex);
+    int3 worldPos = intFloorFloat3(ray.origin + ray.direction * t);
+    if (Material_sample_mode(material, atlas, texCoord, false, ray.flags, worldPos, biome, sample)) {
+        record->texCoord = texCoord;
+        record->normal = n;
+        record->material = materialIndex;
+        record->distance = t;
+        return true;
+    }
     return false;
 }
 
+// Test the i-th triangle of a leaf, closer than the current record.
+bool Triangle_intersect(__global const int* leaf, int i, image2d_array_t atlas, MaterialPalette materialPalette, Ray ray, BiomeColors biome, IntersectionRecord* record, MaterialSample* sample) {
+    float t;
+    float2 uv;
+    Triangle tri = Triangle_new(leaf, i);
+    return Triangle_hit(tri, i >= leaf[1], ray.origin, ray.direction, record->distance, &t, &uv) &&
+           Triangle_shade(leaf, i, atlas, materialPalette, ray, biome, t, uv, record, sample);
+}
+
 #endif
@@ -1,15 +1,41 @@
 #ifndef CHUNKYCLPLUGIN_RANDOMNESS_H
 #define CHUNKYCLPLUGIN_RANDOMNESS_H
 
-typedef unsigned int* Random;
+typedef struct {
+    unsigned int state;
+
+    // Low discrepancy sampler state, see sampler.h
+    unsigned int index;
+    unsigned int scramble;
+    // First dimension of the current bounce, or -1 if every dimension is drawn from the PCG stream
+    int dimension;
+} RandomState;
+
+typedef RandomState* Random;
 
 // PCG hash from
 // https://www.reedbeta.com/blog/hash-functions-for-gpu-rendering/
+unsigned int Random_hash(unsigned int value) {
+    value = value * 47796405u + 2891336453u;
+    value = ((value >> ((value >> 28u) + 4u)) ^ value) * 277803737u;
+    return (value >> 22u) ^ value;
+}
+
 unsigned int Random_nextState(Random random) {
-    *random = *random * 47796405u + 2891336453u;
-    *random = ((*random >> ((*random >> 28u) + 4u)) ^ *random) * 277803737u;
-    *random = (*random >> 22u) ^ *random;
-    return *random;
+    random->state = Random_hash(random->state);
+    return random->state;
+}
+
+// Seed the state for one sample of a pixel. The sample index is hashed on its own first so the
+// samples of one pixel do not walk the same sequence as the neighbouring pixels.
+void Random_seed(Random random, unsigned int seed, unsigned int pixel, unsigned int sample) {
+    random->state = sample;
+    Random_nextState(random);
+    random->state = (random->state ^ seed) + pixel;
+    Random_nextState(random);
+    random->index = sample;
+    random->scramble = 0;
+    random->dimension = -1;
 }
 
 // Calculate the next float based on the formula on
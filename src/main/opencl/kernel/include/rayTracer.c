@@ -3,9 +3,16 @@
 #include "intersect/octree_intersect.h"
 #include "intersect/bvh_intersect.h"
 #include "intersect/closest_hit.h"
+#include "intersect/occlusion.h"
+
+#include "bvh_build.h"
 
 #include "shading/material_eval.h"
 #include "shading/emitter_sampling.h"
 #include "shading/sky_eval.h"
 
 #include "integrator/path_tracer.h"
+#include "integrator/wavefront.h"
+#include "integrator/ray_sort.h"
+#include "integrator/adaptive.h"
+#include "integrator/persistent.h"
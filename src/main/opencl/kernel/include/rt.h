@@ -5,6 +5,8 @@
 
 #define RAY_INDIRECT 0b01
 #define RAY_PREVIEW  0b10
+#define RAY_OCCLUSION 0b100
+#define RAY_OCCLUSION_OPAQUE 0b1000
 
 typedef struct {
     float3 origin;
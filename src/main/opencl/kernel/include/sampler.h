@@ -0,0 +1,126 @@
+// Low discrepancy sampler. Dimensions are drawn from a hash based Owen scrambled Sobol sequence,
+// following "Practical Hash-based Owen Scrambling" (Burley 2020). Only the first two Sobol
+// dimensions are used. Higher dimensions are padded by shuffling the sample index with a different
+// seed for each dimension, so every dimension stays stratified on its own.
+//
+// Every random decision of a path has a fixed dimension. The camera takes the first
+// SAMPLER_CAMERA_DIMENSIONS, then every bounce takes SAMPLER_BOUNCE_DIMENSIONS. When the sampler is
+// off the same calls draw from the PCG stream in random.h, in the same order as before.
+
+#ifndef CHUNKYCLPLUGIN_SAMPLER_H
+#define CHUNKYCLPLUGIN_SAMPLER_H
+
+#include "../opencl.h"
+#include "random.h"
+
+#define SAMPLER_PCG 0
+#define SAMPLER_SOBOL 1
+
+// Camera dimensions
+#define SAMPLER_PIXEL 0         // 2D
+#define SAMPLER_LENS 2          // 2D
+#define SAMPLER_CAMERA_DIMENSIONS 4
+
+// Bounce dimensions, relative to the first dimension of the bounce
+#define SAMPLER_ROULETTE 0      // 1D
+#define SAMPLER_METAL 1         // 1D
+#define SAMPLER_SPECULAR 2      // 1D
+#define SAMPLER_DIFFUSE 3       // 1D
+#define SAMPLER_FRESNEL 4       // 1D
+#define SAMPLER_BSDF 5          // 2D
+#define SAMPLER_SUN 7           // 2D
+#define SAMPLER_EMITTER 9       // 1D
+#define SAMPLER_EMITTER_FACE 10 // 1D
+#define SAMPLER_EMITTER_POINT 11 // 2D
+#define SAMPLER_BOUNCE_DIMENSIONS 13
+
+unsigned int Sampler_reverseBits(unsigned int x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Owen scramble of the bits of x, from the most significant bit down.
+unsigned int Sampler_owenScramble(unsigned int x, unsigned int seed) {
+    x = Sampler_reverseBits(x);
+    // Laine-Karras style permutation, improved constants by Burley
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return Sampler_reverseBits(x);
+}
+
+unsigned int Sampler_hashCombine(unsigned int seed, unsigned int value) {
+    return seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// The first two dimensions of the Sobol sequence.
+unsigned int Sampler_sobol0(unsigned int index) {
+    return Sampler_reverseBits(index);
+}
+
+unsigned int Sampler_sobol1(unsigned int index) {
+    unsigned int result = 0;
+    for (unsigned int v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1) result ^= v;
+    }
+    return result;
+}
+
+float Sampler_toFloat(unsigned int x) {
+    return (x >> 8) / ((float) (1 << 24));
+}
+
+// Switch to the low discrepancy sequence. The sample index must count up over all samples of the
+// pixel. The scramble seed decorrelates pixels, and must stay the same for every sample of a pixel.
+void Sampler_init(Random random, int sampler, unsigned int pixel, unsigned int sampleIndex, unsigned int seed) {
+    if (sampler != SAMPLER_SOBOL) return;
+    random->index = sampleIndex;
+    random->scramble = Random_hash(Sampler_hashCombine(Random_hash(pixel), seed));
+    random->dimension = 0;
+}
+
+// Move to the dimensions of the given bounce.
+void Sampler_startBounce(Random random, int depth) {
+    if (random->dimension < 0) return;
+    random->dimension = SAMPLER_CAMERA_DIMENSIONS + depth * SAMPLER_BOUNCE_DIMENSIONS;
+}
+
+float Sampler_next1D(Random random, int dimension) {
+    if (random->dimension < 0) {
+        return Random_nextFloat(random);
+    }
+    unsigned int seed = Random_hash(Sampler_hashCombine(random->scramble, random->dimension + dimension));
+    unsigned int index = Sampler_owenScramble(random->index, seed);
+    return Sampler_toFloat(Sampler_owenScramble(Sampler_sobol0(index), Sampler_hashCombine(seed, 1)));
+}
+
+// Draw a 2D sample from one of several streams of the same dimension, for decisions made in a loop
+// such as one sample per emitter face. Every stream is scrambled with its own seed, stream 0 is the
+// same as Sampler_next2D.
+float2 Sampler_next2DStream(Random random, int dimension, int stream) {
+    if (random->dimension < 0) {
+        float x = Random_nextFloat(random);
+        float y = Random_nextFloat(random);
+        return (float2) (x, y);
+    }
+    unsigned int seed = Random_hash(Sampler_hashCombine(random->scramble, random->dimension + dimension));
+    if (stream != 0) {
+        seed = Random_hash(Sampler_hashCombine(seed, stream));
+    }
+    unsigned int index = Sampler_owenScramble(random->index, seed);
+    return (float2) (
+            Sampler_toFloat(Sampler_owenScramble(Sampler_sobol0(index), Sampler_hashCombine(seed, 1))),
+            Sampler_toFloat(Sampler_owenScramble(Sampler_sobol1(index), Sampler_hashCombine(seed, 2)))
+    );
+}
+
+float2 Sampler_next2D(Random random, int dimension) {
+    return Sampler_next2DStream(random, dimension, 0);
+}
+
+#endif
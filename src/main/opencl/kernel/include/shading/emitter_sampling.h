@@ -1,5 +1,12 @@
 #include "kernel.h"
 
+// Emitter sampling strategies. 0-3 match Chunky's EmitterSamplingStrategy.
+#define EMITTER_SAMPLING_ONE 1
+#define EMITTER_SAMPLING_ONE_BLOCK 2
+#define EMITTER_SAMPLING_ALL 3
+// Pick one emitter from the cell alias table, weighted by power and distance
+#define EMITTER_SAMPLING_ALIAS 4
+
 float3 sampleEmitterFace(
         Scene scene,
         image2d_array_t textureAtlas,
@@ -11,12 +18,14 @@ float3 sampleEmitterFace(
         float emitterIntensity,
         bool fancierTranslucency,
         float transmissivityCap,
+        int sampleIndex,
         Random random
 ) {
     float3 localPos;
     float3 emitterNormal;
     float emitterArea;
-    float2 uv = (float2)(Random_nextFloat(random), Random_nextFloat(random));
+    // Strategies that sample several faces draw each point from its own stream
+    float2 uv = Sampler_next2DStream(random, SAMPLER_EMITTER_POINT, sampleIndex);
     if (!BlockPalette_sampleEmitterFace(scene.blockPalette, emitter.w, face, uv, &localPos, &emitterNormal, &emitterArea)) {
         return (float3)(0.0f);
     }
@@ -42,58 +51,30 @@ float3 sampleEmitterFace(
     shadowRay.currentBlock = 0;
     shadowRay.flags = RAY_INDIRECT;
 
-    float traveled = 0.0f;
-    float3 attenuation = (float3)(1.0f, 1.0f, 1.0f);
-    while (traveled < distance) {
-        IntersectionRecord record = IntersectionRecord_new();
-        MaterialSample sample;
-        Material material;
-        if (!closestIntersect(scene, textureAtlas, shadowRay, &record, &sample, &material)) {
-            return (float3)(0.0f);
-        }
-
-        traveled += record.distance;
-        if (traveled >= distance - (2.0f * OFFSET)) {
-            if (record.block != emitter.w || sample.emittance <= EPS) {
-                return (float3)(0.0f);
-            }
-            float e = fabs(dot(direction, record.normal));
-            e /= fmax(distance * distance, 1.0f);
-            e *= emitterArea;
-            e *= sample.emittance;
-            e *= emitterIntensity;
-            e *= faceScaler;
-            return attenuation * sample.color.xyz * e;
-        }
-
-        float3 transmittance = Material_translucentTransmission(
-                sample,
-                sample.color.w,
-                transmissivityCap,
-                fancierTranslucency
-        );
-        if (Material_isRefractive(material) && !Material_isOpaque(material) && sample.color.w > EPS) {
-            float colorAvg = (sample.color.x + sample.color.y + sample.color.z) / 3.0f;
-            if (colorAvg > EPS) {
-                float3 tintBoost = clamp(sample.color.xyz / colorAvg, (float3)(0.0f), (float3)(4.0f));
-                float tintMix = clamp(sample.color.w * 2.25f, 0.0f, 1.0f);
-                transmittance *= mix((float3)(1.0f), tintBoost, tintMix);
-            }
-        }
-        attenuation *= transmittance;
-        if (fmax(attenuation.x, fmax(attenuation.y, attenuation.z)) <= 1.0e-3f) {
-            return (float3)(0.0f);
-        }
+    // Everything up to the emitter only attenuates the light
+    float maxDistance = distance - (2.0f * OFFSET);
+    float4 attenuation = (float4) (1.0f);
+    OcclusionQuery query = OcclusionQuery_emitter(maxDistance, transmissivityCap, fancierTranslucency);
+    if (!Scene_occlusion(scene, textureAtlas, query, shadowRay, &attenuation)) {
+        return (float3)(0.0f);
+    }
 
-        shadowRay.prevMaterial = shadowRay.currentMaterial;
-        shadowRay.prevBlock = shadowRay.currentBlock;
-        shadowRay.currentMaterial = record.material;
-        shadowRay.currentBlock = record.block;
-        shadowRay.origin += shadowRay.direction * (record.distance + OFFSET);
-        traveled += OFFSET;
+    // Sample the emitter surface itself
+    IntersectionRecord record = IntersectionRecord_new();
+    MaterialSample sample;
+    int3 emitterPos = (int3)(emitter.x, emitter.y, emitter.z);
+    if (!BlockPalette_intersectNormalizedBlock(scene.blockPalette, textureAtlas, scene.materialPalette, scene.biome, emitter.w, emitterPos, shadowRay, &record, &sample) ||
+            record.distance < maxDistance || sample.emittance <= EPS) {
+        return (float3)(0.0f);
     }
 
-    return (float3)(0.0f);
+    float e = fabs(dot(direction, record.normal));
+    e /= fmax(distance * distance, 1.0f);
+    e *= emitterArea;
+    e *= sample.emittance;
+    e *= emitterIntensity;
+    e *= faceScaler;
+    return attenuation.xyz * sample.color.xyz * e;
 }
 
 float3 sampleEmitters(
@@ -115,9 +96,9 @@ float3 sampleEmitters(
 
     float3 result = (float3)(0.0f);
     switch (strategy) {
-        case 1:
-        case 2: {
-            int emitterListIndex = start + (int)(Random_nextFloat(random) * count);
+        case EMITTER_SAMPLING_ONE:
+        case EMITTER_SAMPLING_ONE_BLOCK: {
+            int emitterListIndex = start + (int)(Sampler_next1D(random, SAMPLER_EMITTER) * count);
             if (emitterListIndex >= start + count) {
                 emitterListIndex = start + count - 1;
             }
@@ -127,22 +108,23 @@ float3 sampleEmitters(
             if (faceCount <= 0) {
                 return (float3)(0.0f);
             }
-            if (strategy == 1) {
-                int face = (int)(Random_nextFloat(random) * faceCount);
+            if (strategy == EMITTER_SAMPLING_ONE) {
+                int face = (int)(Sampler_next1D(random, SAMPLER_EMITTER_FACE) * faceCount);
                 if (face >= faceCount) {
                     face = faceCount - 1;
                 }
-                result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, M_PI_F, emitterIntensity, fancierTranslucency, transmissivityCap, random);
+                result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, M_PI_F, emitterIntensity, fancierTranslucency, transmissivityCap, 0, random);
             } else {
                 float scaler = M_PI_F / (float) faceCount;
                 for (int face = 0; face < faceCount; face++) {
-                    result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, scaler, emitterIntensity, fancierTranslucency, transmissivityCap, random);
+                    result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, scaler, emitterIntensity, fancierTranslucency, transmissivityCap, face, random);
                 }
             }
             break;
         }
-        case 3: {
+        case EMITTER_SAMPLING_ALL: {
             float emitterScaler = M_PI_F / (float) count;
+            int sampleIndex = 0;
             for (int i = 0; i < count; i++) {
                 int emitterIndex = scene.emitterGrid.indexes[start + i];
                 int4 emitter = EmitterGrid_getEmitter(scene.emitterGrid, emitterIndex);
@@ -152,11 +134,30 @@ float3 sampleEmitters(
                 }
                 float faceScaler = emitterScaler / (float) faceCount;
                 for (int face = 0; face < faceCount; face++) {
-                    result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, faceScaler, emitterIntensity, fancierTranslucency, transmissivityCap, random);
+                    result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, faceScaler, emitterIntensity, fancierTranslucency, transmissivityCap, sampleIndex++, random);
                 }
             }
             break;
         }
+        case EMITTER_SAMPLING_ALIAS: {
+            float pdf;
+            int emitterListIndex = EmitterGrid_sampleAlias(scene.emitterGrid, start, count, Sampler_next1D(random, SAMPLER_EMITTER), &pdf);
+            if (pdf <= 0.0f) {
+                break;
+            }
+            int emitterIndex = scene.emitterGrid.indexes[emitterListIndex];
+            int4 emitter = EmitterGrid_getEmitter(scene.emitterGrid, emitterIndex);
+            int faceCount = BlockPalette_emitterFaceCount(scene.blockPalette, emitter.w);
+            if (faceCount <= 0) {
+                break;
+            }
+            int face = min((int)(Sampler_next1D(random, SAMPLER_EMITTER_FACE) * faceCount), faceCount - 1);
+
+            // Same estimate as EMITTER_SAMPLING_ALL, divided by the selection probability
+            float scaler = M_PI_F / (count * pdf);
+            result += sampleEmitterFace(scene, textureAtlas, hitPoint, shadingNormal, emitter, face, scaler, emitterIntensity, fancierTranslucency, transmissivityCap, 0, random);
+            break;
+        }
         default:
             break;
     }
@@ -5,10 +5,21 @@ float4 getDirectLightAttenuation(
         Scene scene,
         image2d_array_t textureAtlas,
         Ray ray,
-        bool strictDirectLight
+        bool strictDirectLight,
+        Random random
 ) {
     float4 attenuation = (float4) (1.0f, 1.0f, 1.0f, 1.0f);
 
+    if (!strictDirectLight) {
+        ray.origin += ray.direction * OFFSET;
+        if (!Scene_occlusion(scene, textureAtlas, OcclusionQuery_sun(), ray, &attenuation)) {
+            attenuation.w = 0.0f;
+        }
+        return attenuation;
+    }
+
+    // Strict direct light stops at every change of index of refraction, which needs the surfaces of
+    // all structures in order
     while (attenuation.w > 0.0f) {
         ray.origin += ray.direction * OFFSET;
 
@@ -16,7 +27,7 @@ float4 getDirectLightAttenuation(
         MaterialSample sample;
         Material material;
 
-        if (!closestIntersect(scene, textureAtlas, ray, &record, &sample, &material)) {
+        if (!closestIntersect(scene, textureAtlas, ray, &record, &sample, &material, random)) {
             break;
         }
 
@@ -31,12 +42,10 @@ float4 getDirectLightAttenuation(
         attenuation.z *= sample.color.z * sample.color.w + mult;
         attenuation.w *= mult;
 
-        if (strictDirectLight) {
-            Material prevMat = Material_get(scene.materialPalette, ray.prevMaterial);
-            Material currentMat = Material_get(scene.materialPalette, ray.currentMaterial);
-            if (fabs(Material_ior(prevMat) - Material_ior(currentMat)) >= EPS) {
-                attenuation.w = 0.0f;
-            }
+        Material prevMat = Material_get(scene.materialPalette, ray.prevMaterial);
+        Material currentMat = Material_get(scene.materialPalette, ray.currentMaterial);
+        if (fabs(Material_ior(prevMat) - Material_ior(currentMat)) >= EPS) {
+            attenuation.w = 0.0f;
         }
 
         ray.origin += ray.direction * record.distance;
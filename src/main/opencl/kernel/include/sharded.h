@@ -0,0 +1,63 @@
+#ifndef CHUNKYCL_SHARDED_H
+#define CHUNKYCL_SHARDED_H
+
+#include "../opencl.h"
+#include "features.h"
+
+// Int array split across several buffers to get around the device allocation limit (see
+// ClShardedIntBuffer.java). Index i is at offset i & (2^shift - 1) of shard i >> shift. Shards are
+// separate kernel arguments, unused ones alias the first shard.
+#define SHARD_COUNT 4
+
+#define SHARDED_KERNEL_ARG(name) \
+    __global const int* name, \
+    __global const int* name##1, \
+    __global const int* name##2, \
+    __global const int* name##3
+
+#define SHARDED_ARGS(name) name, name##1, name##2, name##3
+
+typedef struct {
+    __global const int* shard0;
+    __global const int* shard1;
+    __global const int* shard2;
+    __global const int* shard3;
+    int shift;
+} ShardedBuffer;
+
+ShardedBuffer ShardedBuffer_new(__global const int* shard0, __global const int* shard1,
+                                __global const int* shard2, __global const int* shard3, int shift) {
+    ShardedBuffer buffer;
+    buffer.shard0 = shard0;
+    buffer.shard1 = shard1;
+    buffer.shard2 = shard2;
+    buffer.shard3 = shard3;
+    buffer.shift = shift;
+    return buffer;
+}
+
+// A buffer that fits in one allocation, read through the sharded accessors.
+ShardedBuffer ShardedBuffer_single(__global const int* buffer) {
+    return ShardedBuffer_new(buffer, buffer, buffer, buffer, 30);
+}
+
+// Pointer to an index. Consecutive reads through it must stay in the shard.
+__global const int* ShardedBuffer_ptr(const ShardedBuffer* self, int index) {
+#if FEATURE_SHARDED
+    int shard = index >> self->shift;
+    int offset = index & ((1 << self->shift) - 1);
+    // Selects instead of a pointer array, which would end up in private memory
+    __global const int* base = shard == 0 ? self->shard0 :
+                               shard == 1 ? self->shard1 :
+                               shard == 2 ? self->shard2 : self->shard3;
+    return base + offset;
+#else
+    return self->shard0 + index;
+#endif
+}
+
+int ShardedBuffer_get(const ShardedBuffer* self, int index) {
+    return *ShardedBuffer_ptr(self, index);
+}
+
+#endif
@@ -4,7 +4,7 @@
 #include "../opencl.h"
 #include "rt.h"
 #include "textureAtlas.h"
-#include "random.h"
+#include "sampler.h"
 #include "material.h"
 
 typedef struct {
@@ -83,8 +83,9 @@ bool Sun_sampleDirection(Sun self, Ray* ray, Random random) {
 
     float radius_cos = cos(0.03f);
 
-    float x1 = Random_nextFloat(random);
-    float x2 = Random_nextFloat(random);
+    float2 x = Sampler_next2D(random, SAMPLER_SUN);
+    float x1 = x.x;
+    float x2 = x.y;
 
     float cos_a = 1 - x1 + x1 * radius_cos;
     float sin_a = sqrt(1 - cos_a * cos_a);
@@ -0,0 +1,146 @@
+#ifndef TONEMAP_DENOISE_H
+#define TONEMAP_DENOISE_H
+
+// Edge-avoiding a-trous wavelet denoiser ("Edge-Avoiding A-Trous Wavelet Transform for fast Global
+// Illumination Filtering", Dammertz et al. 2010). The color is divided by the first hit albedo so
+// textures are not blurred, filtered with a 5x5 B3 spline kernel at growing step widths, then
+// multiplied by the albedo again.
+//
+// Guides are stored in 7 floats per pixel:
+// 0-2: first hit albedo
+// 3-5: first hit normal
+// 6: first hit distance
+
+#include "../opencl.h"
+#include "double.h"
+
+#define DENOISE_GUIDE_SIZE 7
+#define DENOISE_NORMAL_PHI 64.0f
+#define DENOISE_DEPTH_PHI 0.1f
+#define DENOISE_ALBEDO_PHI 0.05f
+#define DENOISE_MIN_ALBEDO 0.01f
+// Keeps the color weight of near black pixels from vanishing
+#define DENOISE_MIN_LUMINANCE 1e-4f
+
+float3 Denoise_albedo(__global const float* guides, int pixel) {
+    return fmax(vload3(0, guides + pixel * DENOISE_GUIDE_SIZE), DENOISE_MIN_ALBEDO);
+}
+
+__kernel void denoise_load(
+        const int width,
+        const int height,
+        __global const imposter_double* input,
+        __global const float* guides,
+        __global float* color
+) {
+    int gid = get_global_id(0);
+    if (gid >= width * height) return;
+
+    float3 c = (float3) (
+            idouble_to_float(input[gid * 3 + 0]),
+            idouble_to_float(input[gid * 3 + 1]),
+            idouble_to_float(input[gid * 3 + 2])
+    );
+    vstore3(c / Denoise_albedo(guides, gid), gid, color);
+}
+
+// One a-trous iteration. The color weight is halved by the host after every iteration, and is
+// relative to the squared luminance of the pixel so bright and dark areas are smoothed alike.
+__kernel void denoise_atrous(
+        const int width,
+        const int height,
+        const int stepWidth,
+        const float colorPhi,
+        __global const float* colorIn,
+        __global const float* guides,
+        __global float* colorOut
+) {
+    int gid = get_global_id(0);
+    if (gid >= width * height) return;
+    int px = gid % width;
+    int py = gid / width;
+
+    const float kernelWeights[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    float3 color = vload3(gid, colorIn);
+    float3 albedo = vload3(0, guides + gid * DENOISE_GUIDE_SIZE);
+    float3 normal = vload3(1, guides + gid * DENOISE_GUIDE_SIZE);
+    float depth = guides[gid * DENOISE_GUIDE_SIZE + 6];
+    float luminance = dot(color, (float3) (0.2126f, 0.7152f, 0.0722f));
+    float phi = colorPhi * fmax(luminance * luminance, DENOISE_MIN_LUMINANCE);
+
+    float3 sum = (float3) (0.0f);
+    float weightSum = 0.0f;
+    for (int dy = -2; dy <= 2; dy++) {
+        int y = py + dy * stepWidth;
+        if (y < 0 || y >= height) continue;
+        for (int dx = -2; dx <= 2; dx++) {
+            int x = px + dx * stepWidth;
+            if (x < 0 || x >= width) continue;
+            int q = y * width + x;
+
+            float3 qColor = vload3(q, colorIn);
+            float3 qAlbedo = vload3(0, guides + q * DENOISE_GUIDE_SIZE);
+            float3 qNormal = vload3(1, guides + q * DENOISE_GUIDE_SIZE);
+            float qDepth = guides[q * DENOISE_GUIDE_SIZE + 6];
+
+            float3 diff = color - qColor;
+            float wColor = exp(-dot(diff, diff) / phi);
+            float wNormal = pow(fmax(dot(normal, qNormal), 0.0f), DENOISE_NORMAL_PHI);
+            float wDepth = exp(-fabs(depth - qDepth) / (DENOISE_DEPTH_PHI * fmax(depth, 1.0f) * stepWidth));
+            diff = albedo - qAlbedo;
+            float wAlbedo = exp(-dot(diff, diff) / DENOISE_ALBEDO_PHI);
+
+            float w = kernelWeights[abs(dx)] * kernelWeights[abs(dy)] * wColor * wNormal * wDepth * wAlbedo;
+            sum += qColor * w;
+            weightSum += w;
+        }
+    }
+
+    // The center pixel always has a weight, unless its own normal is missing
+    vstore3(weightSum > 0.0f ? sum / weightSum : color, gid, colorOut);
+}
+
+__kernel void denoise_store(
+        const int width,
+        const int height,
+        __global const float* color,
+        __global const float* guides,
+        __global imposter_double* output
+) {
+    int gid = get_global_id(0);
+    if (gid >= width * height) return;
+
+    float3 c = vload3(gid, color) * Denoise_albedo(guides, gid);
+    output[gid * 3 + 0] = float_to_idouble(c.x);
+    output[gid * 3 + 1] = float_to_idouble(c.y);
+    output[gid * 3 + 2] = float_to_idouble(c.z);
+}
+
+// Merge the guides of a render pass into the guide buffer. The samples are given per tile of
+// tileSize^2 pixels, a single tile covers the canvas when every pixel has the same samples.
+__kernel void denoise_merge_guides(
+        const int width,
+        const int height,
+        const int tileSize,
+        __global const int* mergedSpp,
+        __global const int* passSpp,
+        __global const float* passGuides,
+        __global float* guides
+) {
+    int gid = get_global_id(0);
+    if (gid >= width * height) return;
+
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tile = (gid / width / tileSize) * tilesX + (gid % width) / tileSize;
+    int merged = mergedSpp[tile];
+    int pass = passSpp[tile];
+    if (pass == 0) return;
+
+    float sinv = 1.0f / (merged + pass);
+    for (int i = gid * DENOISE_GUIDE_SIZE; i < (gid + 1) * DENOISE_GUIDE_SIZE; i++) {
+        guides[i] = (guides[i] * merged + passGuides[i] * pass) * sinv;
+    }
+}
+
+#endif
@@ -38,4 +38,26 @@ float idouble_to_float(imposter_double value) {
 #endif
 }
 
+/// Convert a float to an (imposter) double.
+imposter_double float_to_idouble(float value) {
+#ifdef CL_DOUBLE_SUPPORT
+    return as_ulong((double) value);
+#else
+    uint bits = as_uint(value);
+    ulong sign = (ulong) (bits >> 31) << 63;
+    uint exponent = (bits >> 23) & 0xFF;
+    ulong mantissa = (ulong) (bits & ((1u << 23) - 1)) << 29;
+
+    if (exponent == 0) {
+        // Zero or subnormal, flushed to zero
+        return sign;
+    } else if (exponent == 0xFF) {
+        // NAN or INFINITY
+        return sign | (0x7FFull << 52) | mantissa;
+    } else {
+        return sign | ((ulong) (exponent - 127 + 1023) << 52) | mantissa;
+    }
+#endif
+}
+
 #endif
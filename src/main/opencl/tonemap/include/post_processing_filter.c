@@ -1,6 +1,7 @@
 #include "../opencl.h"
 #include "double.h"
 #include "rgba.h"
+#include "denoise.h"
 
 __kernel void filter(
         const int width,